@@ -2,485 +2,600 @@
 // MIT License (see file: LICENSE)
 
 #include "offsetAllocator.hpp"
+#include "offsetAllocatorRegistry.hpp"
 
 #ifdef DEBUG
 #include <assert.h>
 #define ASSERT(x) assert(x)
-//#define DEBUG_VERBOSE
 #else
 #define ASSERT(x)
 #endif
 
-#ifdef DEBUG_VERBOSE
-#include <stdio.h>
-#endif
+#include <cstring>
+#include <bit>
+#include <atomic>
 
 #ifdef _MSC_VER
-#include <intrin.h>
+#include <io.h>
+#else
+#include <unistd.h>
 #endif
 
-#include <cstring>
-
 namespace OffsetAllocator
 {
-    inline uint32 lzcnt_nonzero(uint32 v)
+    // Flight recorder...
+    struct FlightRecorder
     {
-#ifdef _MSC_VER
-        unsigned long retVal;
-        _BitScanReverse(&retVal, v);
-        return 31 - retVal;
-#else
-        return __builtin_clz(v);
-#endif
-    }
-
-    inline uint32 tzcnt_nonzero(uint32 v)
+        enum Op : uint32
+        {
+            ALLOCATE = 0,
+            FREE = 1,
+            MERGE = 2,
+        };
+        
+        struct Event
+        {
+            uint32 op;
+            uint32 offset;
+            uint32 size;
+            uint32 node;
+        };
+        
+        // Single writer (allocator owner). Head is atomic so that a crash handler on any thread sees a sane count.
+        std::atomic<uint32> head;
+        uint32 mask;
+        Event* events;
+        
+        FlightRecorder(uint32 eventCount) : head(0), mask(eventCount - 1), events(new Event[eventCount]) {}
+        ~FlightRecorder() { delete[] events; }
+        
+        inline void record(uint32 op, uint32 offset, uint32 size, uint32 node)
+        {
+            uint32 index = head.load(std::memory_order_relaxed);
+            events[index & mask] = {.op = op, .offset = offset, .size = size, .node = node};
+            head.store(index + 1, std::memory_order_release);
+        }
+    };
+    
+    // Async-signal-safe output helpers: No stdio, no allocations
+    struct SignalSafeWriter
     {
+        int fd;
+        char buffer[128];
+        uint32 length = 0;
+        
+        SignalSafeWriter(int fd) : fd(fd) {}
+        
+        void flush()
+        {
 #ifdef _MSC_VER
-        unsigned long retVal;
-        _BitScanForward(&retVal, v);
-        return retVal;
+            _write(fd, buffer, length);
 #else
-        return __builtin_ctz(v);
+            ssize_t result = write(fd, buffer, length);
+            (void)result;
 #endif
-    }
-
-    namespace SmallFloat
-    {
-        static constexpr uint32 MANTISSA_BITS = 3;
-        static constexpr uint32 MANTISSA_VALUE = 1 << MANTISSA_BITS;
-        static constexpr uint32 MANTISSA_MASK = MANTISSA_VALUE - 1;
-    
-        // Bin sizes follow floating point (exponent + mantissa) distribution (piecewise linear log approx)
-        // This ensures that for each size class, the average overhead percentage stays the same
-        uint32 uintToFloatRoundUp(uint32 size)
+            length = 0;
+        }
+        
+        void str(const char* text)
         {
-            uint32 exp = 0;
-            uint32 mantissa = 0;
-            
-            if (size < MANTISSA_VALUE)
-            {
-                // Denorm: 0..(MANTISSA_VALUE-1)
-                mantissa = size;
-            }
-            else
+            while (*text)
             {
-                // Normalized: Hidden high bit always 1. Not stored. Just like float.
-                uint32 leadingZeros = lzcnt_nonzero(size);
-                uint32 highestSetBit = 31 - leadingZeros;
-                
-                uint32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
-                exp = mantissaStartBit + 1;
-                mantissa = (size >> mantissaStartBit) & MANTISSA_MASK;
-                
-                uint32 lowBitsMask = (1 << mantissaStartBit) - 1;
-                
-                // Round up!
-                if ((size & lowBitsMask) != 0)
-                    mantissa++;
+                if (length == sizeof(buffer)) flush();
+                buffer[length++] = *text++;
             }
-            
-            return (exp << MANTISSA_BITS) + mantissa; // + allows mantissa->exp overflow for round up
         }
-
-        uint32 uintToFloatRoundDown(uint32 size)
+        
+        void dec(uint32 value)
         {
-            uint32 exp = 0;
-            uint32 mantissa = 0;
-            
-            if (size < MANTISSA_VALUE)
-            {
-                // Denorm: 0..(MANTISSA_VALUE-1)
-                mantissa = size;
-            }
-            else
+            char digits[10];
+            uint32 count = 0;
+            do
             {
-                // Normalized: Hidden high bit always 1. Not stored. Just like float.
-                uint32 leadingZeros = lzcnt_nonzero(size);
-                uint32 highestSetBit = 31 - leadingZeros;
-                
-                uint32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
-                exp = mantissaStartBit + 1;
-                mantissa = (size >> mantissaStartBit) & MANTISSA_MASK;
-            }
+                digits[count++] = '0' + (value % 10);
+                value /= 10;
+            } while (value);
             
-            return (exp << MANTISSA_BITS) | mantissa;
+            if (length + count > sizeof(buffer)) flush();
+            while (count) buffer[length++] = digits[--count];
         }
-    
-        uint32 floatToUint(uint32 floatValue)
+        
+        void hex(uint32 value)
         {
-            uint32 exponent = floatValue >> MANTISSA_BITS;
-            uint32 mantissa = floatValue & MANTISSA_MASK;
-            if (exponent == 0)
-            {
-                // Denorms
-                return mantissa;
-            }
-            else
-            {
-                return (mantissa | MANTISSA_VALUE) << (exponent - 1);
-            }
+            static const char hexDigits[] = "0123456789abcdef";
+            if (length + 10 > sizeof(buffer)) flush();
+            buffer[length++] = '0';
+            buffer[length++] = 'x';
+            for (int shift = 28; shift >= 0; shift -= 4)
+                buffer[length++] = hexDigits[(value >> shift) & 0xf];
         }
+    };
+    
+    // Feature hooks...
+    FeatureHooks::FeatureHooks(FeatureHooks&& other) :
+        features(other.features),
+        reservedStorage(other.reservedStorage),
+        reservedAllocs(other.reservedAllocs),
+        reservationGeneration(other.reservationGeneration),
+        stateHash(other.stateHash),
+        flightRecorder(other.flightRecorder),
+        stats(other.stats),
+        tags(other.tags),
+        lifetimes(other.lifetimes),
+        allocTicks(other.allocTicks),
+        currentTag(other.currentTag),
+        sequence(other.sequence)
+    {
+        other.features = 0;
+        other.reservedStorage = 0;
+        other.reservedAllocs = 0;
+        other.reservationGeneration++; // Reservations moved with the budget
+        other.flightRecorder = nullptr;
+        other.stats = nullptr;
+        other.tags = nullptr;
+        other.lifetimes = nullptr;
+        other.allocTicks = nullptr;
     }
 
-    // Utility functions
-    uint32 findLowestSetBitAfter(uint32 bitMask, uint32 startBitIndex)
+    FeatureHooks::~FeatureHooks()
     {
-        uint32 maskBeforeStartIndex = (1 << startBitIndex) - 1;
-        uint32 maskAfterStartIndex = ~maskBeforeStartIndex;
-        uint32 bitsAfter = bitMask & maskAfterStartIndex;
-        if (bitsAfter == 0) return Allocation::NO_SPACE;
-        return tzcnt_nonzero(bitsAfter);
+        delete flightRecorder;
+        delete stats;
+        delete[] tags;
+        delete lifetimes;
+        delete[] allocTicks;
     }
 
-    // Allocator...
-    Allocator::Allocator(uint32 size, uint32 maxAllocs) :
-        m_size(size),
-        m_maxAllocs(maxAllocs),
-        m_nodes(nullptr),
-        m_freeNodes(nullptr)
+    void FeatureHooks::recordFit(uint32 size, uint32 binIndex, uint32 nodeSize)
+    {
+        uint32 minBinIndex = SmallFloat::uintToFloatRoundUp(size);
+        uint32 minTopBinIndex = minBinIndex >> TOP_BINS_INDEX_SHIFT;
+        if ((binIndex >> TOP_BINS_INDEX_SHIFT) > minTopBinIndex) stats->topBinEscalations[minTopBinIndex]++;
+        
+        AllocationStats::SizeClass& sizeClass = stats->sizeClasses[minBinIndex];
+        sizeClass.allocations++;
+        sizeClass.requestedBytes += size;
+        sizeClass.binBytes += SmallFloat::floatToUint(minBinIndex);
+        sizeClass.nodeBytes += nodeSize;
+        sizeClass.exactFits += nodeSize == size;
+    }
+
+    void FeatureHooks::recordAllocate(uint32 offset, uint32 size, uint32 nodeIndex)
     {
-        if (sizeof(NodeIndex) == 2)
+        if (features & FEATURE_STATE_HASH) stateHash += hashRegion(offset, size);
+        if (features & FEATURE_FLIGHT_RECORDER) flightRecorder->record(FlightRecorder::ALLOCATE, offset, size, nodeIndex);
+        if (features & FEATURE_TAGS) tags[nodeIndex] = {.tag = currentTag, .sequence = sequence};
+        if (features & FEATURE_LIFETIMES) allocTicks[nodeIndex] = sequence;
+        sequence++;
+    }
+
+    void FeatureHooks::recordFree(uint32 offset, uint32 size, uint32 nodeIndex)
+    {
+        if (features & FEATURE_STATE_HASH) stateHash -= hashRegion(offset, size);
+        if (features & FEATURE_FLIGHT_RECORDER) flightRecorder->record(FlightRecorder::FREE, offset, size, nodeIndex);
+        if (features & FEATURE_LIFETIMES)
         {
-            ASSERT(maxAllocs <= 65536);
+            uint32 sizeClass = SmallFloat::uintToFloatRoundUp(size);
+            lifetimes->counts[sizeClass][LifetimeHistogram::bucket(sequence - allocTicks[nodeIndex])]++;
         }
-        reset();
     }
 
-    Allocator::Allocator(Allocator &&other) :
-        m_size(other.m_size),
-        m_maxAllocs(other.m_maxAllocs),
-        m_freeStorage(other.m_freeStorage),
-        m_usedBinsTop(other.m_usedBinsTop),
-        m_nodes(other.m_nodes),
-        m_freeNodes(other.m_freeNodes),
-        m_freeOffset(other.m_freeOffset)
-    {
-        memcpy(m_usedBins, other.m_usedBins, sizeof(uint8) * NUM_TOP_BINS);
-        memcpy(m_binIndices, other.m_binIndices, sizeof(NodeIndex) * NUM_LEAF_BINS);
+    void FeatureHooks::recordMerge(uint32 offset, uint32 size, uint32 nodeIndex)
+    {
+        flightRecorder->record(FlightRecorder::MERGE, offset, size, nodeIndex);
+    }
 
-        other.m_nodes = nullptr;
-        other.m_freeNodes = nullptr;
-        other.m_freeOffset = 0;
-        other.m_maxAllocs = 0;
-        other.m_usedBinsTop = 0;
+    void FeatureHooks::onCompact(const NodeIndex* oldToNew, uint32 oldMaxAllocs, uint32 newMaxAllocs, uint32 liveNodes)
+    {
+        // Per node feature buffers follow the new node numbering
+        AllocationTag* newTags = tags ? new AllocationTag[newMaxAllocs] : nullptr;
+        uint64* newAllocTicks = allocTicks ? new uint64[newMaxAllocs] : nullptr;
+        for (uint32 i = 0; i < oldMaxAllocs; i++)
+        {
+            if (oldToNew[i] == (NodeIndex)Allocation::NO_SPACE) continue;
+            if (newTags) newTags[oldToNew[i]] = tags[i];
+            if (newAllocTicks) newAllocTicks[oldToNew[i]] = allocTicks[i];
+        }
+        if (newTags) memset(newTags + liveNodes, 0, sizeof(AllocationTag) * (newMaxAllocs - liveNodes));
+        
+        delete[] tags;
+        delete[] allocTicks;
+        tags = newTags;
+        allocTicks = newAllocTicks;
     }
 
-    void Allocator::reset()
+    // Allocator...
+    Allocator::Allocator(uint32 size, uint32 maxAllocs, const char* name) :
+        m_core(size, maxAllocs),
+        m_name(nullptr),
+        m_registrySample(nullptr),
+        m_registryPrev(nullptr),
+        m_registryNext(nullptr)
     {
-        m_freeStorage = 0;
-        m_usedBinsTop = 0;
-        m_freeOffset = m_maxAllocs - 1;
+        if (name) registerAllocator(this, name);
+    }
 
-        for (uint32 i = 0 ; i < NUM_TOP_BINS; i++)
-            m_usedBins[i] = 0;
-        
-        for (uint32 i = 0 ; i < NUM_LEAF_BINS; i++)
-            m_binIndices[i] = Node::unused;
-        
-        if (m_nodes) delete[] m_nodes;
-        if (m_freeNodes) delete[] m_freeNodes;
+    Allocator::Allocator(uint32 size, uint32 maxAllocs, const AllocationRange* allocations, uint32 count, Allocation* outAllocations) :
+        Allocator(size, maxAllocs)
+    {
+        // Invalid layout -> Stays in the start state
+        m_core.load(allocations, count, outAllocations);
+    }
 
-        m_nodes = new Node[m_maxAllocs];
-        m_freeNodes = new NodeIndex[m_maxAllocs];
-        
-        // Freelist is a stack. Nodes in inverse order so that [0] pops first.
-        for (uint32 i = 0; i < m_maxAllocs; i++)
+    Allocator::Allocator(Allocator &&other) :
+        m_core(static_cast<Core&&>(other.m_core)),
+        m_name(nullptr),
+        m_registrySample(nullptr),
+        m_registryPrev(nullptr),
+        m_registryNext(nullptr)
+    {
+        // Registration moves with the state
+        if (other.m_name)
         {
-            m_freeNodes[i] = m_maxAllocs - i - 1;
+            const char* name = other.m_name;
+            unregisterAllocator(&other);
+            registerAllocator(this, name);
         }
-        
-        // Start state: Whole storage as one big node
-        // Algorithm will split remainders and push them back as smaller nodes
-        insertNodeIntoBin(m_size, 0);
+    }
+
+    void Allocator::reset()
+    {
+        m_core.reset();
+        if (m_registrySample) publishRegistrySample();
     }
 
     Allocator::~Allocator()
     {        
-        delete[] m_nodes;
-        delete[] m_freeNodes;
+        if (m_name) unregisterAllocator(this);
     }
     
-    Allocation Allocator::allocate(uint32 size)
+    Allocation Allocator::allocate(uint32 size, Placement placement)
     {
-        // Out of allocations?
-        if (m_freeOffset == 0)
+        Allocation allocation = m_core.allocate(size, placement);
+        if (m_registrySample) publishRegistrySample();
+        return allocation;
+    }
+    
+    Reservation Allocator::reserve(uint32 size, uint32 maxAllocs)
+    {
+        // Each allocation consumes at most one node (the split remainder). See allocate().
+        // No allocs: The reservation could never be used.
+        FeatureHooks& hooks = m_core.hooks();
+        if (maxAllocs == 0 || maxAllocs > m_core.freeNodeCount() - hooks.reservedAllocs || size > m_core.freeStorage() - hooks.reservedStorage)
         {
-            return {.offset = Allocation::NO_SPACE, .metadata = Allocation::NO_SPACE};
+            return {};
         }
         
-        // Round up to bin index to ensure that alloc >= bin
-        // Gives us min bin index that fits the size
-        uint32 minBinIndex = SmallFloat::uintToFloatRoundUp(size);
-        
-        uint32 minTopBinIndex = minBinIndex >> TOP_BINS_INDEX_SHIFT;
-        uint32 minLeafBinIndex = minBinIndex & LEAF_BINS_INDEX_MASK;
-        
-        uint32 topBinIndex = minTopBinIndex;
-        uint32 leafBinIndex = Allocation::NO_SPACE;
-
-        // If top bin exists, scan its leaf bin. This can fail (NO_SPACE).
-        if (m_usedBinsTop & (1 << topBinIndex))
+        hooks.reservedStorage += size;
+        hooks.reservedAllocs += maxAllocs;
+        return {.size = size, .allocs = maxAllocs, .generation = hooks.reservationGeneration};
+    }
+    
+    Allocation Allocator::allocate(uint32 size, Reservation& reservation)
+    {
+        // Stale (made before reset)? The budget is gone.
+        FeatureHooks& hooks = m_core.hooks();
+        if (reservation.generation != hooks.reservationGeneration)
         {
-            leafBinIndex = findLowestSetBitAfter(m_usedBins[topBinIndex], minLeafBinIndex);
+            reservation = {};
+            return {};
         }
-    
-        // If we didn't find space in top bin, we search top bin from +1
-        if (leafBinIndex == Allocation::NO_SPACE)
+        
+        // Exceeds the reservation? Fail fast. Also covers failed reservations (allocs = 0).
+        if (reservation.allocs == 0 || size > reservation.size)
         {
-            topBinIndex = findLowestSetBitAfter(m_usedBinsTop, minTopBinIndex + 1);
-            
-            // Out of space?
-            if (topBinIndex == Allocation::NO_SPACE)
-            {
-                return {.offset = Allocation::NO_SPACE, .metadata = Allocation::NO_SPACE};
-            }
-
-            // All leaf bins here fit the alloc, since the top bin was rounded up. Start leaf search from bit 0.
-            // NOTE: This search can't fail since at least one leaf bit was set because the top bit was set.
-            leafBinIndex = tzcnt_nonzero(m_usedBins[topBinIndex]);
+            return {};
         }
-                
-        uint32 binIndex = (topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex;
-        
-        // Pop the top node of the bin. Bin top = node.next.
-        uint32 nodeIndex = m_binIndices[binIndex];
-        Node& node = m_nodes[nodeIndex];
-        uint32 nodeTotalSize = node.dataSize;
-        node.dataSize = size;
-        node.used = true;
-        m_binIndices[binIndex] = node.binListNext;
-        if (node.binListNext != Node::unused) m_nodes[node.binListNext].binListPrev = Node::unused;
-        m_freeStorage -= nodeTotalSize;
-#ifdef DEBUG_VERBOSE
-        printf("Free storage: %u (-%u) (allocate)\n", m_freeStorage, nodeTotalSize);
-#endif
-
-        // Bin empty?
-        if (m_binIndices[binIndex] == Node::unused)
+        
+        // Hand the reserved budget back and allocate normally
+        hooks.reservedStorage -= size;
+        hooks.reservedAllocs--;
+        
+        Allocation allocation = allocate(size);
+        if (allocation.offset == Allocation::NO_SPACE)
         {
-            // Remove a leaf bin mask bit
-            m_usedBins[topBinIndex] &= ~(1 << leafBinIndex);
-            
-            // All leaf bins empty?
-            if (m_usedBins[topBinIndex] == 0)
-            {
-                // Remove a top bin mask bit
-                m_usedBinsTop &= ~(1 << topBinIndex);
-            }
+            // Fragmentation: Keep the budget reserved for the caller
+            hooks.reservedStorage += size;
+            hooks.reservedAllocs++;
+            return allocation;
         }
         
-        // Push back reminder N elements to a lower bin
-        uint32 reminderSize = nodeTotalSize - size;
-        if (reminderSize > 0)
+        reservation.size -= size;
+        reservation.allocs--;
+        return allocation;
+    }
+    
+    void Allocator::unreserve(Reservation& reservation)
+    {
+        // Failed or stale (made before reset): Nothing reserved
+        FeatureHooks& hooks = m_core.hooks();
+        if (reservation.size == Allocation::NO_SPACE || reservation.generation != hooks.reservationGeneration)
         {
-            uint32 newNodeIndex = insertNodeIntoBin(reminderSize, node.dataOffset + size);
-            
-            // Link nodes next to each other so that we can merge them later if both are free
-            // And update the old next neighbor to point to the new node (in middle)
-            if (node.neighborNext != Node::unused) m_nodes[node.neighborNext].neighborPrev = newNodeIndex;
-            m_nodes[newNodeIndex].neighborPrev = nodeIndex;
-            m_nodes[newNodeIndex].neighborNext = node.neighborNext;
-            node.neighborNext = newNodeIndex;
+            reservation = {};
+            return;
         }
         
-        return {.offset = node.dataOffset, .metadata = nodeIndex};
+        ASSERT(hooks.reservedStorage >= reservation.size);
+        ASSERT(hooks.reservedAllocs >= reservation.allocs);
+        hooks.reservedStorage -= reservation.size;
+        hooks.reservedAllocs -= reservation.allocs;
+        reservation = {};
     }
     
     void Allocator::free(Allocation allocation)
     {
-        ASSERT(allocation.metadata != Allocation::NO_SPACE);
-        if (!m_nodes) return;
+        if (!m_core.nodes()) return;
         
-        uint32 nodeIndex = allocation.metadata;
-        Node& node = m_nodes[nodeIndex];
-        
-        // Double delete check
-        ASSERT(node.used == true);
-        
-        // Merge with neighbors...
-        uint32 offset = node.dataOffset;
-        uint32 size = node.dataSize;
+        m_core.free(allocation);
+        if (m_registrySample) publishRegistrySample();
+    }
+
+    void Allocator::free(const Allocation* allocations, uint32 count)
+    {
+        if (!m_core.nodes()) return;
         
-        if ((node.neighborPrev != Node::unused) && (m_nodes[node.neighborPrev].used == false))
-        {
-            // Previous (contiguous) free node: Change offset to previous node offset. Sum sizes
-            Node& prevNode = m_nodes[node.neighborPrev];
-            offset = prevNode.dataOffset;
-            size += prevNode.dataSize;
-            
-            // Remove node from the bin linked list and put it in the freelist
-            removeNodeFromBin(node.neighborPrev);
-            
-            ASSERT(prevNode.neighborNext == nodeIndex);
-            node.neighborPrev = prevNode.neighborPrev;
-        }
+        m_core.free(allocations, count);
+        if (m_registrySample) publishRegistrySample();
+    }
+
+    uint32 Allocator::prewarm(const uint32* sizes, const uint32* counts, uint32 n)
+    {
+        uint32 carvedCount = m_core.prewarm(sizes, counts, n);
+        if (m_registrySample) publishRegistrySample();
+        return carvedCount;
+    }
+    
+    void Allocator::unwarm()
+    {
+        if (!m_core.nodes()) return;
         
-        if ((node.neighborNext != Node::unused) && (m_nodes[node.neighborNext].used == false))
-        {
-            // Next (contiguous) free node: Offset remains the same. Sum sizes.
-            Node& nextNode = m_nodes[node.neighborNext];
-            size += nextNode.dataSize;
-            
-            // Remove node from the bin linked list and put it in the freelist
-            removeNodeFromBin(node.neighborNext);
-            
-            ASSERT(nextNode.neighborPrev == nodeIndex);
-            node.neighborNext = nextNode.neighborNext;
-        }
+        m_core.unwarm();
+        if (m_registrySample) publishRegistrySample();
+    }
 
-        uint32 neighborNext = node.neighborNext;
-        uint32 neighborPrev = node.neighborPrev;
+    uint32 Allocator::allocationSize(Allocation allocation) const
+    {
+        if (!m_core.nodes()) return 0;
         
-        // Insert the removed node to freelist
-#ifdef DEBUG_VERBOSE
-        printf("Putting node %u into freelist[%u] (free)\n", nodeIndex, m_freeOffset + 1);
-#endif
-        m_freeNodes[++m_freeOffset] = nodeIndex;
+        return m_core.allocationSize(allocation);
+    }
 
-        // Insert the (combined) free node to bin
-        uint32 combinedNodeIndex = insertNodeIntoBin(size, offset);
+    StorageReport Allocator::storageReport() const
+    {
+        return m_core.storageReport();
+    }
 
-        // Connect neighbors with the new combined node
-        if (neighborNext != Node::unused)
-        {
-            m_nodes[combinedNodeIndex].neighborNext = neighborNext;
-            m_nodes[neighborNext].neighborPrev = combinedNodeIndex;
-        }
-        if (neighborPrev != Node::unused)
+    void Allocator::publishRegistrySample()
+    {
+        // Read by registryReport on other threads: Relaxed stores, fields may come from different operations
+        StorageReport report = storageReport();
+        m_registrySample->totalFreeSpace.store(report.totalFreeSpace, std::memory_order_relaxed);
+        m_registrySample->largestFreeRegion.store(report.largestFreeRegion, std::memory_order_relaxed);
+        m_registrySample->usedNodes.store(m_core.usedNodes(), std::memory_order_relaxed);
+        m_registrySample->maxAllocs.store(m_core.maxAllocs(), std::memory_order_relaxed);
+    }
+
+    StorageReportFull Allocator::storageReportFull() const
+    {
+        StorageReportFull report;
+        for (uint32 i = 0; i < NUM_LEAF_BINS; i++)
         {
-            m_nodes[combinedNodeIndex].neighborPrev = neighborPrev;
-            m_nodes[neighborPrev].neighborNext = combinedNodeIndex;
+            uint32 count = 0;
+            uint32 nodeIndex = m_core.binHead(i);
+            while (nodeIndex != Node::unused)
+            {
+                nodeIndex = m_core.nodes()[nodeIndex].binListNext;
+                count++;
+            }
+            report.freeRegions[i] = { .size = SmallFloat::floatToUint(i), .count = count };
         }
+        return report;
     }
 
-    uint32 Allocator::insertNodeIntoBin(uint32 size, uint32 dataOffset)
+    void Allocator::enableStateHash(bool enable)
     {
-        // Round down to bin index to ensure that bin >= alloc
-        uint32 binIndex = SmallFloat::uintToFloatRoundDown(size);
+        FeatureHooks& hooks = m_core.hooks();
+        hooks.setFeature(FeatureHooks::FEATURE_STATE_HASH, enable);
+        hooks.stateHash = 0;
+        if (!enable || !m_core.nodes()) return;
         
-        uint32 topBinIndex = binIndex >> TOP_BINS_INDEX_SHIFT;
-        uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+        // Start from the live allocations, then update incrementally
+        m_core.visitNodes([&hooks](const Node& node, uint32)
+        {
+            if (node.used) hooks.stateHash += FeatureHooks::hashRegion(node.dataOffset, node.dataSize);
+        });
+    }
+    
+    void Allocator::enableAllocationStats(bool enable)
+    {
+        FeatureHooks& hooks = m_core.hooks();
+        delete hooks.stats;
+        hooks.stats = nullptr;
+        hooks.setFeature(FeatureHooks::FEATURE_STATS, enable);
+        if (!enable) return;
+        
+        hooks.stats = new AllocationStats;
+        memset(hooks.stats, 0, sizeof(AllocationStats));
+    }
+    
+    void Allocator::enableAllocationTags(bool enable)
+    {
+        FeatureHooks& hooks = m_core.hooks();
+        delete[] hooks.tags;
+        hooks.tags = nullptr;
+        hooks.setFeature(FeatureHooks::FEATURE_TAGS, enable);
+        if (!enable) return;
+        
+        // Allocations made before enabling have no tag: Sequence 0, tag 0
+        hooks.tags = new AllocationTag[m_core.maxAllocs()];
+        memset(hooks.tags, 0, sizeof(AllocationTag) * m_core.maxAllocs());
+        if (hooks.sequence == 0) hooks.sequence = 1;
+    }
+    
+    uint32 LifetimeHistogram::bucket(uint64 ticks)
+    {
+        uint32 b = (uint32)std::bit_width(ticks + 1) - 1;
+        return b < NUM_BUCKETS ? b : NUM_BUCKETS - 1;
+    }
+    
+    void Allocator::enableLifetimeHistograms(bool enable)
+    {
+        FeatureHooks& hooks = m_core.hooks();
+        delete hooks.lifetimes;
+        delete[] hooks.allocTicks;
+        hooks.lifetimes = nullptr;
+        hooks.allocTicks = nullptr;
+        hooks.setFeature(FeatureHooks::FEATURE_LIFETIMES, enable);
+        if (!enable) return;
         
-        // Bin was empty before?
-        if (m_binIndices[binIndex] == Node::unused)
+        hooks.lifetimes = new LifetimeHistogram;
+        memset(hooks.lifetimes, 0, sizeof(LifetimeHistogram));
+        hooks.allocTicks = new uint64[m_core.maxAllocs()];
+        for (uint32 i = 0; i < m_core.maxAllocs(); i++)
         {
-            // Set bin mask bits
-            m_usedBins[topBinIndex] |= 1 << leafBinIndex;
-            m_usedBinsTop |= 1 << topBinIndex;
+            hooks.allocTicks[i] = hooks.sequence;
         }
+    }
+    
+    void Allocator::ageHistogram(LifetimeHistogram& ages) const
+    {
+        memset(&ages, 0, sizeof(LifetimeHistogram));
+        const FeatureHooks& hooks = m_core.hooks();
+        if (!hooks.allocTicks) return;
         
-        // Take a freelist node and insert on top of the bin linked list (next = old top)
-        uint32 topNodeIndex = m_binIndices[binIndex];
-        uint32 nodeIndex = m_freeNodes[m_freeOffset--];
-#ifdef DEBUG_VERBOSE
-        printf("Getting node %u from freelist[%u]\n", nodeIndex, m_freeOffset + 1);
-#endif
-        m_nodes[nodeIndex] = {.dataOffset = dataOffset, .dataSize = size, .binListNext = topNodeIndex};
-        if (topNodeIndex != Node::unused) m_nodes[topNodeIndex].binListPrev = nodeIndex;
-        m_binIndices[binIndex] = nodeIndex;
+        for (uint32 i = 0; i < m_core.maxAllocs(); i++)
+        {
+            const Node& node = m_core.nodes()[i];
+            if (!node.used) continue;
+            uint32 sizeClass = SmallFloat::uintToFloatRoundUp(node.dataSize);
+            ages.counts[sizeClass][LifetimeHistogram::bucket(hooks.sequence - hooks.allocTicks[i])]++;
+        }
+    }
+    
+    void Allocator::enableFlightRecorder(uint32 eventCount)
+    {
+        FeatureHooks& hooks = m_core.hooks();
+        delete hooks.flightRecorder;
+        hooks.flightRecorder = nullptr;
+        hooks.setFeature(FeatureHooks::FEATURE_FLIGHT_RECORDER, eventCount != 0);
+        if (eventCount == 0) return;
         
-        m_freeStorage += size;
-#ifdef DEBUG_VERBOSE
-        printf("Free storage: %u (+%u) (insertNodeIntoBin)\n", m_freeStorage, size);
-#endif
-
-        return nodeIndex;
+        // Round up to pow2 for a mask based ring. Largest uint32 pow2 caps it (bit_ceil would overflow).
+        uint32 pow2Count = eventCount > MAX_FLIGHT_RECORDER_EVENTS ? MAX_FLIGHT_RECORDER_EVENTS : std::bit_ceil(eventCount);
+        hooks.flightRecorder = new FlightRecorder(pow2Count);
     }
     
-    void Allocator::removeNodeFromBin(uint32 nodeIndex)
+    void Allocator::dumpFlightRecorder(int fd) const
     {
-        Node &node = m_nodes[nodeIndex];
+        // NOTE: Called from signal handlers. Only async-signal-safe code here!
+        static const char* opNames[] = {"allocate", "free", "merge"};
+        const FlightRecorder* flightRecorder = m_core.hooks().flightRecorder;
+        SignalSafeWriter out(fd);
         
-        if (node.binListPrev != Node::unused)
+        out.str("OffsetAllocator: size=");
+        out.dec(m_core.size());
+        out.str(" maxAllocs=");
+        out.dec(m_core.maxAllocs());
+        out.str(" freeStorage=");
+        out.dec(m_core.freeStorage());
+        out.str(" freeNodes=");
+        out.dec(m_core.freeNodeCount());
+        out.str("\nusedBinsTop=");
+        out.hex(m_core.usedBinsTop());
+        out.str("\n");
+        for (uint32 i = 0; i < NUM_TOP_BINS; i++)
         {
-            // Easy case: We have previous node. Just remove this node from the middle of the list.
-            m_nodes[node.binListPrev].binListNext = node.binListNext;
-            if (node.binListNext != Node::unused) m_nodes[node.binListNext].binListPrev = node.binListPrev;
+            if (m_core.usedBins(i) == 0) continue;
+            out.str("usedBins[");
+            out.dec(i);
+            out.str("]=");
+            out.hex(m_core.usedBins(i));
+            out.str("\n");
         }
-        else
+        
+        if (flightRecorder)
         {
-            // Hard case: We are the first node in a bin. Find the bin.
-            
-            // Round down to bin index to ensure that bin >= alloc
-            uint32 binIndex = SmallFloat::uintToFloatRoundDown(node.dataSize);
-            
-            uint32 topBinIndex = binIndex >> TOP_BINS_INDEX_SHIFT;
-            uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
-            
-            m_binIndices[binIndex] = node.binListNext;
-            if (node.binListNext != Node::unused) m_nodes[node.binListNext].binListPrev = Node::unused;
-
-            // Bin empty?
-            if (m_binIndices[binIndex] == Node::unused)
+            // Oldest event first. Ring may have wrapped around.
+            uint32 head = flightRecorder->head.load(std::memory_order_acquire);
+            uint32 count = head < flightRecorder->mask + 1 ? head : flightRecorder->mask + 1;
+            out.str("events=");
+            out.dec(count);
+            out.str(" (total ");
+            out.dec(head);
+            out.str(")\n");
+            for (uint32 i = head - count; i != head; i++)
             {
-                // Remove a leaf bin mask bit
-                m_usedBins[topBinIndex] &= ~(1 << leafBinIndex);
-                
-                // All leaf bins empty?
-                if (m_usedBins[topBinIndex] == 0)
-                {
-                    // Remove a top bin mask bit
-                    m_usedBinsTop &= ~(1 << topBinIndex);
-                }
+                const FlightRecorder::Event& event = flightRecorder->events[i & flightRecorder->mask];
+                out.dec(i);
+                out.str(" ");
+                out.str(event.op <= FlightRecorder::MERGE ? opNames[event.op] : "?");
+                out.str(" offset=");
+                out.dec(event.offset);
+                out.str(" size=");
+                out.dec(event.size);
+                out.str(" node=");
+                out.dec(event.node);
+                out.str("\n");
             }
         }
-        
-        // Insert the node to freelist
-#ifdef DEBUG_VERBOSE
-        printf("Putting node %u into freelist[%u] (removeNodeFromBin)\n", nodeIndex, m_freeOffset + 1);
-#endif
-        m_freeNodes[++m_freeOffset] = nodeIndex;
-
-        m_freeStorage -= node.dataSize;
-#ifdef DEBUG_VERBOSE
-        printf("Free storage: %u (-%u) (removeNodeFromBin)\n", m_freeStorage, node.dataSize);
-#endif
+        out.flush();
     }
 
-    uint32 Allocator::allocationSize(Allocation allocation) const
+    void Allocator::visitRegions(RegionVisitor visitor, void* userData) const
     {
-        if (allocation.metadata == Allocation::NO_SPACE) return 0;
-        if (!m_nodes) return 0;
+        if (!m_core.nodes()) return;
         
-        return m_nodes[allocation.metadata].dataSize;
+        m_core.visitNodes([visitor, userData](const Node& node, uint32 nodeIndex)
+        {
+            visitor(userData, {.offset = node.dataOffset, .size = node.dataSize, .metadata = (NodeIndex)nodeIndex, .used = node.used});
+        });
     }
-
-    StorageReport Allocator::storageReport() const
+    
+    void Allocator::visitNodeRange(uint32 firstNode, uint32 nodeCount, RegionVisitor visitor, void* userData) const
     {
-        uint32 largestFreeRegion = 0;
-        uint32 freeStorage = 0;
+        if (!m_core.nodes() || firstNode >= m_core.maxAllocs()) return;
         
-        // Out of allocations? -> Zero free space
-        if (m_freeOffset > 0)
+        uint32 lastNode = nodeCount < m_core.maxAllocs() - firstNode ? firstNode + nodeCount : m_core.maxAllocs();
+        for (uint32 i = firstNode; i < lastNode; i++)
         {
-            freeStorage = m_freeStorage;
-            if (m_usedBinsTop)
-            {
-                uint32 topBinIndex = 31 - lzcnt_nonzero(m_usedBinsTop);
-                uint32 leafBinIndex = 31 - lzcnt_nonzero(m_usedBins[topBinIndex]);
-                largestFreeRegion = SmallFloat::floatToUint((topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex);
-                ASSERT(freeStorage >= largestFreeRegion);
-            }
+            // Freelist nodes are self linked
+            const Node& node = m_core.nodes()[i];
+            if (node.neighborPrev == i) continue;
+            visitor(userData, {.offset = node.dataOffset, .size = node.dataSize, .metadata = (NodeIndex)i, .used = node.used});
         }
-
-        return {.totalFreeSpace = freeStorage, .largestFreeRegion = largestFreeRegion};
     }
-
-    StorageReportFull Allocator::storageReportFull() const
+    
+    bool Allocator::compactMetadata(uint32 newMaxAllocs, NodeIndex* oldToNew, MetadataRemap remap, void* userData)
     {
-        StorageReportFull report;
-        for (uint32 i = 0; i < NUM_LEAF_BINS; i++)
+        if (!m_core.nodes()) return false;
+        
+        uint32 oldMaxAllocs = m_core.maxAllocs();
+        NodeIndex* map = oldToNew ? oldToNew : new NodeIndex[oldMaxAllocs];
+        bool compacted = m_core.compactMetadata(newMaxAllocs, map);
+        if (compacted && remap)
         {
-            uint32 count = 0;
-            uint32 nodeIndex = m_binIndices[i];
-            while (nodeIndex != Node::unused)
+            for (uint32 i = 0; i < oldMaxAllocs; i++)
             {
-                nodeIndex = m_nodes[nodeIndex].binListNext;
-                count++;
+                if (map[i] != Node::unused && map[i] != i && m_core.nodes()[map[i]].used) remap(userData, i, map[i]);
             }
-            report.freeRegions[i] = { .size = SmallFloat::floatToUint(i), .count = count };
         }
-        return report;
+        
+        if (!oldToNew) delete[] map;
+        if (compacted && m_registrySample) publishRegistrySample();
+        return compacted;
+    }
+    
+    bool Allocator::validate() const
+    {
+        if (!m_core.nodes()) return true;
+        
+        return m_core.validate();
+    }
+    
+    bool Allocator::validateNodes(uint32 firstNode, uint32 nodeCount) const
+    {
+        if (!m_core.nodes()) return true;
+        
+        return m_core.validateNodes(firstNode, nodeCount);
     }
 }
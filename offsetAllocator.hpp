@@ -1,42 +1,38 @@
 // (C) Sebastian Aaltonen 2023
 // MIT License (see file: LICENSE)
 
+#pragma once
+
 //#define USE_16_BIT_OFFSETS
 
+#include "offsetAllocatorBasic.hpp"
+
 namespace OffsetAllocator
 {
-    typedef unsigned char uint8;
-    typedef unsigned short uint16;
-    typedef unsigned int uint32;
-
-    // 16 bit offsets mode will halve the metadata storage cost
-    // But it only supports up to 65536 maximum allocation count
-#ifdef USE_16_BIT_NODE_INDICES
-    typedef uint16 NodeIndex;
-#else
-    typedef uint32 NodeIndex;
-#endif
-
-    static constexpr uint32 NUM_TOP_BINS = 32;
-    static constexpr uint32 BINS_PER_LEAF = 8;
-    static constexpr uint32 TOP_BINS_INDEX_SHIFT = 3;
-    static constexpr uint32 LEAF_BINS_INDEX_MASK = 0x7;
-    static constexpr uint32 NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
-
-    struct Allocation
-    {
-        static constexpr uint32 NO_SPACE = 0xffffffff;
-        
-        uint32 offset = NO_SPACE;
-        NodeIndex metadata = NO_SPACE; // internal: node index
-    };
+    // Bin layout of the allocator core (DefaultPolicy). Sizes the per bin arrays of the reports and dumps.
+    static constexpr uint32 NUM_TOP_BINS = BasicAllocator<DefaultPolicy>::NUM_TOP_BINS;
+    static constexpr uint32 BINS_PER_LEAF = BasicAllocator<DefaultPolicy>::BINS_PER_LEAF;
+    static constexpr uint32 TOP_BINS_INDEX_SHIFT = BasicAllocator<DefaultPolicy>::MANTISSA_BITS;
+    static constexpr uint32 LEAF_BINS_INDEX_MASK = BasicAllocator<DefaultPolicy>::LEAF_BINS_INDEX_MASK;
+    static constexpr uint32 NUM_LEAF_BINS = BasicAllocator<DefaultPolicy>::NUM_LEAF_BINS;
 
-    struct StorageReport
+    // Bin encoding of the allocator core: Size classes of the reports, stats and histograms
+    typedef BasicAllocator<DefaultPolicy>::Float SmallFloat;
+
+    typedef BasicAllocation<uint32, NodeIndex> Allocation;
+
+    struct Reservation
     {
-        uint32 totalFreeSpace;
-        uint32 largestFreeRegion;
+        uint32 size = Allocation::NO_SPACE; // NO_SPACE = reserve failed
+        uint32 allocs = 0;
+        uint32 generation = 0;              // Allocator reservation generation at reserve time
     };
 
+    // Live allocation for the bulk load constructor
+    typedef BasicAllocationRange<uint32> AllocationRange;
+
+    typedef BasicStorageReport<uint32> StorageReport;
+
     struct StorageReportFull
     {
         struct Region
@@ -48,48 +44,270 @@ namespace OffsetAllocator
         Region freeRegions[NUM_LEAF_BINS];
     };
 
+    // Contiguous used or free range of the offset space (one allocator node)
+    struct Region
+    {
+        uint32 offset;
+        uint32 size;
+        NodeIndex metadata; // internal: node index. Matches Allocation::metadata for used regions.
+        bool used;
+    };
+
+    typedef void (*RegionVisitor)(void* userData, const Region& region);
+
+    // Called for each live allocation whose metadata (node index) changed
+    typedef void (*MetadataRemap)(void* userData, NodeIndex oldMetadata, NodeIndex newMetadata);
+
+    // Internal fragmentation accounting. Indexed by the request size class (round up bin).
+    // The allocator carves exactly the requested size and returns the remainder of the node to a bin:
+    //   binBytes - requestedBytes = SmallFloat round up (the size class the bin search guarantees)
+    //   nodeBytes - requestedBytes = remainder split off the picked free node
+    struct AllocationStats
+    {
+        struct SizeClass
+        {
+            uint64 allocations;
+            uint64 requestedBytes;
+            uint64 binBytes;
+            uint64 nodeBytes;
+            uint64 exactFits;           // No remainder split
+        };
+
+        SizeClass sizeClasses[NUM_LEAF_BINS];
+        uint64 topBinEscalations[NUM_TOP_BINS]; // Requested top bin had no fitting leaf bin -> served from a higher top bin
+        uint64 failedAllocations;               // Out of space, out of nodes or fragmentation
+    };
+
+    // Per allocation tag + sequence (allocation order). Indexed by Allocation::metadata. Valid for used nodes only.
+    struct AllocationTag
+    {
+        uint32 tag;
+        uint64 sequence;
+    };
+
+    // Log2 histograms of allocation lifetimes (at free) or ages (live allocations), in allocate calls.
+    // Indexed by the request size class (round up bin). Bucket b counts [2^b - 1, 2^(b+1) - 1), last bucket is open.
+    struct LifetimeHistogram
+    {
+        static constexpr uint32 NUM_BUCKETS = 32;
+        
+        static uint32 bucket(uint64 ticks);
+        
+        uint64 counts[NUM_LEAF_BINS][NUM_BUCKETS];
+    };
+
+    struct FlightRecorder;
+    struct RegistrySample;
+    struct RegistryReport;
+    struct HeapDump;
+    class Allocator;
+
+    // Allocator features as BasicAllocator hooks: Reservations and the opt-in state hash and instrumentation.
+    // Owns the feature buffers. With every feature off each hook is a single test of the features mask.
+    struct FeatureHooks
+    {
+        enum Feature : uint32
+        {
+            FEATURE_STATE_HASH = 1 << 0,
+            FEATURE_FLIGHT_RECORDER = 1 << 1,
+            FEATURE_STATS = 1 << 2,
+            FEATURE_TAGS = 1 << 3,
+            FEATURE_LIFETIMES = 1 << 4,
+        };
+
+        uint32 features = 0; // Enabled Feature bits
+        uint32 reservedStorage = 0;
+        uint32 reservedAllocs = 0;
+        uint32 reservationGeneration = 0; // Bumped by reset: Outstanding reservations go stale
+        uint64 stateHash = 0;
+
+        FlightRecorder* flightRecorder = nullptr;
+        AllocationStats* stats = nullptr;
+        AllocationTag* tags = nullptr;
+        LifetimeHistogram* lifetimes = nullptr;
+        uint64* allocTicks = nullptr;
+        uint32 currentTag = 0;
+        uint64 sequence = 0; // Allocate calls while any feature is on: Tag sequence and lifetime tick
+
+        FeatureHooks() = default;
+        FeatureHooks(FeatureHooks&& other);
+        ~FeatureHooks();
+
+        void setFeature(Feature feature, bool enable) { features = enable ? features | feature : features & ~feature; }
+
+        uint32 nodesReserved() const { return reservedAllocs; }
+        uint64 storageReserved() const { return reservedStorage; }
+
+        // Hot path: Feature mask test inline, enabled features out of line
+        void onFit(uint64 size, uint32 binIndex, uint64 nodeSize)
+        {
+            if (features & FEATURE_STATS) recordFit((uint32)size, binIndex, (uint32)nodeSize);
+        }
+        void onAllocate(uint64 offset, uint64 size, uint32 nodeIndex)
+        {
+            if (features) recordAllocate((uint32)offset, (uint32)size, nodeIndex);
+        }
+        void onFree(uint64 offset, uint64 size, uint32 nodeIndex)
+        {
+            if (features) recordFree((uint32)offset, (uint32)size, nodeIndex);
+        }
+        void onMerge(uint64 offset, uint64 size, uint32 nodeIndex)
+        {
+            if (features & FEATURE_FLIGHT_RECORDER) recordMerge((uint32)offset, (uint32)size, nodeIndex);
+        }
+        void onFailure(uint64)
+        {
+            if (features & FEATURE_STATS) stats->failedAllocations++;
+        }
+        void onReset()
+        {
+            reservedStorage = 0;
+            reservedAllocs = 0;
+            reservationGeneration++;
+            stateHash = 0;
+        }
+        void onCompact(const NodeIndex* oldToNew, uint32 oldMaxAllocs, uint32 newMaxAllocs, uint32 liveNodes);
+
+        // Region hash (splitmix64 finalizer). Summed over all used nodes -> order independent and O(1) to update.
+        static uint64 hashRegion(uint32 offset, uint32 size)
+        {
+            uint64 x = ((uint64)offset << 32) | size;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+
+    private:
+        void recordFit(uint32 size, uint32 binIndex, uint32 nodeSize);
+        void recordAllocate(uint32 offset, uint32 size, uint32 nodeIndex);
+        void recordFree(uint32 offset, uint32 size, uint32 nodeIndex);
+        void recordMerge(uint32 offset, uint32 size, uint32 nodeIndex);
+    };
+
+    // Process wide allocator registry (see offsetAllocatorRegistry.hpp). Opt-in: Named allocators register
+    // themselves, others can be registered explicitly. Registered allocators unregister in the destructor.
+    // The name is not copied: It must outlive the registration.
+    void registerAllocator(Allocator* allocator, const char* name);
+    void unregisterAllocator(Allocator* allocator);
+    void registryReport(RegistryReport& report);
+
+    // BasicAllocator<DefaultPolicy, FeatureHooks> + the runtime feature API and registry membership
     class Allocator
     {
     public:
-        Allocator(uint32 size, uint32 maxAllocs = 128 * 1024);
+        // Non null name registers the allocator in the process wide registry
+        Allocator(uint32 size, uint32 maxAllocs = 128 * 1024, const char* name = nullptr);
         Allocator(Allocator &&other);
+        
+        // Bulk load: Allocator in the state where exactly the given allocations are live. Linear pass, no searches.
+        // Allocations sorted by offset, non overlapping, inside size. outAllocations (optional) receives their handles.
+        // Needs count + gaps + 1 nodes (free tail included) below maxAllocs. Otherwise the allocator stays empty
+        // (as constructed without a layout) and all outAllocations are NO_SPACE.
+        Allocator(uint32 size, uint32 maxAllocs, const AllocationRange* allocations, uint32 count, Allocation* outAllocations = nullptr);
         ~Allocator();
         void reset();
         
-        Allocation allocate(uint32 size);
+        Allocation allocate(uint32 size, Placement placement = PLACE_LOW);
         void free(Allocation allocation);
+        
+        // Batch free: Each run of contiguous free space (batch members + free neighbors) is merged with one bin insert
+        void free(const Allocation* allocations, uint32 count);
+
+        // Reservations subtract from the allocatable budget (free space + free nodes) without placing anything.
+        // Allocations without a reservation fail instead of eating into the reserved budget.
+        // NOTE: Budget only, not placement. A reserved allocation still needs a free region that fits: With the free
+        // space fragmented, allocate(size, reservation) returns NO_SPACE although the budget covers it. The
+        // reservation keeps its budget on failure. Callers must handle NO_SPACE (smaller allocations, compaction).
+        // reserve fails for maxAllocs = 0. reset() makes outstanding reservations stale: Allocating from a stale
+        // reservation fails, unreserving it does nothing.
+        Reservation reserve(uint32 size, uint32 maxAllocs);
+        Allocation allocate(uint32 size, Reservation& reservation);
+        void unreserve(Reservation& reservation);
+
+        // Warmup: Carve free nodes of the expected sizes (counts[i] of sizes[i]) up front and leave them unmerged.
+        // While warm, allocate probes the size's round down bin first: A prewarmed exact size node is taken without
+        // a remainder split. Returns the number of nodes carved. unwarm() coalesces the prewarmed nodes left free.
+        uint32 prewarm(const uint32* sizes, const uint32* counts, uint32 n);
+        void unwarm();
 
         uint32 allocationSize(Allocation allocation) const;
         StorageReport storageReport() const;
         StorageReportFull storageReportFull() const;
+
+        // Visits all used and free regions in offset order (walks the neighbor chain). O(maxAllocs).
+        void visitRegions(RegionVisitor visitor, void* userData) const;
+        
+        // Visits the regions of a node index range in index order (no offset order). Use it to spread a walk over
+        // many frames: Like validateNodes, node index ranges stay valid while the allocator changes.
+        void visitNodeRange(uint32 firstNode, uint32 nodeCount, RegionVisitor visitor, void* userData) const;
+        uint32 size() const { return m_core.size(); }
+
+        // Renumbers live nodes into a dense prefix (old index order) and shrinks the node arrays to newMaxAllocs.
+        // Live allocation metadata changes: oldToNew (optional, old maxAllocs entries, NO_SPACE = dead node)
+        // receives the full map, remap (optional) is called per moved allocation. O(maxAllocs).
+        // Fails (no change) if newMaxAllocs can't hold the live nodes + reserved nodes + 1.
+        bool compactMetadata(uint32 newMaxAllocs, NodeIndex* oldToNew = nullptr, MetadataRemap remap = nullptr, void* userData = nullptr);
+
+        // Consistency checks: Neighbor links, bin lists, bin masks and totals.
+        // validateNodes checks a node index range only. Use it to spread the check over many frames.
+        bool validate() const;
+        bool validateNodes(uint32 firstNode, uint32 nodeCount) const;
+        uint32 maxAllocs() const { return m_core.maxAllocs(); }
+        const char* name() const { return m_name; }
+
+        // Order independent hash of all used (offset, size) regions. Updated incrementally in O(1).
+        // Deterministic replicas have equal hashes as long as they have equal heap layouts.
+        // Free regions follow from the used ones: Splitting free space (prewarm) doesn't change the hash.
+        // Off by default (returns 0). Enabling hashes the live allocations once, O(maxAllocs).
+        void enableStateHash(bool enable);
+        bool stateHashEnabled() const { return m_core.hooks().features & FeatureHooks::FEATURE_STATE_HASH; }
+        uint64 stateHash() const { return m_core.hooks().stateHash; }
+
+        // Allocation stats: Off by default. Enabling (re)starts counting from zero. Returns nullptr when disabled.
+        void enableAllocationStats(bool enable);
+        const AllocationStats* allocationStats() const { return m_core.hooks().stats; }
+
+        // Allocation tags: Off by default. New allocations get the current tag and the next sequence number.
+        // Returns nullptr when disabled.
+        void enableAllocationTags(bool enable);
+        const AllocationTag* allocationTags() const { return m_core.hooks().tags; }
+        void setCurrentTag(uint32 tag) { m_core.hooks().currentTag = tag; }
+        void setAllocationTag(Allocation allocation, uint32 tag) { if (m_core.hooks().tags) m_core.hooks().tags[allocation.metadata].tag = tag; }
+
+        // Lifetime histograms: Off by default. Each allocation records its allocate tick (allocate call counter),
+        // frees add the lifetime to lifetimeHistogram(). Enabling (re)starts counting. Allocations live at enable
+        // time count their age from there. Returns nullptr when disabled.
+        void enableLifetimeHistograms(bool enable);
+        const LifetimeHistogram* lifetimeHistogram() const { return m_core.hooks().lifetimes; }
+        
+        // Ages of the live allocations (now - allocate tick). O(maxAllocs). Zeroes when disabled.
+        void ageHistogram(LifetimeHistogram& ages) const;
+
+        // Flight recorder: Ring of the most recent allocate/free/merge events. Off by default.
+        // Event count is rounded up to pow2, clamped to MAX_FLIGHT_RECORDER_EVENTS.
+        // Dump is async-signal-safe (write to fd only, no allocations).
+        static constexpr uint32 MAX_FLIGHT_RECORDER_EVENTS = 1u << 31;
+        void enableFlightRecorder(uint32 eventCount);
+        void dumpFlightRecorder(int fd) const;
         
     private:
-        uint32 insertNodeIntoBin(uint32 size, uint32 dataOffset);
-        void removeNodeFromBin(uint32 nodeIndex);
+        friend void registerAllocator(Allocator* allocator, const char* name);
+        friend void unregisterAllocator(Allocator* allocator);
+        friend void registryReport(RegistryReport& report);
+        friend bool captureHeapDump(const Allocator& allocator, HeapDump& dump);
 
-        struct Node
-        {
-            static constexpr NodeIndex unused = 0xffffffff;
-            
-            uint32 dataOffset = 0;
-            uint32 dataSize = 0;
-            NodeIndex binListPrev = unused;
-            NodeIndex binListNext = unused;
-            NodeIndex neighborPrev = unused;
-            NodeIndex neighborNext = unused;
-            bool used = false; // TODO: Merge as bit flag
-        };
-    
-        uint32 m_size;
-        uint32 m_maxAllocs;
-        uint32 m_freeStorage;
-
-        uint32 m_usedBinsTop;
-        uint8 m_usedBins[NUM_TOP_BINS];
-        NodeIndex m_binIndices[NUM_LEAF_BINS];
-                
-        Node* m_nodes;
-        NodeIndex* m_freeNodes;
-        uint32 m_freeOffset;
+        typedef BasicAllocator<DefaultPolicy, FeatureHooks> Core;
+        typedef Core::Node Node;
+        static_assert(Core::NUM_TOP_BINS == NUM_TOP_BINS && Core::NUM_LEAF_BINS == NUM_LEAF_BINS);
+
+        void publishRegistrySample();
+
+        Core m_core;
+
+        // Registry: Intrusive list, guarded by the registry mutex. Name is null when not registered.
+        const char* m_name;
+        RegistrySample* m_registrySample;
+        Allocator* m_registryPrev;
+        Allocator* m_registryNext;
     };
 }
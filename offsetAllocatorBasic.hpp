@@ -0,0 +1,1067 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include <bit>
+#include <type_traits>
+
+#ifdef DEBUG
+#include <assert.h>
+#define OFFSET_ALLOCATOR_BASIC_ASSERT(x) assert(x)
+#else
+#define OFFSET_ALLOCATOR_BASIC_ASSERT(x)
+#endif
+
+// Hot path helpers are inlined into allocate/free: A wrapper calling them pays a single call, like a hand written allocator
+#ifdef _MSC_VER
+#define OFFSET_ALLOCATOR_FORCE_INLINE __forceinline
+#else
+#define OFFSET_ALLOCATOR_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace OffsetAllocator
+{
+    typedef unsigned char uint8;
+    typedef unsigned short uint16;
+    typedef unsigned int uint32;
+    typedef unsigned long long uint64;
+
+    // 16 bit offsets mode will halve the metadata storage cost
+    // But it only supports up to 65536 maximum allocation count
+#ifdef USE_16_BIT_NODE_INDICES
+    typedef uint16 NodeIndex;
+#else
+    typedef uint32 NodeIndex;
+#endif
+
+    // Which end of the chosen free node an allocation is carved from. The remainder stays free at the other end.
+    enum Placement : uint8
+    {
+        PLACE_LOW = 0,
+        PLACE_HIGH = 1,
+    };
+
+    // Header only allocator core, specialized at compile time by a policy:
+    //   Index                  Node index type (metadata). uint16 halves the node size, max 65535 allocations.
+    //   Offset                 Offset/size type: uint16, uint32 or uint64.
+    //   MANTISSA_BITS          Bin encoding: SmallFloat mantissa bits (1..5). More bits = finer size classes.
+    //   BIN_ORDER              LIFO (hot reuse, default) or FIFO (oldest free node first) inside a bin.
+    //   Storage<Node, Index>   Node + freelist storage: HeapStorage (runtime maxAllocs) or InlineStorage<N>::Type.
+    //   Hooks                  Instrumentation and reserved budget, see NoHooks. Can also be given as 2nd template argument.
+    // Allocator is BasicAllocator<DefaultPolicy, FeatureHooks>: Reservations, stats, tags, lifetimes, flight recorder
+    // and the state hash are its hooks. BasicAllocator<> (NoHooks) is the same core with all of them compiled away.
+
+    enum class BinOrder : uint8
+    {
+        LIFO = 0,
+        FIFO = 1,
+    };
+
+    // Hook interface. Derive from NoHooks and hide the hooks you need, the rest compile away.
+    //   nodesReserved, storageReserved     Budget allocate() must leave untouched (reservations)
+    //   onFit(size, binIndex, nodeSize)    Bin picked for a request, node size before the remainder split
+    //   onAllocate/onFree(offset, size, nodeIndex)
+    //   onMerge(offset, size, nodeIndex)   Free neighbor absorbed by a free
+    //   onFailure(size)                    Out of space, out of nodes or fragmentation
+    //   onReset, onCompact                 State reset, node renumbering (compactMetadata)
+    struct NoHooks
+    {
+        uint32 nodesReserved() const { return 0; }
+        uint64 storageReserved() const { return 0; }
+
+        void onFit(uint64, uint32, uint64) {}
+        void onAllocate(uint64, uint64, uint32) {}
+        void onFree(uint64, uint64, uint32) {}
+        void onMerge(uint64, uint64, uint32) {}
+        void onFailure(uint64) {}
+        void onReset() {}
+        template<typename Index> void onCompact(const Index*, uint32, uint32, uint32) {}
+    };
+
+    template<typename Node, typename Index>
+    class HeapStorage
+    {
+    public:
+        HeapStorage() = default;
+        HeapStorage(const HeapStorage&) = delete;
+        HeapStorage(HeapStorage&& other) : m_nodes(other.m_nodes), m_freeNodes(other.m_freeNodes)
+        {
+            other.m_nodes = nullptr;
+            other.m_freeNodes = nullptr;
+        }
+        ~HeapStorage()
+        {
+            delete[] m_nodes;
+            delete[] m_freeNodes;
+        }
+
+        void init(uint32 maxAllocs)
+        {
+            delete[] m_nodes;
+            delete[] m_freeNodes;
+            m_nodes = new Node[maxAllocs];
+            m_freeNodes = new Index[maxAllocs];
+        }
+
+        // New capacity, keeps the first keepNodes nodes. Freelist content is not kept.
+        void resize(uint32 maxAllocs, uint32 keepNodes)
+        {
+            Node* nodes = new Node[maxAllocs];
+            for (uint32 i = 0; i < keepNodes; i++) nodes[i] = m_nodes[i];
+            delete[] m_nodes;
+            delete[] m_freeNodes;
+            m_nodes = nodes;
+            m_freeNodes = new Index[maxAllocs];
+        }
+
+        Node* nodes() { return m_nodes; }
+        const Node* nodes() const { return m_nodes; }
+        Index* freeNodes() { return m_freeNodes; }
+        const Index* freeNodes() const { return m_freeNodes; }
+
+    private:
+        Node* m_nodes = nullptr;
+        Index* m_freeNodes = nullptr;
+    };
+
+    // No heap allocations: Metadata lives inside the allocator object
+    template<uint32 MaxAllocs>
+    struct InlineStorage
+    {
+        template<typename Node, typename Index>
+        class Type
+        {
+        public:
+            void init(uint32 maxAllocs) { OFFSET_ALLOCATOR_BASIC_ASSERT(maxAllocs <= MaxAllocs); }
+            void resize(uint32 maxAllocs, uint32) { OFFSET_ALLOCATOR_BASIC_ASSERT(maxAllocs <= MaxAllocs); }
+
+            Node* nodes() { return m_nodes; }
+            const Node* nodes() const { return m_nodes; }
+            Index* freeNodes() { return m_freeNodes; }
+            const Index* freeNodes() const { return m_freeNodes; }
+
+        private:
+            Node m_nodes[MaxAllocs];
+            Index m_freeNodes[MaxAllocs];
+        };
+    };
+
+    struct DefaultPolicy
+    {
+        using Index = NodeIndex;
+        using Offset = uint32;
+        static constexpr uint32 MANTISSA_BITS = 3;
+        static constexpr BinOrder BIN_ORDER = BinOrder::LIFO;
+        template<typename Node, typename IndexType> using Storage = HeapStorage<Node, IndexType>;
+        using Hooks = NoHooks;
+    };
+
+    // Index of the lowest set bit at or after startBitIndex. BIT_NOT_FOUND if none.
+    static constexpr uint32 BIT_NOT_FOUND = 0xffffffff;
+
+    template<typename Mask>
+    inline uint32 findLowestSetBitAfter(Mask bitMask, uint32 startBitIndex)
+    {
+        if (startBitIndex >= sizeof(Mask) * 8) return BIT_NOT_FOUND;
+        Mask bitsAfter = bitMask & (Mask)~(((Mask)1 << startBitIndex) - 1);
+        if (bitsAfter == 0) return BIT_NOT_FOUND;
+        return std::countr_zero(bitsAfter);
+    }
+
+    // SmallFloat bin encoding for any offset width and mantissa size.
+    // Bin sizes follow floating point (exponent + mantissa) distribution (piecewise linear log approx).
+    // This ensures that for each size class, the average overhead percentage stays the same.
+    // Sizes below MANTISSA_VALUE are denorms (exponent 0). Normalized: Hidden high bit always 1, not stored, just like float.
+    template<typename Offset, uint32 MANTISSA_BITS>
+    struct BasicSmallFloat
+    {
+        static constexpr uint32 MANTISSA_VALUE = 1 << MANTISSA_BITS;
+        static constexpr uint32 MANTISSA_MASK = MANTISSA_VALUE - 1;
+        static constexpr uint32 OFFSET_BITS = sizeof(Offset) * 8;
+
+        static uint32 uintToFloatRoundUp(Offset size)
+        {
+            if (size < MANTISSA_VALUE) return (uint32)size;
+
+            uint32 highestSetBit = OFFSET_BITS - 1 - std::countl_zero(size);
+            uint32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
+            uint32 exp = mantissaStartBit + 1;
+            uint32 mantissa = (uint32)(size >> mantissaStartBit) & MANTISSA_MASK;
+
+            // Round up!
+            Offset lowBitsMask = (Offset)(((Offset)1 << mantissaStartBit) - 1);
+            if ((size & lowBitsMask) != 0) mantissa++;
+
+            return (exp << MANTISSA_BITS) + mantissa; // + allows mantissa->exp overflow for round up
+        }
+
+        static uint32 uintToFloatRoundDown(Offset size)
+        {
+            if (size < MANTISSA_VALUE) return (uint32)size;
+
+            uint32 highestSetBit = OFFSET_BITS - 1 - std::countl_zero(size);
+            uint32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
+            uint32 exp = mantissaStartBit + 1;
+            uint32 mantissa = (uint32)(size >> mantissaStartBit) & MANTISSA_MASK;
+            return (exp << MANTISSA_BITS) | mantissa;
+        }
+
+        static Offset floatToUint(uint32 floatValue)
+        {
+            uint32 exponent = floatValue >> MANTISSA_BITS;
+            uint32 mantissa = floatValue & MANTISSA_MASK;
+            if (exponent == 0) return (Offset)mantissa; // Denorms
+            return (Offset)((Offset)(mantissa | MANTISSA_VALUE) << (exponent - 1));
+        }
+    };
+
+    template<typename Offset, typename Index>
+    struct BasicAllocation
+    {
+        static constexpr Offset NO_SPACE = (Offset)~(Offset)0;
+
+        Offset offset = NO_SPACE;
+        Index metadata = (Index)~(Index)0; // internal: node index
+    };
+
+    // Live allocation for the bulk load (see BasicAllocator::load)
+    template<typename Offset>
+    struct BasicAllocationRange
+    {
+        Offset offset;
+        Offset size;
+    };
+
+    template<typename Offset>
+    struct BasicStorageReport
+    {
+        Offset totalFreeSpace;
+        Offset largestFreeRegion;
+    };
+
+    template<typename Policy = DefaultPolicy, typename PolicyHooks = typename Policy::Hooks>
+    class BasicAllocator
+    {
+    public:
+        using Index = typename Policy::Index;
+        using Offset = typename Policy::Offset;
+        using Allocation = BasicAllocation<Offset, Index>;
+        using AllocationRange = BasicAllocationRange<Offset>;
+        using StorageReport = BasicStorageReport<Offset>;
+        using Hooks = PolicyHooks;
+        using Float = BasicSmallFloat<Offset, Policy::MANTISSA_BITS>;
+
+        static constexpr uint32 MANTISSA_BITS = Policy::MANTISSA_BITS;
+        static constexpr uint32 BINS_PER_LEAF = 1 << MANTISSA_BITS;
+        static constexpr uint32 LEAF_BINS_INDEX_MASK = BINS_PER_LEAF - 1;
+        static constexpr uint32 NUM_TOP_BINS = sizeof(Offset) * 8 - MANTISSA_BITS + 2; // Round up may overflow the top exponent
+        static constexpr uint32 NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
+
+        static_assert(MANTISSA_BITS >= 1 && MANTISSA_BITS <= 5, "Leaf bin masks hold up to 32 bins");
+        static_assert(NUM_TOP_BINS <= 64, "Top bin mask holds up to 64 bins");
+        static_assert(std::is_unsigned_v<Offset> && std::is_unsigned_v<Index>);
+
+        using TopMask = std::conditional_t<(NUM_TOP_BINS <= 32), uint32, uint64>;
+        using LeafMask = std::conditional_t<(BINS_PER_LEAF <= 8), uint8, std::conditional_t<(BINS_PER_LEAF <= 16), uint16, uint32>>;
+
+        struct Node
+        {
+            static constexpr Index unused = (Index)~(Index)0;
+
+            Offset dataOffset = 0;
+            Offset dataSize = 0;
+            Index binListPrev = unused;
+            Index binListNext = unused;
+            Index neighborPrev = unused;
+            Index neighborNext = unused;
+            bool used = false;
+        };
+
+        BasicAllocator(Offset size, uint32 maxAllocs = 128 * 1024) : m_size(size), m_maxAllocs(maxAllocs)
+        {
+            OFFSET_ALLOCATOR_BASIC_ASSERT(maxAllocs <= Node::unused);
+            reset();
+        }
+
+        // Moved from allocator has no free nodes: Allocations fail
+        BasicAllocator(BasicAllocator&& other) :
+            m_size(other.m_size),
+            m_maxAllocs(other.m_maxAllocs),
+            m_freeStorage(other.m_freeStorage),
+            m_usedBinsTop(other.m_usedBinsTop),
+            m_storage(static_cast<Storage&&>(other.m_storage)),
+            m_freeOffset(other.m_freeOffset),
+            m_prewarmed(other.m_prewarmed),
+            m_hooks(static_cast<Hooks&&>(other.m_hooks))
+        {
+            for (uint32 i = 0; i < NUM_TOP_BINS; i++) m_usedBins[i] = other.m_usedBins[i];
+            for (uint32 i = 0; i < NUM_LEAF_BINS; i++) m_binIndices[i] = other.m_binIndices[i];
+            for (uint32 i = 0; i < sizeof(m_binTails) / sizeof(Index); i++) m_binTails[i] = other.m_binTails[i];
+
+            other.m_maxAllocs = 0;
+            other.m_freeStorage = 0;
+            other.m_usedBinsTop = 0;
+            other.m_freeOffset = 0;
+        }
+
+        void reset()
+        {
+            m_freeStorage = 0;
+            m_usedBinsTop = 0;
+            m_freeOffset = m_maxAllocs - 1;
+            m_prewarmed = false;
+            for (uint32 i = 0; i < NUM_TOP_BINS; i++) m_usedBins[i] = 0;
+            for (uint32 i = 0; i < NUM_LEAF_BINS; i++) m_binIndices[i] = Node::unused;
+            for (Index& tail : m_binTails) tail = Node::unused;
+
+            m_storage.init(m_maxAllocs);
+            Node* nodes = m_storage.nodes();
+            Index* freeNodes = m_storage.freeNodes();
+
+            // Freelist is a stack. Nodes in inverse order so that [0] pops first.
+            // Freelist nodes are self linked. This tells them apart from live nodes (see validateNodes).
+            for (uint32 i = 0; i < m_maxAllocs; i++)
+            {
+                freeNodes[i] = (Index)(m_maxAllocs - i - 1);
+                nodes[i] = {};
+                nodes[i].neighborPrev = nodes[i].neighborNext = (Index)i;
+            }
+
+            // Start state: Whole storage as one big node
+            insertNodeIntoBin(m_size, 0);
+            m_hooks.onReset();
+        }
+
+        OFFSET_ALLOCATOR_FORCE_INLINE Allocation allocate(Offset size, Placement placement = PLACE_LOW)
+        {
+            Node* nodes = m_storage.nodes();
+
+            // Out of allocations or would eat into the reserved budget? Fail fast.
+            // Without reserved storage the bin search is the space check: Hooks without reservations pay nothing extra.
+            Offset storageReserved = (Offset)m_hooks.storageReserved();
+            if (m_freeOffset <= m_hooks.nodesReserved() || (storageReserved && size > m_freeStorage - storageReserved))
+            {
+                m_hooks.onFailure(size);
+                return {};
+            }
+
+            // Round up to bin index to ensure that alloc >= bin. Gives us min bin index that fits the size.
+            uint32 minBinIndex = Float::uintToFloatRoundUp(size);
+            uint32 binIndex = NO_BIT;
+
+            // Prewarmed: Exact size nodes sit in the round down bin. Take its top node if it fits.
+            if (m_prewarmed)
+            {
+                uint32 exactBinIndex = Float::uintToFloatRoundDown(size);
+                Index exactNodeIndex = m_binIndices[exactBinIndex];
+                if (exactBinIndex != minBinIndex && exactNodeIndex != Node::unused && nodes[exactNodeIndex].dataSize >= size)
+                {
+                    binIndex = exactBinIndex;
+                }
+            }
+
+            if (binIndex == NO_BIT)
+            {
+                binIndex = findBin(minBinIndex);
+
+                // Out of space?
+                if (binIndex == NO_BIT)
+                {
+                    m_hooks.onFailure(size);
+                    return {};
+                }
+            }
+
+            m_hooks.onFit(size, binIndex, nodes[m_binIndices[binIndex]].dataSize);
+            uint32 nodeIndex = takeNode(binIndex, size, placement);
+            const Node& node = nodes[nodeIndex];
+            m_hooks.onAllocate(node.dataOffset, size, nodeIndex);
+            return {.offset = node.dataOffset, .metadata = (Index)nodeIndex};
+        }
+
+        OFFSET_ALLOCATOR_FORCE_INLINE void free(Allocation allocation)
+        {
+            OFFSET_ALLOCATOR_BASIC_ASSERT(allocation.metadata != Node::unused);
+            Node* nodes = m_storage.nodes();
+            uint32 nodeIndex = allocation.metadata;
+            Node& node = nodes[nodeIndex];
+
+            // Double delete check
+            OFFSET_ALLOCATOR_BASIC_ASSERT(node.used == true);
+            m_hooks.onFree(node.dataOffset, node.dataSize, nodeIndex);
+
+            // Merge with neighbors...
+            Offset offset = node.dataOffset;
+            Offset size = node.dataSize;
+
+            if ((node.neighborPrev != Node::unused) && (nodes[node.neighborPrev].used == false))
+            {
+                // Previous (contiguous) free node: Change offset to previous node offset. Sum sizes
+                Node& prevNode = nodes[node.neighborPrev];
+                m_hooks.onMerge(prevNode.dataOffset, prevNode.dataSize, node.neighborPrev);
+                offset = prevNode.dataOffset;
+                size += prevNode.dataSize;
+
+                // Remove node from the bin linked list and put it in the freelist
+                Index prevNodeIndex = node.neighborPrev;
+                removeNodeFromBin(prevNodeIndex);
+                OFFSET_ALLOCATOR_BASIC_ASSERT(prevNode.neighborNext == nodeIndex);
+                node.neighborPrev = prevNode.neighborPrev;
+                prevNode.neighborPrev = prevNode.neighborNext = prevNodeIndex;
+            }
+
+            if ((node.neighborNext != Node::unused) && (nodes[node.neighborNext].used == false))
+            {
+                // Next (contiguous) free node: Offset remains the same. Sum sizes.
+                Node& nextNode = nodes[node.neighborNext];
+                m_hooks.onMerge(nextNode.dataOffset, nextNode.dataSize, node.neighborNext);
+                size += nextNode.dataSize;
+
+                // Remove node from the bin linked list and put it in the freelist
+                Index nextNodeIndex = node.neighborNext;
+                removeNodeFromBin(nextNodeIndex);
+                OFFSET_ALLOCATOR_BASIC_ASSERT(nextNode.neighborPrev == nodeIndex);
+                node.neighborNext = nextNode.neighborNext;
+                nextNode.neighborPrev = nextNode.neighborNext = nextNodeIndex;
+            }
+
+            Index neighborNext = node.neighborNext;
+            Index neighborPrev = node.neighborPrev;
+
+            // Insert the removed node to freelist, then the (combined) free node to bin
+            m_storage.freeNodes()[++m_freeOffset] = (Index)nodeIndex;
+            uint32 combinedNodeIndex = insertNodeIntoBin(size, offset);
+            linkNeighbors(combinedNodeIndex, neighborPrev, neighborNext);
+        }
+
+        // Batch free: Each run of contiguous free space (batch members + free neighbors) is merged with one bin insert
+        void free(const Allocation* allocations, uint32 count)
+        {
+            Node* nodes = m_storage.nodes();
+
+            // Mark the whole batch free first. Pending nodes are not in a bin yet: Self linked bin list marks them.
+            for (uint32 i = 0; i < count; i++)
+            {
+                OFFSET_ALLOCATOR_BASIC_ASSERT(allocations[i].metadata != Node::unused);
+                uint32 nodeIndex = allocations[i].metadata;
+                Node& node = nodes[nodeIndex];
+
+                // Double delete check
+                OFFSET_ALLOCATOR_BASIC_ASSERT(node.used == true);
+                m_hooks.onFree(node.dataOffset, node.dataSize, nodeIndex);
+                node.used = false;
+                node.binListPrev = node.binListNext = (Index)nodeIndex;
+            }
+
+            for (uint32 i = 0; i < count; i++)
+            {
+                // Already merged by an earlier run?
+                uint32 nodeIndex = allocations[i].metadata;
+                if (nodes[nodeIndex].binListPrev != nodeIndex || nodes[nodeIndex].used) continue;
+
+                // Find the start of the contiguous free run
+                uint32 runStart = nodeIndex;
+                while (nodes[runStart].neighborPrev != Node::unused && nodes[nodes[runStart].neighborPrev].used == false)
+                {
+                    runStart = nodes[runStart].neighborPrev;
+                }
+
+                Index neighborPrev = nodes[runStart].neighborPrev;
+                Offset offset = nodes[runStart].dataOffset;
+                Offset size = 0;
+
+                // Consume the run: Pending nodes go to the freelist, binned free neighbors are removed from their bins
+                uint32 runNode = runStart;
+                while (runNode != Node::unused && nodes[runNode].used == false)
+                {
+                    Node& node = nodes[runNode];
+                    Index next = node.neighborNext;
+                    size += node.dataSize;
+
+                    if (node.binListPrev == runNode)
+                    {
+                        m_storage.freeNodes()[++m_freeOffset] = (Index)runNode;
+                    }
+                    else
+                    {
+                        m_hooks.onMerge(node.dataOffset, node.dataSize, runNode);
+                        removeNodeFromBin(runNode);
+                    }
+                    node.neighborPrev = node.neighborNext = (Index)runNode;
+                    node.binListPrev = node.binListNext = Node::unused;
+                    runNode = next;
+                }
+
+                // Insert the combined free node to bin
+                uint32 combinedNodeIndex = insertNodeIntoBin(size, offset);
+                linkNeighbors(combinedNodeIndex, neighborPrev, (Index)runNode);
+            }
+        }
+
+        // Warmup: Carve free nodes of the expected sizes (counts[i] of sizes[i]) up front and leave them unmerged.
+        // While warm, allocate probes the size's round down bin first: A prewarmed exact size node is taken without
+        // a remainder split. Returns the number of nodes carved. unwarm() coalesces the prewarmed nodes left free.
+        uint32 prewarm(const Offset* sizes, const uint32* counts, uint32 n)
+        {
+            Node* nodes = m_storage.nodes();
+            uint32 total = 0;
+            for (uint32 i = 0; i < n; i++) total += counts[i];
+
+            // Carve all first: A carved node put back right away would be carved again by the next carve.
+            // Carving bypasses the hooks and the reserved storage (no storage is consumed). Reserved nodes stay untouched.
+            Index* carved = new Index[total];
+            uint32 carvedCount = 0;
+            for (uint32 i = 0; i < n; i++)
+            {
+                for (uint32 j = 0; j < counts[i] && m_freeOffset > m_hooks.nodesReserved(); j++)
+                {
+                    uint32 binIndex = findBin(Float::uintToFloatRoundUp(sizes[i]));
+                    if (binIndex == NO_BIT) break;
+                    carved[carvedCount++] = (Index)takeNode(binIndex, sizes[i], PLACE_LOW);
+                }
+            }
+
+            // Put the carved nodes back in their bins without merging
+            for (uint32 i = 0; i < carvedCount; i++)
+            {
+                Node& node = nodes[carved[i]];
+                Index neighborPrev = node.neighborPrev;
+                Index neighborNext = node.neighborNext;
+
+                // Freelist is a stack: The bin insert gets the same node back
+                m_storage.freeNodes()[++m_freeOffset] = carved[i];
+                uint32 nodeIndex = insertNodeIntoBin(node.dataSize, node.dataOffset);
+                OFFSET_ALLOCATOR_BASIC_ASSERT(nodeIndex == carved[i]);
+                nodes[nodeIndex].neighborPrev = neighborPrev;
+                nodes[nodeIndex].neighborNext = neighborNext;
+            }
+            delete[] carved;
+
+            m_prewarmed = true;
+            return carvedCount;
+        }
+
+        void unwarm()
+        {
+            Node* nodes = m_storage.nodes();
+            m_prewarmed = false;
+
+            // Merge each run of adjacent free nodes into one node
+            uint32 nodeIndex = firstNode();
+            while (nodeIndex != Node::unused)
+            {
+                Node& node = nodes[nodeIndex];
+                if (node.used || node.neighborNext == Node::unused || nodes[node.neighborNext].used)
+                {
+                    nodeIndex = node.neighborNext;
+                    continue;
+                }
+
+                Index neighborPrev = node.neighborPrev;
+                Offset offset = node.dataOffset;
+                Offset size = 0;
+                while (nodeIndex != Node::unused && nodes[nodeIndex].used == false)
+                {
+                    Node& runNode = nodes[nodeIndex];
+                    Index next = runNode.neighborNext;
+                    size += runNode.dataSize;
+                    removeNodeFromBin(nodeIndex);
+                    runNode.neighborPrev = runNode.neighborNext = (Index)nodeIndex;
+                    nodeIndex = next;
+                }
+
+                uint32 combinedNodeIndex = insertNodeIntoBin(size, offset);
+                linkNeighbors(combinedNodeIndex, neighborPrev, (Index)nodeIndex);
+            }
+        }
+
+        // Bulk load: Replaces the start state (fresh or reset allocator) with exactly the given allocations live.
+        // Linear pass, no searches, no hooks. Allocations sorted by offset, non overlapping, inside size.
+        // Needs count + gaps + 1 nodes (free tail included) below maxAllocs. Otherwise returns false, the allocator
+        // stays in the start state and all outAllocations (optional) are NO_SPACE.
+        bool load(const AllocationRange* allocations, uint32 count, Allocation* outAllocations = nullptr)
+        {
+            OFFSET_ALLOCATOR_BASIC_ASSERT(m_freeOffset == m_maxAllocs - 2);
+
+            // Validate and count the nodes first: Used node per allocation, free node per gap, free tail
+            bool valid = true;
+            uint64 nodeCount = count;
+            Offset cursor = 0;
+            for (uint32 i = 0; i < count && valid; i++)
+            {
+                const AllocationRange& allocation = allocations[i];
+                valid = allocation.offset >= cursor && allocation.offset <= m_size && allocation.size <= m_size - allocation.offset;
+                if (allocation.offset > cursor) nodeCount++;
+                cursor = allocation.offset + allocation.size;
+            }
+            if (cursor < m_size || count == 0) nodeCount++;
+
+            // Unsorted, overlapping or out of nodes (allocations can't take the last freelist node, see allocate)
+            if (!valid || nodeCount > m_maxAllocs - 1)
+            {
+                if (outAllocations)
+                {
+                    for (uint32 i = 0; i < count; i++) outAllocations[i] = {};
+                }
+                return false;
+            }
+
+            // Replace the start state (whole storage as one free node) with the given layout
+            Node* nodes = m_storage.nodes();
+            uint32 startNodeIndex = m_binIndices[Float::uintToFloatRoundDown(m_size)];
+            removeNodeFromBin(startNodeIndex);
+            nodes[startNodeIndex].neighborPrev = nodes[startNodeIndex].neighborNext = (Index)startNodeIndex;
+
+            // Walk the layout once: Free gap (if any) + used node per allocation, then the free tail
+            uint32 prevNodeIndex = Node::unused;
+            cursor = 0;
+            for (uint32 i = 0; i < count; i++)
+            {
+                const AllocationRange& allocation = allocations[i];
+                if (allocation.offset > cursor)
+                {
+                    prevNodeIndex = appendNode(allocation.offset - cursor, cursor, false, prevNodeIndex);
+                }
+                prevNodeIndex = appendNode(allocation.size, allocation.offset, true, prevNodeIndex);
+                if (outAllocations) outAllocations[i] = {.offset = allocation.offset, .metadata = (Index)prevNodeIndex};
+                cursor = allocation.offset + allocation.size;
+            }
+            if (cursor < m_size || count == 0)
+            {
+                appendNode(m_size - cursor, cursor, false, prevNodeIndex);
+            }
+            return true;
+        }
+
+        // Renumbers live nodes into a dense prefix (old index order) and resizes the node storage to newMaxAllocs.
+        // oldToNew (old maxAllocs entries) receives the map, Node::unused = dead node. O(maxAllocs).
+        // Fails (no change) if newMaxAllocs can't hold the live nodes + reserved nodes + 1.
+        bool compactMetadata(uint32 newMaxAllocs, Index* oldToNew)
+        {
+            OFFSET_ALLOCATOR_BASIC_ASSERT(newMaxAllocs <= Node::unused);
+
+            // Live nodes = not in the freelist
+            uint32 liveNodes = usedNodes();
+            if (newMaxAllocs < liveNodes + m_hooks.nodesReserved() + 1) return false;
+
+            Node* nodes = m_storage.nodes();
+            uint32 newIndex = 0;
+            for (uint32 i = 0; i < m_maxAllocs; i++)
+            {
+                // Freelist nodes are self linked
+                oldToNew[i] = nodes[i].neighborPrev == i ? Node::unused : (Index)newIndex++;
+            }
+            OFFSET_ALLOCATOR_BASIC_ASSERT(newIndex == liveNodes);
+
+            auto remapIndex = [oldToNew](Index index) { return index == Node::unused ? index : oldToNew[index]; };
+
+            // In place: New index <= old index, the ascending pass never overwrites a node it still has to read
+            for (uint32 i = 0; i < m_maxAllocs; i++)
+            {
+                if (oldToNew[i] == Node::unused) continue;
+
+                Node node = nodes[i];
+                node.binListPrev = remapIndex(node.binListPrev);
+                node.binListNext = remapIndex(node.binListNext);
+                node.neighborPrev = remapIndex(node.neighborPrev);
+                node.neighborNext = remapIndex(node.neighborNext);
+                nodes[oldToNew[i]] = node;
+            }
+            for (uint32 i = 0; i < NUM_LEAF_BINS; i++) m_binIndices[i] = remapIndex(m_binIndices[i]);
+            for (Index& tail : m_binTails) tail = remapIndex(tail);
+
+            // Freelist: Everything after the live prefix. Inverse order so that the lowest index pops first. Self linked.
+            m_storage.resize(newMaxAllocs, liveNodes);
+            nodes = m_storage.nodes();
+            Index* freeNodes = m_storage.freeNodes();
+            m_freeOffset = newMaxAllocs - liveNodes - 1;
+            for (uint32 i = 0; i < newMaxAllocs - liveNodes; i++)
+            {
+                freeNodes[i] = (Index)(newMaxAllocs - i - 1);
+            }
+            for (uint32 i = liveNodes; i < newMaxAllocs; i++)
+            {
+                nodes[i] = {};
+                nodes[i].neighborPrev = nodes[i].neighborNext = (Index)i;
+            }
+
+            m_hooks.onCompact(oldToNew, m_maxAllocs, newMaxAllocs, liveNodes);
+            m_maxAllocs = newMaxAllocs;
+            return true;
+        }
+
+        Offset allocationSize(Allocation allocation) const
+        {
+            if (allocation.metadata == Node::unused) return 0;
+            return m_storage.nodes()[allocation.metadata].dataSize;
+        }
+
+        StorageReport storageReport() const
+        {
+            Offset largestFreeRegion = 0;
+            Offset freeStorage = 0;
+
+            // Out of allocations? -> Zero free space
+            if (m_freeOffset > 0)
+            {
+                freeStorage = m_freeStorage;
+                if (m_usedBinsTop)
+                {
+                    uint32 topBinIndex = sizeof(TopMask) * 8 - 1 - std::countl_zero(m_usedBinsTop);
+                    uint32 leafBinIndex = sizeof(LeafMask) * 8 - 1 - std::countl_zero(m_usedBins[topBinIndex]);
+                    largestFreeRegion = Float::floatToUint((topBinIndex << MANTISSA_BITS) | leafBinIndex);
+                    OFFSET_ALLOCATOR_BASIC_ASSERT(freeStorage >= largestFreeRegion);
+                }
+            }
+            return {.totalFreeSpace = freeStorage, .largestFreeRegion = largestFreeRegion};
+        }
+
+        // Visits all used and free nodes in offset order (walks the neighbor chain): visitor(node, nodeIndex)
+        template<typename Visitor>
+        void visitNodes(Visitor&& visitor) const
+        {
+            const Node* nodes = m_storage.nodes();
+            for (uint32 nodeIndex = firstNode(); nodeIndex != Node::unused; nodeIndex = nodes[nodeIndex].neighborNext)
+            {
+                visitor(nodes[nodeIndex], nodeIndex);
+            }
+        }
+
+        // Consistency checks: Bin masks, neighbor links, bin lists and totals.
+        // validateNodes checks a node index range only. Use it to spread the check over many frames.
+        bool validate() const
+        {
+            const Node* nodes = m_storage.nodes();
+
+            // Bin masks must match the bin lists
+            for (uint32 topBinIndex = 0; topBinIndex < NUM_TOP_BINS; topBinIndex++)
+            {
+                LeafMask leafMask = 0;
+                for (uint32 leafBinIndex = 0; leafBinIndex < BINS_PER_LEAF; leafBinIndex++)
+                {
+                    if (m_binIndices[(topBinIndex << MANTISSA_BITS) | leafBinIndex] != Node::unused)
+                        leafMask |= (LeafMask)(1u << leafBinIndex);
+                }
+                if (m_usedBins[topBinIndex] != leafMask) return false;
+                if (((m_usedBinsTop >> topBinIndex) & 1) != (leafMask != 0)) return false;
+            }
+
+            if (!validateNodes(0, m_maxAllocs)) return false;
+
+            // Totals: Free storage and live node count (every node is either live or in the freelist)
+            Offset freeStorage = 0;
+            uint32 liveNodes = 0;
+            for (uint32 i = 0; i < m_maxAllocs; i++)
+            {
+                const Node& node = nodes[i];
+                if (node.neighborPrev == i) continue;
+                liveNodes++;
+                if (!node.used) freeStorage += node.dataSize;
+            }
+            return freeStorage == m_freeStorage && liveNodes == usedNodes();
+        }
+
+        bool validateNodes(uint32 firstNode, uint32 nodeCount) const
+        {
+            const Node* nodes = m_storage.nodes();
+            uint32 lastNode = firstNode + nodeCount < m_maxAllocs ? firstNode + nodeCount : m_maxAllocs;
+            for (uint32 i = firstNode; i < lastNode; i++)
+            {
+                const Node& node = nodes[i];
+
+                // Freelist node? (self linked)
+                if (node.neighborPrev == i)
+                {
+                    if (node.neighborNext != i) return false;
+                    continue;
+                }
+
+                // Neighbors must be live, link back and be contiguous
+                if (node.neighborPrev != Node::unused)
+                {
+                    const Node& prevNode = nodes[node.neighborPrev];
+                    if (prevNode.neighborNext != i) return false;
+                    if (prevNode.dataOffset + prevNode.dataSize != node.dataOffset) return false;
+                }
+                else if (node.dataOffset != 0) return false;
+
+                if (node.neighborNext != Node::unused)
+                {
+                    const Node& nextNode = nodes[node.neighborNext];
+                    if (nextNode.neighborPrev != i) return false;
+                    if (node.dataOffset + node.dataSize != nextNode.dataOffset) return false;
+                }
+                else if (node.dataOffset + node.dataSize != m_size) return false;
+
+                if (node.used) continue;
+
+                // Free node: Must be in the bin matching its size and the bin mask bits must be set
+                uint32 binIndex = Float::uintToFloatRoundDown(node.dataSize);
+                uint32 topBinIndex = binIndex >> MANTISSA_BITS;
+                uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+                if (!((m_usedBinsTop >> topBinIndex) & 1) || !((m_usedBins[topBinIndex] >> leafBinIndex) & 1)) return false;
+
+                if (node.binListPrev != Node::unused)
+                {
+                    const Node& prevNode = nodes[node.binListPrev];
+                    if (prevNode.used || prevNode.binListNext != i) return false;
+                }
+                else if (m_binIndices[binIndex] != i) return false;
+
+                if (node.binListNext != Node::unused)
+                {
+                    const Node& nextNode = nodes[node.binListNext];
+                    if (nextNode.used || nextNode.binListPrev != i) return false;
+                    if (Float::uintToFloatRoundDown(nextNode.dataSize) != binIndex) return false;
+                }
+            }
+            return true;
+        }
+
+        Offset size() const { return m_size; }
+        uint32 maxAllocs() const { return m_maxAllocs; }
+        Hooks& hooks() { return m_hooks; }
+        const Hooks& hooks() const { return m_hooks; }
+
+        // Raw state for dumps and reports. Free nodes = freelist entries allocate can take (the last one is kept).
+        const Node* nodes() const { return m_storage.nodes(); }
+        const Index* freeNodes() const { return m_storage.freeNodes(); }
+        uint32 freeNodeCount() const { return m_freeOffset; }
+        uint32 usedNodes() const { return m_maxAllocs - m_freeOffset - 1; }
+        Offset freeStorage() const { return m_freeStorage; }
+        TopMask usedBinsTop() const { return m_usedBinsTop; }
+        LeafMask usedBins(uint32 topBinIndex) const { return m_usedBins[topBinIndex]; }
+        Index binHead(uint32 binIndex) const { return m_binIndices[binIndex]; }
+
+    private:
+        using Storage = typename Policy::template Storage<Node, Index>;
+        static constexpr uint32 NO_BIT = BIT_NOT_FOUND;
+
+        OFFSET_ALLOCATOR_FORCE_INLINE uint32 findBin(uint32 minBinIndex) const
+        {
+            uint32 minTopBinIndex = minBinIndex >> MANTISSA_BITS;
+            uint32 minLeafBinIndex = minBinIndex & LEAF_BINS_INDEX_MASK;
+
+            uint32 topBinIndex = minTopBinIndex;
+            uint32 leafBinIndex = NO_BIT;
+
+            // If top bin exists, scan its leaf bin. This can fail (NO_BIT).
+            if (topBinIndex < NUM_TOP_BINS && (m_usedBinsTop & ((TopMask)1 << topBinIndex)))
+            {
+                leafBinIndex = findLowestSetBitAfter<LeafMask>(m_usedBins[topBinIndex], minLeafBinIndex);
+            }
+
+            // If we didn't find space in top bin, we search top bin from +1
+            if (leafBinIndex == NO_BIT)
+            {
+                topBinIndex = findLowestSetBitAfter<TopMask>(m_usedBinsTop, minTopBinIndex + 1);
+
+                // Out of space?
+                if (topBinIndex == NO_BIT) return NO_BIT;
+
+                // All leaf bins here fit the alloc, since the top bin was rounded up. Start leaf search from bit 0.
+                leafBinIndex = std::countr_zero(m_usedBins[topBinIndex]);
+            }
+
+            return (topBinIndex << MANTISSA_BITS) | leafBinIndex;
+        }
+
+        // Pops the top node of the bin as a used node of the given size. Remainder goes back to a bin.
+        OFFSET_ALLOCATOR_FORCE_INLINE uint32 takeNode(uint32 binIndex, Offset size, Placement placement)
+        {
+            Node* nodes = m_storage.nodes();
+            uint32 topBinIndex = binIndex >> MANTISSA_BITS;
+            uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+
+            // Pop the top node of the bin. Bin top = node.next.
+            uint32 nodeIndex = m_binIndices[binIndex];
+            Node& node = nodes[nodeIndex];
+            Offset nodeTotalSize = node.dataSize;
+            node.dataSize = size;
+            node.used = true;
+            m_binIndices[binIndex] = node.binListNext;
+            if (node.binListNext != Node::unused) nodes[node.binListNext].binListPrev = Node::unused;
+            m_freeStorage -= nodeTotalSize;
+
+            // Bin empty?
+            if (m_binIndices[binIndex] == Node::unused)
+            {
+                if constexpr (Policy::BIN_ORDER == BinOrder::FIFO) m_binTails[binIndex] = Node::unused;
+                m_usedBins[topBinIndex] &= (LeafMask)~(1u << leafBinIndex);
+                if (m_usedBins[topBinIndex] == 0) m_usedBinsTop &= ~((TopMask)1 << topBinIndex);
+            }
+
+            // High placement: Allocation moves to the end of the node, reminder stays at the start
+            Offset reminderSize = nodeTotalSize - size;
+            if (placement == PLACE_HIGH && reminderSize > 0)
+            {
+                uint32 newNodeIndex = insertNodeIntoBin(reminderSize, node.dataOffset);
+                node.dataOffset += reminderSize;
+
+                // Link the reminder between the previous neighbor and the allocation
+                if (node.neighborPrev != Node::unused) nodes[node.neighborPrev].neighborNext = (Index)newNodeIndex;
+                nodes[newNodeIndex].neighborPrev = node.neighborPrev;
+                nodes[newNodeIndex].neighborNext = (Index)nodeIndex;
+                node.neighborPrev = (Index)newNodeIndex;
+            }
+
+            // Push back reminder N elements to a lower bin
+            else if (reminderSize > 0)
+            {
+                uint32 newNodeIndex = insertNodeIntoBin(reminderSize, node.dataOffset + size);
+
+                // Link nodes next to each other so that we can merge them later if both are free
+                if (node.neighborNext != Node::unused) nodes[node.neighborNext].neighborPrev = (Index)newNodeIndex;
+                nodes[newNodeIndex].neighborPrev = (Index)nodeIndex;
+                nodes[newNodeIndex].neighborNext = node.neighborNext;
+                node.neighborNext = (Index)newNodeIndex;
+            }
+
+            return nodeIndex;
+        }
+
+        // Connect neighbors with a new combined free node
+        OFFSET_ALLOCATOR_FORCE_INLINE void linkNeighbors(uint32 nodeIndex, Index neighborPrev, Index neighborNext)
+        {
+            Node* nodes = m_storage.nodes();
+            if (neighborNext != Node::unused)
+            {
+                nodes[nodeIndex].neighborNext = neighborNext;
+                nodes[neighborNext].neighborPrev = (Index)nodeIndex;
+            }
+            if (neighborPrev != Node::unused)
+            {
+                nodes[nodeIndex].neighborPrev = neighborPrev;
+                nodes[neighborPrev].neighborNext = (Index)nodeIndex;
+            }
+        }
+
+        // Bulk load: Next node in offset order. Free nodes go to their bin.
+        uint32 appendNode(Offset size, Offset dataOffset, bool used, uint32 prevNodeIndex)
+        {
+            Node* nodes = m_storage.nodes();
+
+            // Allocations can't take the last freelist node (see allocate)
+            OFFSET_ALLOCATOR_BASIC_ASSERT(m_freeOffset > 0);
+
+            uint32 nodeIndex;
+            if (used)
+            {
+                nodeIndex = m_storage.freeNodes()[m_freeOffset--];
+                nodes[nodeIndex] = {.dataOffset = dataOffset, .dataSize = size, .used = true};
+            }
+            else
+            {
+                nodeIndex = insertNodeIntoBin(size, dataOffset);
+            }
+
+            nodes[nodeIndex].neighborPrev = (Index)prevNodeIndex;
+            if (prevNodeIndex != Node::unused) nodes[prevNodeIndex].neighborNext = (Index)nodeIndex;
+            return nodeIndex;
+        }
+
+        // Any live node (freelist nodes are self linked), walked back to the first node. Node::unused if none.
+        uint32 firstNode() const
+        {
+            const Node* nodes = m_storage.nodes();
+            uint32 nodeIndex = 0;
+            while (nodeIndex < m_maxAllocs && nodes[nodeIndex].neighborPrev == nodeIndex) nodeIndex++;
+            if (nodeIndex == m_maxAllocs) return Node::unused;
+            while (nodes[nodeIndex].neighborPrev != Node::unused) nodeIndex = nodes[nodeIndex].neighborPrev;
+            return nodeIndex;
+        }
+
+        OFFSET_ALLOCATOR_FORCE_INLINE uint32 insertNodeIntoBin(Offset size, Offset dataOffset)
+        {
+            Node* nodes = m_storage.nodes();
+
+            // Round down to bin index to ensure that bin >= alloc
+            uint32 binIndex = Float::uintToFloatRoundDown(size);
+            uint32 topBinIndex = binIndex >> MANTISSA_BITS;
+            uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+
+            // Bin was empty before?
+            if (m_binIndices[binIndex] == Node::unused)
+            {
+                m_usedBins[topBinIndex] |= (LeafMask)(1u << leafBinIndex);
+                m_usedBinsTop |= (TopMask)1 << topBinIndex;
+            }
+
+            uint32 nodeIndex = m_storage.freeNodes()[m_freeOffset--];
+            if constexpr (Policy::BIN_ORDER == BinOrder::FIFO)
+            {
+                // Append to the bin tail: allocate pops the oldest free node
+                Index tailNodeIndex = m_binTails[binIndex];
+                nodes[nodeIndex] = {.dataOffset = dataOffset, .dataSize = size, .binListPrev = tailNodeIndex};
+                if (tailNodeIndex != Node::unused) nodes[tailNodeIndex].binListNext = (Index)nodeIndex;
+                else m_binIndices[binIndex] = (Index)nodeIndex;
+                m_binTails[binIndex] = (Index)nodeIndex;
+            }
+            else
+            {
+                // Insert on top of the bin linked list (next = old top)
+                Index topNodeIndex = m_binIndices[binIndex];
+                nodes[nodeIndex] = {.dataOffset = dataOffset, .dataSize = size, .binListNext = topNodeIndex};
+                if (topNodeIndex != Node::unused) nodes[topNodeIndex].binListPrev = (Index)nodeIndex;
+                m_binIndices[binIndex] = (Index)nodeIndex;
+            }
+
+            m_freeStorage += size;
+            return nodeIndex;
+        }
+
+        OFFSET_ALLOCATOR_FORCE_INLINE void removeNodeFromBin(uint32 nodeIndex)
+        {
+            Node* nodes = m_storage.nodes();
+            Node& node = nodes[nodeIndex];
+
+            if (node.binListPrev != Node::unused)
+            {
+                // Easy case: We have previous node. Just remove this node from the middle of the list.
+                nodes[node.binListPrev].binListNext = node.binListNext;
+                if (node.binListNext != Node::unused) nodes[node.binListNext].binListPrev = node.binListPrev;
+                else if constexpr (Policy::BIN_ORDER == BinOrder::FIFO) m_binTails[Float::uintToFloatRoundDown(node.dataSize)] = node.binListPrev;
+            }
+            else
+            {
+                // Hard case: We are the first node in a bin. Find the bin.
+                uint32 binIndex = Float::uintToFloatRoundDown(node.dataSize);
+                uint32 topBinIndex = binIndex >> MANTISSA_BITS;
+                uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+
+                m_binIndices[binIndex] = node.binListNext;
+                if (node.binListNext != Node::unused) nodes[node.binListNext].binListPrev = Node::unused;
+
+                // Bin empty?
+                if (m_binIndices[binIndex] == Node::unused)
+                {
+                    if constexpr (Policy::BIN_ORDER == BinOrder::FIFO) m_binTails[binIndex] = Node::unused;
+                    m_usedBins[topBinIndex] &= (LeafMask)~(1u << leafBinIndex);
+                    if (m_usedBins[topBinIndex] == 0) m_usedBinsTop &= ~((TopMask)1 << topBinIndex);
+                }
+            }
+
+            // Insert the node to freelist
+            m_storage.freeNodes()[++m_freeOffset] = (Index)nodeIndex;
+            m_freeStorage -= node.dataSize;
+        }
+
+        Offset m_size;
+        uint32 m_maxAllocs;
+        Offset m_freeStorage;
+
+        TopMask m_usedBinsTop;
+        LeafMask m_usedBins[NUM_TOP_BINS];
+        Index m_binIndices[NUM_LEAF_BINS];
+        Index m_binTails[Policy::BIN_ORDER == BinOrder::FIFO ? NUM_LEAF_BINS : 1]; // FIFO only
+
+        Storage m_storage;
+        uint32 m_freeOffset;
+        bool m_prewarmed;
+        [[no_unique_address]] Hooks m_hooks;
+    };
+}
+
+#undef OFFSET_ALLOCATOR_BASIC_ASSERT
+#undef OFFSET_ALLOCATOR_FORCE_INLINE
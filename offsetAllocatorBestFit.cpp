@@ -0,0 +1,333 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorBestFit.hpp"
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Fixed pseudo random treap priority per node index (Fibonacci hashing)
+    static inline uint32 treePriority(uint32 nodeIndex)
+    {
+        return nodeIndex * 0x9e3779b9;
+    }
+
+    BestFitAllocator::BestFitAllocator(uint32 size, uint32 maxAllocs) :
+        m_size(size),
+        m_maxAllocs(maxAllocs),
+        m_nodes(nullptr),
+        m_freeNodes(nullptr)
+    {
+        if (sizeof(NodeIndex) == 2)
+        {
+            ASSERT(maxAllocs <= 65536);
+        }
+        reset();
+    }
+
+    BestFitAllocator::BestFitAllocator(BestFitAllocator &&other) :
+        m_size(other.m_size),
+        m_maxAllocs(other.m_maxAllocs),
+        m_freeStorage(other.m_freeStorage),
+        m_treeRoot(other.m_treeRoot),
+        m_nodes(other.m_nodes),
+        m_freeNodes(other.m_freeNodes),
+        m_freeOffset(other.m_freeOffset)
+    {
+        other.m_nodes = nullptr;
+        other.m_freeNodes = nullptr;
+        other.m_freeOffset = 0;
+        other.m_maxAllocs = 0;
+        other.m_freeStorage = 0;
+        other.m_treeRoot = Node::unused;
+    }
+
+    void BestFitAllocator::reset()
+    {
+        m_freeStorage = 0;
+        m_freeOffset = m_maxAllocs - 1;
+        m_treeRoot = Node::unused;
+
+        if (m_nodes) delete[] m_nodes;
+        if (m_freeNodes) delete[] m_freeNodes;
+
+        m_nodes = new Node[m_maxAllocs];
+        m_freeNodes = new NodeIndex[m_maxAllocs];
+
+        // Freelist is a stack. Nodes in inverse order so that [0] pops first.
+        for (uint32 i = 0; i < m_maxAllocs; i++)
+        {
+            m_freeNodes[i] = m_maxAllocs - i - 1;
+        }
+
+        // Start state: Whole storage as one big node
+        insertFreeNode(m_size, 0);
+    }
+
+    BestFitAllocator::~BestFitAllocator()
+    {
+        delete[] m_nodes;
+        delete[] m_freeNodes;
+    }
+
+    Allocation BestFitAllocator::allocate(uint32 size)
+    {
+        // Out of allocations?
+        if (m_freeOffset == 0)
+        {
+            return {.offset = Allocation::NO_SPACE, .metadata = Allocation::NO_SPACE};
+        }
+
+        // Smallest free node >= size. Lowest offset among equal sizes.
+        uint32 nodeIndex = Node::unused;
+        for (uint32 i = m_treeRoot; i != Node::unused; )
+        {
+            if (m_nodes[i].dataSize >= size)
+            {
+                nodeIndex = i;
+                i = m_nodes[i].treeLeft;
+            }
+            else
+            {
+                i = m_nodes[i].treeRight;
+            }
+        }
+        if (nodeIndex == Node::unused)
+        {
+            return {.offset = Allocation::NO_SPACE, .metadata = Allocation::NO_SPACE};
+        }
+
+        treeRemove(nodeIndex);
+
+        Node& node = m_nodes[nodeIndex];
+        uint32 nodeTotalSize = node.dataSize;
+        node.dataSize = size;
+        node.used = true;
+        m_freeStorage -= nodeTotalSize;
+
+        // Push back reminder as a new free node
+        uint32 reminderSize = nodeTotalSize - size;
+        if (reminderSize > 0)
+        {
+            uint32 newNodeIndex = insertFreeNode(reminderSize, node.dataOffset + size);
+
+            // Link nodes next to each other so that we can merge them later if both are free
+            if (node.neighborNext != Node::unused) m_nodes[node.neighborNext].neighborPrev = newNodeIndex;
+            m_nodes[newNodeIndex].neighborPrev = nodeIndex;
+            m_nodes[newNodeIndex].neighborNext = node.neighborNext;
+            node.neighborNext = newNodeIndex;
+        }
+
+        return {.offset = node.dataOffset, .metadata = (NodeIndex)nodeIndex};
+    }
+
+    void BestFitAllocator::free(Allocation allocation)
+    {
+        ASSERT(allocation.metadata != Allocation::NO_SPACE);
+        if (!m_nodes) return;
+
+        uint32 nodeIndex = allocation.metadata;
+        Node& node = m_nodes[nodeIndex];
+
+        // Double delete check
+        ASSERT(node.used == true);
+
+        // Merge with neighbors...
+        uint32 offset = node.dataOffset;
+        uint32 size = node.dataSize;
+
+        if ((node.neighborPrev != Node::unused) && (m_nodes[node.neighborPrev].used == false))
+        {
+            Node& prevNode = m_nodes[node.neighborPrev];
+            offset = prevNode.dataOffset;
+            size += prevNode.dataSize;
+            removeFreeNode(node.neighborPrev);
+            node.neighborPrev = prevNode.neighborPrev;
+        }
+
+        if ((node.neighborNext != Node::unused) && (m_nodes[node.neighborNext].used == false))
+        {
+            Node& nextNode = m_nodes[node.neighborNext];
+            size += nextNode.dataSize;
+            removeFreeNode(node.neighborNext);
+            node.neighborNext = nextNode.neighborNext;
+        }
+
+        uint32 neighborNext = node.neighborNext;
+        uint32 neighborPrev = node.neighborPrev;
+
+        // Insert the removed node to freelist and the (combined) free node to the tree
+        m_freeNodes[++m_freeOffset] = nodeIndex;
+        uint32 combinedNodeIndex = insertFreeNode(size, offset);
+
+        // Connect neighbors with the new combined node
+        if (neighborNext != Node::unused)
+        {
+            m_nodes[combinedNodeIndex].neighborNext = neighborNext;
+            m_nodes[neighborNext].neighborPrev = combinedNodeIndex;
+        }
+        if (neighborPrev != Node::unused)
+        {
+            m_nodes[combinedNodeIndex].neighborPrev = neighborPrev;
+            m_nodes[neighborPrev].neighborNext = combinedNodeIndex;
+        }
+    }
+
+    uint32 BestFitAllocator::insertFreeNode(uint32 size, uint32 dataOffset)
+    {
+        uint32 nodeIndex = m_freeNodes[m_freeOffset--];
+        m_nodes[nodeIndex] = {.dataOffset = dataOffset, .dataSize = size};
+        treeInsert(nodeIndex);
+        m_freeStorage += size;
+        return nodeIndex;
+    }
+
+    void BestFitAllocator::removeFreeNode(uint32 nodeIndex)
+    {
+        Node& node = m_nodes[nodeIndex];
+        treeRemove(nodeIndex);
+        m_freeNodes[++m_freeOffset] = nodeIndex;
+        m_freeStorage -= node.dataSize;
+    }
+
+    void BestFitAllocator::treeInsert(uint32 nodeIndex)
+    {
+        Node& node = m_nodes[nodeIndex];
+        uint64 key = treeKey(node);
+
+        // Descend until the new node's priority is higher than the subtree root's
+        uint32 priority = treePriority(nodeIndex);
+        uint32 parent = Node::unused;
+        NodeIndex* link = &m_treeRoot;
+        while (*link != Node::unused && treePriority(*link) >= priority)
+        {
+            parent = *link;
+            link = key < treeKey(m_nodes[parent]) ? &m_nodes[parent].treeLeft : &m_nodes[parent].treeRight;
+        }
+
+        // Split that subtree by the new key into the new node's children
+        NodeIndex* left = &node.treeLeft;
+        NodeIndex* right = &node.treeRight;
+        uint32 leftParent = nodeIndex;
+        uint32 rightParent = nodeIndex;
+        uint32 i = *link;
+        while (i != Node::unused)
+        {
+            Node& splitNode = m_nodes[i];
+            if (treeKey(splitNode) < key)
+            {
+                *left = i;
+                splitNode.treeParent = leftParent;
+                leftParent = i;
+                left = &splitNode.treeRight;
+                i = *left;
+            }
+            else
+            {
+                *right = i;
+                splitNode.treeParent = rightParent;
+                rightParent = i;
+                right = &splitNode.treeLeft;
+                i = *right;
+            }
+        }
+        *left = Node::unused;
+        *right = Node::unused;
+        *link = nodeIndex;
+        node.treeParent = parent;
+    }
+
+    void BestFitAllocator::treeRemove(uint32 nodeIndex)
+    {
+        Node& node = m_nodes[nodeIndex];
+        uint32 parent = node.treeParent;
+        NodeIndex* link = &m_treeRoot;
+        if (parent != Node::unused)
+        {
+            link = m_nodes[parent].treeLeft == nodeIndex ? &m_nodes[parent].treeLeft : &m_nodes[parent].treeRight;
+        }
+
+        // Merge the children in place of the node. Higher priority root wins at each step.
+        uint32 left = node.treeLeft;
+        uint32 right = node.treeRight;
+        while (left != Node::unused && right != Node::unused)
+        {
+            if (treePriority(left) > treePriority(right))
+            {
+                *link = left;
+                m_nodes[left].treeParent = parent;
+                parent = left;
+                link = &m_nodes[left].treeRight;
+                left = *link;
+            }
+            else
+            {
+                *link = right;
+                m_nodes[right].treeParent = parent;
+                parent = right;
+                link = &m_nodes[right].treeLeft;
+                right = *link;
+            }
+        }
+        uint32 child = left != Node::unused ? left : right;
+        *link = child;
+        if (child != Node::unused) m_nodes[child].treeParent = parent;
+    }
+
+    uint32 BestFitAllocator::allocationSize(Allocation allocation) const
+    {
+        if (allocation.metadata == Allocation::NO_SPACE) return 0;
+        if (!m_nodes) return 0;
+
+        return m_nodes[allocation.metadata].dataSize;
+    }
+
+    StorageReport BestFitAllocator::storageReport() const
+    {
+        uint32 largestFreeRegion = 0;
+        uint32 freeStorage = 0;
+
+        // Out of allocations? -> Zero free space
+        if (m_freeOffset > 0)
+        {
+            freeStorage = m_freeStorage;
+
+            // Rightmost tree node is the largest
+            for (uint32 i = m_treeRoot; i != Node::unused; i = m_nodes[i].treeRight)
+            {
+                largestFreeRegion = m_nodes[i].dataSize;
+            }
+        }
+
+        return {.totalFreeSpace = freeStorage, .largestFreeRegion = largestFreeRegion};
+    }
+
+    StorageReportFull BestFitAllocator::storageReportFull() const
+    {
+        // Same bins as Allocator for comparable reports
+        StorageReportFull report;
+        for (uint32 i = 0; i < NUM_LEAF_BINS; i++)
+        {
+            report.freeRegions[i] = {.size = SmallFloat::floatToUint(i), .count = 0};
+        }
+        std::vector<uint32> stack;
+        if (m_treeRoot != Node::unused) stack.push_back(m_treeRoot);
+        while (!stack.empty())
+        {
+            const Node& node = m_nodes[stack.back()];
+            stack.pop_back();
+            report.freeRegions[SmallFloat::uintToFloatRoundDown(node.dataSize)].count++;
+            if (node.treeLeft != Node::unused) stack.push_back(node.treeLeft);
+            if (node.treeRight != Node::unused) stack.push_back(node.treeRight);
+        }
+        return report;
+    }
+}
@@ -0,0 +1,62 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+namespace OffsetAllocator
+{
+    // Exact best fit engine with the Allocator API. Free nodes are kept in a size-then-offset ordered tree:
+    // allocate picks the smallest free node that fits (lowest offset on ties) in O(log n).
+    // The tree is a treap linked through the node array, so allocate and free never touch the heap.
+    // For long lived heaps where fragmentation matters more than latency. Allocator (binned) is O(1).
+    class BestFitAllocator
+    {
+    public:
+        BestFitAllocator(uint32 size, uint32 maxAllocs = 128 * 1024);
+        BestFitAllocator(BestFitAllocator &&other);
+        ~BestFitAllocator();
+        void reset();
+
+        Allocation allocate(uint32 size);
+        void free(Allocation allocation);
+
+        uint32 allocationSize(Allocation allocation) const;
+        StorageReport storageReport() const;
+        StorageReportFull storageReportFull() const;
+
+    private:
+        uint32 insertFreeNode(uint32 size, uint32 dataOffset);
+        void removeFreeNode(uint32 nodeIndex);
+        void treeInsert(uint32 nodeIndex);
+        void treeRemove(uint32 nodeIndex);
+
+        struct Node
+        {
+            static constexpr NodeIndex unused = 0xffffffff;
+
+            uint32 dataOffset = 0;
+            uint32 dataSize = 0;
+            NodeIndex neighborPrev = unused;
+            NodeIndex neighborNext = unused;
+            NodeIndex treeParent = unused;
+            NodeIndex treeLeft = unused;
+            NodeIndex treeRight = unused;
+            bool used = false;
+        };
+
+        // Free tree order: (size, offset). Unique since free nodes don't overlap.
+        static inline uint64 treeKey(const Node& node) { return ((uint64)node.dataSize << 32) | node.dataOffset; }
+
+        uint32 m_size;
+        uint32 m_maxAllocs;
+        uint32 m_freeStorage;
+
+        NodeIndex m_treeRoot;
+
+        Node* m_nodes;
+        NodeIndex* m_freeNodes;
+        uint32 m_freeOffset;
+    };
+}
@@ -0,0 +1,106 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorCombining.hpp"
+
+#include <functional>
+#include <thread>
+
+namespace OffsetAllocator
+{
+    FlatCombiningAllocator::FlatCombiningAllocator(uint32 size, uint32 maxAllocs, uint32 slotCount) :
+        m_allocator(size, maxAllocs),
+        m_slotCount(slotCount ? slotCount : 1),
+        m_slots(new Slot[m_slotCount]),
+        m_batch(new Allocation[m_slotCount]),
+        m_batchSlots(new uint32[m_slotCount]),
+        m_combinerLock(false)
+    {
+        for (uint32 i = 0; i < m_slotCount; i++)
+        {
+            m_slots[i].state.store(EMPTY, std::memory_order_relaxed);
+        }
+    }
+
+    FlatCombiningAllocator::~FlatCombiningAllocator()
+    {
+        delete[] m_slots;
+        delete[] m_batch;
+        delete[] m_batchSlots;
+    }
+
+    Allocation FlatCombiningAllocator::allocate(uint32 size)
+    {
+        return execute(ALLOCATE, size, {});
+    }
+
+    void FlatCombiningAllocator::free(Allocation allocation)
+    {
+        execute(FREE, 0, allocation);
+    }
+
+    Allocation FlatCombiningAllocator::execute(SlotState request, uint32 size, Allocation allocation)
+    {
+        // Claim a slot. Probing starts from a per thread position, so threads rarely collide.
+        uint32 slotIndex = (uint32)std::hash<std::thread::id>()(std::this_thread::get_id()) % m_slotCount;
+        for (;;)
+        {
+            uint32 expected = EMPTY;
+            if (m_slots[slotIndex].state.load(std::memory_order_relaxed) == EMPTY &&
+                m_slots[slotIndex].state.compare_exchange_weak(expected, CLAIMED, std::memory_order_acquire)) break;
+            if (++slotIndex == m_slotCount)
+            {
+                slotIndex = 0;
+                std::this_thread::yield();
+            }
+        }
+
+        // Publish
+        Slot& slot = m_slots[slotIndex];
+        slot.size = size;
+        slot.allocation = allocation;
+        slot.state.store(request, std::memory_order_release);
+
+        // Combine or wait for the combiner to serve us
+        for (;;)
+        {
+            if (slot.state.load(std::memory_order_acquire) == DONE) break;
+            if (!m_combinerLock.load(std::memory_order_relaxed) && !m_combinerLock.exchange(true, std::memory_order_acquire))
+            {
+                combine();
+                m_combinerLock.store(false, std::memory_order_release);
+                continue;
+            }
+            std::this_thread::yield();
+        }
+
+        Allocation result = slot.allocation;
+        slot.state.store(EMPTY, std::memory_order_release);
+        return result;
+    }
+
+    void FlatCombiningAllocator::combine()
+    {
+        // Frees first as one batch: Merged space is available to the allocations of the same pass
+        uint32 batchCount = 0;
+        for (uint32 i = 0; i < m_slotCount; i++)
+        {
+            if (m_slots[i].state.load(std::memory_order_acquire) != FREE) continue;
+            m_batch[batchCount] = m_slots[i].allocation;
+            m_batchSlots[batchCount++] = i;
+        }
+        m_allocator.free(m_batch, batchCount);
+        for (uint32 i = 0; i < batchCount; i++)
+        {
+            m_slots[m_batchSlots[i]].state.store(DONE, std::memory_order_release);
+        }
+
+        for (uint32 i = 0; i < m_slotCount; i++)
+        {
+            Slot& slot = m_slots[i];
+            if (slot.state.load(std::memory_order_acquire) != ALLOCATE) continue;
+            slot.allocation = m_allocator.allocate(slot.size);
+            slot.state.store(DONE, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,55 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <atomic>
+
+namespace OffsetAllocator
+{
+    // Thread safe flat combining front end for one Allocator (single global heap, unchanged placement).
+    // Threads publish requests into slots. Whichever thread takes the combiner lock executes all published
+    // requests: Frees first as one batch free, then allocations. Other threads spin on their own slot.
+    class FlatCombiningAllocator
+    {
+    public:
+        // slotCount bounds the number of concurrently published requests. Threads probe for a free slot.
+        FlatCombiningAllocator(uint32 size, uint32 maxAllocs = 128 * 1024, uint32 slotCount = 64);
+        ~FlatCombiningAllocator();
+
+        Allocation allocate(uint32 size);
+        void free(Allocation allocation);
+
+        // Not thread safe: Only when no other thread uses the combiner
+        Allocator& allocator() { return m_allocator; }
+
+    private:
+        enum SlotState : uint32
+        {
+            EMPTY = 0,
+            CLAIMED = 1,
+            ALLOCATE = 2,
+            FREE = 3,
+            DONE = 4,
+        };
+
+        struct alignas(64) Slot
+        {
+            std::atomic<uint32> state;
+            uint32 size;
+            Allocation allocation;
+        };
+
+        Allocation execute(SlotState request, uint32 size, Allocation allocation);
+        void combine();
+
+        Allocator m_allocator;
+        uint32 m_slotCount;
+        Slot* m_slots;
+        Allocation* m_batch;
+        uint32* m_batchSlots;
+        alignas(64) std::atomic<bool> m_combinerLock;
+    };
+}
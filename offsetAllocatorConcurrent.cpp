@@ -0,0 +1,379 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorConcurrent.hpp"
+
+#include <bit>
+#include <thread>
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+namespace OffsetAllocator
+{
+    void ConcurrentAllocator::SpinLock::lock()
+    {
+        while (!tryLock()) std::this_thread::yield();
+    }
+
+    ConcurrentAllocator::ConcurrentAllocator(uint32 size, uint32 maxAllocs) :
+        m_size(size),
+        m_maxAllocs(maxAllocs),
+        m_freeStorage(0),
+        m_usedBinsTop(0),
+        m_hidden(0),
+        m_nodes(new Node[maxAllocs]),
+        m_freeNodes(new NodeIndex[maxAllocs]),
+        m_freeOffset(maxAllocs - 1)
+    {
+        if (sizeof(NodeIndex) == 2)
+        {
+            ASSERT(maxAllocs <= 65536);
+        }
+
+        for (TopBin& topBin : m_topBins)
+        {
+            for (uint32 i = 0; i < BINS_PER_LEAF; i++) topBin.binIndices[i] = Node::unused;
+        }
+
+        // Freelist is a stack. Nodes in inverse order so that [0] pops first.
+        for (uint32 i = 0; i < maxAllocs; i++)
+        {
+            m_freeNodes[i] = maxAllocs - i - 1;
+        }
+
+        // Start state: Whole storage as one big node
+        uint32 nodeIndex = popFreeNode();
+        m_nodes[nodeIndex].dataSize = size;
+        insertNodeIntoBin(nodeIndex);
+    }
+
+    ConcurrentAllocator::~ConcurrentAllocator()
+    {
+        delete[] m_nodes;
+        delete[] m_freeNodes;
+    }
+
+    Allocation ConcurrentAllocator::allocate(uint32 size)
+    {
+        // Round up to bin index to ensure that alloc >= bin
+        uint32 minBinIndex = SmallFloat::uintToFloatRoundUp(size);
+
+        // Fitting nodes locked by other threads are skipped, and nodes being split or merged are out of the bins.
+        // Failure is final only when the search overlapped neither.
+        bool skipped = false;
+        uint64 hidden = m_hidden.load(std::memory_order_acquire);
+        uint32 nodeIndex = takeFittingNode(minBinIndex, skipped);
+        while (nodeIndex == Node::unused && (skipped || (uint32)hidden != 0 || (m_hidden.load(std::memory_order_acquire) >> 32) != (hidden >> 32)))
+        {
+            std::this_thread::yield();
+            hidden = m_hidden.load(std::memory_order_acquire);
+            nodeIndex = takeFittingNode(minBinIndex, skipped);
+        }
+
+        if (nodeIndex == Node::unused)
+        {
+            return {.offset = Allocation::NO_SPACE, .metadata = Allocation::NO_SPACE};
+        }
+
+        Node& node = m_nodes[nodeIndex];
+        uint32 nodeTotalSize = node.dataSize;
+        node.dataSize = size;
+        node.used = true;
+
+        // Push back reminder N elements to a lower bin
+        uint32 reminderSize = nodeTotalSize - size;
+        if (reminderSize > 0)
+        {
+            uint32 newNodeIndex = popFreeNode();
+            if (newNodeIndex == Node::unused)
+            {
+                // Out of nodes: Undo
+                node.dataSize = nodeTotalSize;
+                node.used = false;
+                insertNodeIntoBin(nodeIndex);
+                m_hidden.fetch_sub(1, std::memory_order_release);
+                node.lock.unlock();
+                return {.offset = Allocation::NO_SPACE, .metadata = Allocation::NO_SPACE};
+            }
+
+            // Next neighbor is higher in offset order: Blocking lock is safe
+            Node& newNode = m_nodes[newNodeIndex];
+            newNode.lock.lock();
+            newNode.dataOffset = node.dataOffset + size;
+            newNode.dataSize = reminderSize;
+            newNode.used = false;
+            newNode.neighborPrev = nodeIndex;
+            newNode.neighborNext = node.neighborNext;
+            if (node.neighborNext != Node::unused)
+            {
+                Node& nextNode = m_nodes[node.neighborNext];
+                nextNode.lock.lock();
+                nextNode.neighborPrev = newNodeIndex;
+                nextNode.lock.unlock();
+            }
+            node.neighborNext = newNodeIndex;
+
+            insertNodeIntoBin(newNodeIndex);
+            newNode.lock.unlock();
+        }
+        m_hidden.fetch_sub(1, std::memory_order_release);
+
+        uint32 offset = node.dataOffset;
+        node.lock.unlock();
+        return {.offset = offset, .metadata = nodeIndex};
+    }
+
+    void ConcurrentAllocator::free(Allocation allocation)
+    {
+        ASSERT(allocation.metadata != Allocation::NO_SPACE);
+        if (!m_nodes) return;
+
+        uint32 nodeIndex = allocation.metadata;
+        Node& node = m_nodes[nodeIndex];
+
+        // Lock the node and the neighbors whose links change: prev (+ its prev if merged), next (+ its next if merged).
+        // Lower offsets are try-locks: Release all and retry on failure.
+        uint32 prev, prevPrev, next, nextNext;
+        for (;;)
+        {
+            node.lock.lock();
+            ASSERT(node.used == true);
+
+            prev = node.neighborPrev;
+            prevPrev = Node::unused;
+            if (prev != Node::unused)
+            {
+                if (!m_nodes[prev].lock.tryLock())
+                {
+                    node.lock.unlock();
+                    std::this_thread::yield();
+                    continue;
+                }
+                if (m_nodes[prev].used == false)
+                {
+                    prevPrev = m_nodes[prev].neighborPrev;
+                    if (prevPrev != Node::unused && !m_nodes[prevPrev].lock.tryLock())
+                    {
+                        m_nodes[prev].lock.unlock();
+                        node.lock.unlock();
+                        std::this_thread::yield();
+                        continue;
+                    }
+                }
+            }
+            break;
+        }
+
+        next = node.neighborNext;
+        nextNext = Node::unused;
+        if (next != Node::unused)
+        {
+            m_nodes[next].lock.lock();
+            if (m_nodes[next].used == false)
+            {
+                nextNext = m_nodes[next].neighborNext;
+                if (nextNext != Node::unused) m_nodes[nextNext].lock.lock();
+            }
+        }
+
+        // Merge with neighbors. The freed node is reused as the combined node.
+        uint32 offset = node.dataOffset;
+        uint32 size = node.dataSize;
+        uint32 neighborPrev = prev;
+        uint32 neighborNext = next;
+        bool mergePrev = prev != Node::unused && m_nodes[prev].used == false;
+        bool mergeNext = next != Node::unused && m_nodes[next].used == false;
+
+        if (mergePrev || mergeNext) m_hidden.fetch_add(HIDE, std::memory_order_acq_rel);
+        if (mergePrev)
+        {
+            removeNodeFromBin(prev);
+            offset = m_nodes[prev].dataOffset;
+            size += m_nodes[prev].dataSize;
+            neighborPrev = prevPrev;
+        }
+        if (mergeNext)
+        {
+            removeNodeFromBin(next);
+            size += m_nodes[next].dataSize;
+            neighborNext = nextNext;
+        }
+
+        node.dataOffset = offset;
+        node.dataSize = size;
+        node.used = false;
+        node.neighborPrev = neighborPrev;
+        node.neighborNext = neighborNext;
+        if (neighborPrev != Node::unused) m_nodes[neighborPrev].neighborNext = nodeIndex;
+        if (neighborNext != Node::unused) m_nodes[neighborNext].neighborPrev = nodeIndex;
+        insertNodeIntoBin(nodeIndex);
+        if (mergePrev || mergeNext) m_hidden.fetch_sub(1, std::memory_order_release);
+
+        // Unlock. Merged nodes go to the freelist only after their lock is released.
+        if (nextNext != Node::unused) m_nodes[nextNext].lock.unlock();
+        if (next != Node::unused) m_nodes[next].lock.unlock();
+        if (prevPrev != Node::unused) m_nodes[prevPrev].lock.unlock();
+        if (prev != Node::unused) m_nodes[prev].lock.unlock();
+        node.lock.unlock();
+
+        if (mergePrev) pushFreeNode(prev);
+        if (mergeNext) pushFreeNode(next);
+    }
+
+    uint32 ConcurrentAllocator::takeFittingNode(uint32 minBinIndex, bool& skipped)
+    {
+        uint32 minTopBinIndex = minBinIndex >> TOP_BINS_INDEX_SHIFT;
+        uint32 minLeafBinIndex = minBinIndex & LEAF_BINS_INDEX_MASK;
+        skipped = false;
+
+        // Top mask is a hint, leaf masks are exact under the top bin lock
+        uint32 topBinIndex = findLowestSetBitAfter(m_usedBinsTop.load(std::memory_order_acquire), minTopBinIndex);
+        while (topBinIndex != Allocation::NO_SPACE)
+        {
+            TopBin& topBin = m_topBins[topBinIndex];
+            topBin.lock.lock();
+
+            // All leaf bins of higher top bins fit the alloc
+            uint32 leafBinIndex = findLowestSetBitAfter(topBin.usedBins, topBinIndex == minTopBinIndex ? minLeafBinIndex : 0);
+            while (leafBinIndex != Allocation::NO_SPACE)
+            {
+                // Skip nodes that a concurrent free is merging
+                for (uint32 candidate = topBin.binIndices[leafBinIndex]; candidate != Node::unused; candidate = m_nodes[candidate].binListNext)
+                {
+                    if (m_nodes[candidate].lock.tryLock())
+                    {
+                        m_hidden.fetch_add(HIDE, std::memory_order_acq_rel);
+                        removeNodeFromBinLocked(candidate);
+                        topBin.lock.unlock();
+                        return candidate;
+                    }
+                    skipped = true;
+                }
+                leafBinIndex = findLowestSetBitAfter(topBin.usedBins, leafBinIndex + 1);
+            }
+
+            topBin.lock.unlock();
+            if (topBinIndex + 1 == NUM_TOP_BINS) break;
+            topBinIndex = findLowestSetBitAfter(m_usedBinsTop.load(std::memory_order_acquire), topBinIndex + 1);
+        }
+        return Node::unused;
+    }
+
+    void ConcurrentAllocator::insertNodeIntoBin(uint32 nodeIndex)
+    {
+        Node& node = m_nodes[nodeIndex];
+
+        // Round down to bin index to ensure that bin >= alloc
+        uint32 binIndex = SmallFloat::uintToFloatRoundDown(node.dataSize);
+        uint32 topBinIndex = binIndex >> TOP_BINS_INDEX_SHIFT;
+        uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+
+        TopBin& topBin = m_topBins[topBinIndex];
+        topBin.lock.lock();
+
+        // Bin was empty before?
+        if (topBin.binIndices[leafBinIndex] == Node::unused)
+        {
+            if (topBin.usedBins == 0) m_usedBinsTop.fetch_or(1 << topBinIndex, std::memory_order_release);
+            topBin.usedBins |= 1 << leafBinIndex;
+        }
+
+        // Insert on top of the bin linked list (next = old top)
+        uint32 topNodeIndex = topBin.binIndices[leafBinIndex];
+        node.binListPrev = Node::unused;
+        node.binListNext = topNodeIndex;
+        if (topNodeIndex != Node::unused) m_nodes[topNodeIndex].binListPrev = nodeIndex;
+        topBin.binIndices[leafBinIndex] = nodeIndex;
+
+        m_freeStorage.fetch_add(node.dataSize, std::memory_order_relaxed);
+        topBin.lock.unlock();
+    }
+
+    void ConcurrentAllocator::removeNodeFromBin(uint32 nodeIndex)
+    {
+        uint32 binIndex = SmallFloat::uintToFloatRoundDown(m_nodes[nodeIndex].dataSize);
+        TopBin& topBin = m_topBins[binIndex >> TOP_BINS_INDEX_SHIFT];
+        topBin.lock.lock();
+        removeNodeFromBinLocked(nodeIndex);
+        topBin.lock.unlock();
+    }
+
+    void ConcurrentAllocator::removeNodeFromBinLocked(uint32 nodeIndex)
+    {
+        Node& node = m_nodes[nodeIndex];
+        uint32 binIndex = SmallFloat::uintToFloatRoundDown(node.dataSize);
+        uint32 topBinIndex = binIndex >> TOP_BINS_INDEX_SHIFT;
+        uint32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+        TopBin& topBin = m_topBins[topBinIndex];
+
+        if (node.binListPrev != Node::unused)
+        {
+            m_nodes[node.binListPrev].binListNext = node.binListNext;
+        }
+        else
+        {
+            topBin.binIndices[leafBinIndex] = node.binListNext;
+        }
+        if (node.binListNext != Node::unused) m_nodes[node.binListNext].binListPrev = node.binListPrev;
+
+        // Bin empty?
+        if (topBin.binIndices[leafBinIndex] == Node::unused)
+        {
+            topBin.usedBins &= ~(1 << leafBinIndex);
+            if (topBin.usedBins == 0) m_usedBinsTop.fetch_and(~(1u << topBinIndex), std::memory_order_release);
+        }
+
+        node.binListPrev = node.binListNext = Node::unused;
+        m_freeStorage.fetch_sub(node.dataSize, std::memory_order_relaxed);
+    }
+
+    uint32 ConcurrentAllocator::popFreeNode()
+    {
+        m_freeNodesLock.lock();
+        uint32 nodeIndex = m_freeOffset != Allocation::NO_SPACE ? m_freeNodes[m_freeOffset--] : Node::unused;
+        m_freeNodesLock.unlock();
+        return nodeIndex;
+    }
+
+    void ConcurrentAllocator::pushFreeNode(uint32 nodeIndex)
+    {
+        m_freeNodesLock.lock();
+        m_freeNodes[++m_freeOffset] = nodeIndex;
+        m_freeNodesLock.unlock();
+    }
+
+    uint32 ConcurrentAllocator::allocationSize(Allocation allocation) const
+    {
+        if (allocation.metadata == Allocation::NO_SPACE) return 0;
+        if (!m_nodes) return 0;
+
+        // Owner only reads its own used node: dataSize doesn't change while allocated
+        return m_nodes[allocation.metadata].dataSize;
+    }
+
+    StorageReport ConcurrentAllocator::storageReport() const
+    {
+        // Snapshot: Concurrent modifications may be partially visible
+        uint32 largestFreeRegion = 0;
+        uint32 usedBinsTop = m_usedBinsTop.load(std::memory_order_acquire);
+        if (usedBinsTop)
+        {
+            uint32 topBinIndex = 31 - std::countl_zero(usedBinsTop);
+            const TopBin& topBin = m_topBins[topBinIndex];
+            topBin.lock.lock();
+            if (topBin.usedBins)
+            {
+                uint32 leafBinIndex = 31 - std::countl_zero((uint32)topBin.usedBins);
+                largestFreeRegion = SmallFloat::floatToUint((topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex);
+            }
+            topBin.lock.unlock();
+        }
+
+        return {.totalFreeSpace = m_freeStorage.load(std::memory_order_relaxed), .largestFreeRegion = largestFreeRegion};
+    }
+}
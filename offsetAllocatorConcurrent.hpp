@@ -0,0 +1,89 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <atomic>
+
+namespace OffsetAllocator
+{
+    // Fine grained thread safe variant of Allocator. Same bins and placement policy, no global lock:
+    // - Bin masks are atomics. Each top bin has its own lock (its 8 leaf bin lists + mask bits).
+    // - Each node has a lock. Node fields are only touched under the node's lock.
+    //   Blocking node locks are taken in offset order, out of order locks are try-locks (release all + retry).
+    // - Node freelist has its own lock.
+    // Allocations in different size classes proceed in parallel. A fitting node that is locked by another thread
+    // is skipped. Allocation retries before failing if the search raced with a split or merge.
+    class ConcurrentAllocator
+    {
+    public:
+        ConcurrentAllocator(uint32 size, uint32 maxAllocs = 128 * 1024);
+        ~ConcurrentAllocator();
+
+        Allocation allocate(uint32 size);
+        void free(Allocation allocation);
+
+        uint32 allocationSize(Allocation allocation) const;
+        StorageReport storageReport() const;
+
+    private:
+        struct SpinLock
+        {
+            std::atomic<bool> locked = false;
+
+            void lock();
+            bool tryLock() { return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire); }
+            void unlock() { locked.store(false, std::memory_order_release); }
+        };
+
+        struct Node
+        {
+            static constexpr NodeIndex unused = 0xffffffff;
+
+            uint32 dataOffset = 0;
+            uint32 dataSize = 0;
+            NodeIndex binListPrev = unused;
+            NodeIndex binListNext = unused;
+            NodeIndex neighborPrev = unused;
+            NodeIndex neighborNext = unused;
+            bool used = false;
+            SpinLock lock;
+        };
+
+        struct alignas(64) TopBin
+        {
+            mutable SpinLock lock;
+            uint8 usedBins = 0;
+            NodeIndex binIndices[BINS_PER_LEAF];
+        };
+
+        // Returns a locked node removed from its bin, or unused. skipped = a fitting node was locked by another thread.
+        uint32 takeFittingNode(uint32 minBinIndex, bool& skipped);
+
+        // Caller holds the node lock. Takes the top bin lock.
+        void insertNodeIntoBin(uint32 nodeIndex);
+        void removeNodeFromBin(uint32 nodeIndex);
+        void removeNodeFromBinLocked(uint32 nodeIndex);
+
+        uint32 popFreeNode();
+        void pushFreeNode(uint32 nodeIndex);
+
+        uint32 m_size;
+        uint32 m_maxAllocs;
+        std::atomic<uint32> m_freeStorage;
+        std::atomic<uint32> m_usedBinsTop;
+
+        // Free space temporarily out of the bins (nodes being split or merged): (hide count << 32) | currently hidden
+        static constexpr uint64 HIDE = (1ull << 32) + 1;
+        std::atomic<uint64> m_hidden;
+        TopBin m_topBins[NUM_TOP_BINS];
+
+        Node* m_nodes;
+
+        SpinLock m_freeNodesLock;
+        NodeIndex* m_freeNodes;
+        uint32 m_freeOffset;
+    };
+}
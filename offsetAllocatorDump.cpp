@@ -0,0 +1,313 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorDump.hpp"
+
+#include <stdarg.h>
+
+namespace OffsetAllocator
+{
+    static constexpr uint32 DUMP_MAGIC = 0x4448414f; // "OAHD"
+    static constexpr uint32 DUMP_VERSION = 2; // 2: Bin arrays sized by the core bin layout (31 top bins)
+    static constexpr uint32 UNUSED = 0xffffffff;
+
+    struct HeapDumpHeader
+    {
+        uint32 magic;
+        uint32 version;
+        uint32 size;
+        uint32 maxAllocs;
+        uint32 freeOffset;
+        uint32 freeStorage;
+        uint32 usedBinsTop;
+        uint32 reserved;
+    };
+
+    bool captureHeapDump(const Allocator& allocator, HeapDump& dump)
+    {
+        const Allocator::Core& core = allocator.m_core;
+        if (!core.nodes()) return false;
+
+        auto widen = [](NodeIndex index) { return index == Allocator::Node::unused ? UNUSED : (uint32)index; };
+
+        dump.size = core.size();
+        dump.maxAllocs = core.maxAllocs();
+        dump.freeOffset = core.freeNodeCount();
+        dump.freeStorage = core.freeStorage();
+        dump.usedBinsTop = core.usedBinsTop();
+        for (uint32 i = 0; i < NUM_TOP_BINS; i++) dump.usedBins[i] = core.usedBins(i);
+        for (uint32 i = 0; i < NUM_LEAF_BINS; i++) dump.binIndices[i] = widen(core.binHead(i));
+
+        dump.nodes.resize(core.maxAllocs());
+        dump.freeNodes.resize(core.maxAllocs());
+        for (uint32 i = 0; i < core.maxAllocs(); i++)
+        {
+            const Allocator::Node& node = core.nodes()[i];
+            dump.nodes[i] = {
+                .dataOffset = node.dataOffset,
+                .dataSize = node.dataSize,
+                .binListPrev = widen(node.binListPrev),
+                .binListNext = widen(node.binListNext),
+                .neighborPrev = widen(node.neighborPrev),
+                .neighborNext = widen(node.neighborNext),
+                .used = node.used ? 1u : 0u,
+            };
+            dump.freeNodes[i] = core.freeNodes()[i];
+        }
+        return true;
+    }
+
+    bool writeHeapDump(const HeapDump& dump, FILE* file)
+    {
+        HeapDumpHeader header = {
+            .magic = DUMP_MAGIC,
+            .version = DUMP_VERSION,
+            .size = dump.size,
+            .maxAllocs = dump.maxAllocs,
+            .freeOffset = dump.freeOffset,
+            .freeStorage = dump.freeStorage,
+            .usedBinsTop = dump.usedBinsTop,
+            .reserved = 0,
+        };
+        if (dump.nodes.size() != dump.maxAllocs || dump.freeNodes.size() != dump.maxAllocs) return false;
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(dump.usedBins, sizeof(dump.usedBins), 1, file) == 1;
+        ok = ok && fwrite(dump.binIndices, sizeof(dump.binIndices), 1, file) == 1;
+        ok = ok && (dump.maxAllocs == 0 || fwrite(dump.nodes.data(), sizeof(HeapDump::Node), dump.maxAllocs, file) == dump.maxAllocs);
+        ok = ok && (dump.maxAllocs == 0 || fwrite(dump.freeNodes.data(), sizeof(uint32), dump.maxAllocs, file) == dump.maxAllocs);
+        return ok;
+    }
+
+    bool loadHeapDump(FILE* file, HeapDump& dump)
+    {
+        HeapDumpHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1) return false;
+        if (header.magic != DUMP_MAGIC || header.version != DUMP_VERSION) return false;
+
+        // Untrusted header: Check maxAllocs against the rest of the file before sizing anything by it.
+        // The file must hold exactly the bins, maxAllocs nodes and maxAllocs freelist entries.
+        if (header.freeOffset >= header.maxAllocs) return false;
+        long start = ftell(file);
+        if (start < 0 || fseek(file, 0, SEEK_END) != 0) return false;
+        long end = ftell(file);
+        if (end < start || fseek(file, start, SEEK_SET) != 0) return false;
+        uint64 expectedBytes = sizeof(dump.usedBins) + sizeof(dump.binIndices) + (uint64)header.maxAllocs * (sizeof(HeapDump::Node) + sizeof(uint32));
+        if ((uint64)(end - start) != expectedBytes) return false;
+
+        dump.size = header.size;
+        dump.maxAllocs = header.maxAllocs;
+        dump.freeOffset = header.freeOffset;
+        dump.freeStorage = header.freeStorage;
+        dump.usedBinsTop = header.usedBinsTop;
+        if (fread(dump.usedBins, sizeof(dump.usedBins), 1, file) != 1) return false;
+        if (fread(dump.binIndices, sizeof(dump.binIndices), 1, file) != 1) return false;
+
+        dump.nodes.resize(header.maxAllocs);
+        dump.freeNodes.resize(header.maxAllocs);
+        if (fread(dump.nodes.data(), sizeof(HeapDump::Node), header.maxAllocs, file) != header.maxAllocs) return false;
+        return fread(dump.freeNodes.data(), sizeof(uint32), header.maxAllocs, file) == header.maxAllocs;
+    }
+
+    struct DumpChecker
+    {
+        HeapDumpAnalysis& analysis;
+        uint32 maxErrors;
+
+        void error(const char* format, ...)
+        {
+            if (analysis.errorCount++ >= maxErrors) return;
+            char message[256];
+            va_list args;
+            va_start(args, format);
+            vsnprintf(message, sizeof(message), format, args);
+            va_end(args);
+            analysis.errors.push_back(message);
+        }
+    };
+
+    HeapDumpAnalysis analyzeHeapDump(const HeapDump& dump, uint32 maxAlignment, uint32 maxErrors)
+    {
+        HeapDumpAnalysis analysis;
+        DumpChecker check = {.analysis = analysis, .maxErrors = maxErrors};
+        const std::vector<HeapDump::Node>& nodes = dump.nodes;
+        uint32 nodeCount = (uint32)nodes.size();
+
+        // Freelist nodes are self linked. Everything else is live.
+        uint32 liveCount = 0;
+        uint32 head = UNUSED;
+        for (uint32 i = 0; i < nodeCount; i++)
+        {
+            if (nodes[i].neighborPrev == i && nodes[i].neighborNext == i) continue;
+            liveCount++;
+            if (nodes[i].neighborPrev == UNUSED)
+            {
+                if (head != UNUSED) check.error("Multiple chain heads: node %u and node %u", head, i);
+                else head = i;
+            }
+        }
+        if (dump.freeOffset >= nodeCount || liveCount != nodeCount - dump.freeOffset - 1)
+        {
+            check.error("Live node count %u doesn't match the freelist (freeOffset %u, maxAllocs %u)", liveCount, dump.freeOffset, nodeCount);
+        }
+        if (head == UNUSED) check.error("No chain head (node with no previous neighbor)");
+
+        // Walk the neighbor chain in offset order
+        struct Span
+        {
+            uint32 offset;
+            uint32 size;
+            bool used;
+        };
+        std::vector<Span> spans;
+        std::vector<uint8> inChain(nodeCount, 0);
+        uint32 cursor = 0;
+        uint64 chainFreeStorage = 0;
+        for (uint32 nodeIndex = head, prev = UNUSED; nodeIndex != UNUSED; )
+        {
+            if (nodeIndex >= nodeCount) { check.error("Node %u: Neighbor link out of range", prev); break; }
+            if (inChain[nodeIndex]) { check.error("Node %u: Neighbor chain loops back to node %u", prev, nodeIndex); break; }
+            inChain[nodeIndex] = 1;
+
+            const HeapDump::Node& node = nodes[nodeIndex];
+            if (node.neighborPrev != prev) check.error("Node %u: Previous neighbor %u, expected %u", nodeIndex, node.neighborPrev, prev);
+            if (node.dataOffset != cursor) check.error("Node %u: Offset %u, previous region ends at %u", nodeIndex, node.dataOffset, cursor);
+            spans.push_back({.offset = node.dataOffset, .size = node.dataSize, .used = node.used != 0});
+            if (!node.used) chainFreeStorage += node.dataSize;
+            cursor = node.dataOffset + node.dataSize;
+            prev = nodeIndex;
+            nodeIndex = node.neighborNext;
+        }
+        if (cursor != dump.size) check.error("Neighbor chain ends at %u, size is %u", cursor, dump.size);
+        if (spans.size() != liveCount) check.error("Neighbor chain has %u nodes, %u live nodes", (uint32)spans.size(), liveCount);
+        if (chainFreeStorage != dump.freeStorage) check.error("Free storage %u, free regions sum to %llu", dump.freeStorage, chainFreeStorage);
+
+        // Bin lists: Free chain nodes of the right size class, each exactly once. Masks match non empty lists.
+        std::vector<uint8> inBin(nodeCount, 0);
+        for (uint32 bin = 0; bin < NUM_LEAF_BINS; bin++)
+        {
+            uint32 top = bin >> TOP_BINS_INDEX_SHIFT;
+            uint32 leaf = bin & LEAF_BINS_INDEX_MASK;
+            bool maskBit = (dump.usedBins[top] >> leaf) & 1;
+            bool listNonEmpty = dump.binIndices[bin] != UNUSED;
+            if (maskBit != listNonEmpty) check.error("Bin %u: Mask bit %u, list %s", bin, (uint32)maskBit, listNonEmpty ? "non empty" : "empty");
+
+            uint32 prev = UNUSED;
+            for (uint32 nodeIndex = dump.binIndices[bin], steps = 0; nodeIndex != UNUSED; steps++)
+            {
+                if (nodeIndex >= nodeCount || steps > nodeCount) { check.error("Bin %u: List link out of range or looping", bin); break; }
+                const HeapDump::Node& node = nodes[nodeIndex];
+                if (!inChain[nodeIndex]) check.error("Bin %u: Node %u is not in the neighbor chain", bin, nodeIndex);
+                if (node.used) check.error("Bin %u: Node %u is used", bin, nodeIndex);
+                if (SmallFloat::uintToFloatRoundDown(node.dataSize) != bin) check.error("Bin %u: Node %u size %u belongs to another bin", bin, nodeIndex, node.dataSize);
+                if (node.binListPrev != prev) check.error("Bin %u: Node %u previous %u, expected %u", bin, nodeIndex, node.binListPrev, prev);
+                if (inBin[nodeIndex]++) { check.error("Bin %u: Node %u listed twice", bin, nodeIndex); break; }
+                prev = nodeIndex;
+                nodeIndex = node.binListNext;
+            }
+        }
+        for (uint32 top = 0; top < NUM_TOP_BINS; top++)
+        {
+            bool topBit = (dump.usedBinsTop >> top) & 1;
+            if (topBit != (dump.usedBins[top] != 0)) check.error("Top bin %u: Mask bit %u, leaf mask 0x%02x", top, (uint32)topBit, dump.usedBins[top]);
+        }
+        for (uint32 i = 0; i < nodeCount; i++)
+        {
+            if (inChain[i] && !nodes[i].used && !inBin[i]) check.error("Node %u: Free but not in any bin", i);
+        }
+
+        // Free span metrics
+        std::vector<HeapDumpAnalysis::SpanClass> spanClasses(NUM_LEAF_BINS, HeapDumpAnalysis::SpanClass{});
+        uint32 largestBin = 0;
+        bool anyFree = false;
+        for (const Span& span : spans)
+        {
+            if (span.used)
+            {
+                analysis.usedCount++;
+                analysis.usedBytes += span.size;
+                continue;
+            }
+            analysis.freeCount++;
+            analysis.freeBytes += span.size;
+            if (span.size > analysis.largestFreeSpan) analysis.largestFreeSpan = span.size;
+
+            uint32 bin = SmallFloat::uintToFloatRoundDown(span.size);
+            spanClasses[bin].count++;
+            spanClasses[bin].bytes += span.size;
+            if (!anyFree || bin > largestBin) largestBin = bin;
+            anyFree = true;
+        }
+        for (uint32 bin = 0; bin < NUM_LEAF_BINS; bin++)
+        {
+            if (spanClasses[bin].count == 0) continue;
+            spanClasses[bin].binSize = SmallFloat::floatToUint(bin);
+            analysis.freeSpans.push_back(spanClasses[bin]);
+        }
+
+        // Allocation needs a free node (the remainder split), like storageReport()
+        if (anyFree && dump.freeOffset > 0) analysis.largestAllocatable = SmallFloat::floatToUint(largestBin);
+        if (analysis.freeBytes) analysis.fragmentation = 1.0 - (double)analysis.largestFreeSpan / (double)analysis.freeBytes;
+
+        for (uint32 alignment = 1; alignment <= maxAlignment && alignment != 0; alignment <<= 1)
+        {
+            uint32 largest = 0;
+            for (const Span& span : spans)
+            {
+                if (span.used) continue;
+                uint64 alignedOffset = ((uint64)span.offset + alignment - 1) & ~(uint64)(alignment - 1);
+                uint64 end = (uint64)span.offset + span.size;
+                if (alignedOffset < end && end - alignedOffset > largest) largest = (uint32)(end - alignedOffset);
+            }
+            analysis.alignedFits.push_back({.alignment = alignment, .largestSize = largest});
+        }
+
+        // Sliding compaction: Every used span not already at its packed position moves
+        uint64 packed = 0;
+        for (const Span& span : spans)
+        {
+            if (!span.used) continue;
+            if (span.offset != packed)
+            {
+                analysis.compactionMoves++;
+                analysis.compactionBytesMoved += span.size;
+            }
+            packed += span.size;
+        }
+        analysis.compactedLargestFree = packed < dump.size ? (uint32)(dump.size - packed) : 0;
+        return analysis;
+    }
+
+    void printHeapDumpAnalysis(const HeapDumpAnalysis& analysis, FILE* file)
+    {
+        fprintf(file, "Used: %u allocations, %llu elements\n", analysis.usedCount, analysis.usedBytes);
+        fprintf(file, "Free: %u spans, %llu elements\n", analysis.freeCount, analysis.freeBytes);
+        fprintf(file, "Largest free span: %u, largest allocatable (bin rounded): %u, fragmentation: %.3f\n",
+                analysis.largestFreeSpan, analysis.largestAllocatable, analysis.fragmentation);
+
+        fprintf(file, "\nFree span distribution (round down bin size: count, elements):\n");
+        for (const HeapDumpAnalysis::SpanClass& spanClass : analysis.freeSpans)
+        {
+            fprintf(file, "  >= %10u: %8u %14llu\n", spanClass.binSize, spanClass.count, spanClass.bytes);
+        }
+
+        fprintf(file, "\nLargest allocatable size per alignment:\n");
+        for (const HeapDumpAnalysis::AlignedFit& fit : analysis.alignedFits)
+        {
+            fprintf(file, "  %6u: %u\n", fit.alignment, fit.largestSize);
+        }
+
+        fprintf(file, "\nSliding compaction: %u moves, %llu elements moved, largest free span after: %u\n",
+                analysis.compactionMoves, analysis.compactionBytesMoved, analysis.compactedLargestFree);
+
+        fprintf(file, "\nConsistency: %s (%u errors)\n", analysis.errorCount ? "FAILED" : "OK", analysis.errorCount);
+        for (const std::string& message : analysis.errors)
+        {
+            fprintf(file, "  %s\n", message.c_str());
+        }
+        if (analysis.errorCount > analysis.errors.size())
+        {
+            fprintf(file, "  ... %u more\n", analysis.errorCount - (uint32)analysis.errors.size());
+        }
+    }
+}
@@ -0,0 +1,90 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Raw allocator metadata: Node array, freelist, bin heads and masks. Taken as is (no validation), so a
+    // corrupted allocator dumps and loads fine. Node indices are widened to 32 bits (unused = 0xffffffff).
+    struct HeapDump
+    {
+        struct Node
+        {
+            uint32 dataOffset;
+            uint32 dataSize;
+            uint32 binListPrev;
+            uint32 binListNext;
+            uint32 neighborPrev;
+            uint32 neighborNext;
+            uint32 used;
+        };
+
+        uint32 size = 0;
+        uint32 maxAllocs = 0;
+        uint32 freeOffset = 0;
+        uint32 freeStorage = 0;
+        uint32 usedBinsTop = 0;
+        uint8 usedBins[NUM_TOP_BINS] = {};
+        uint32 binIndices[NUM_LEAF_BINS] = {};
+        std::vector<Node> nodes;
+        std::vector<uint32> freeNodes;
+    };
+
+    struct HeapDumpAnalysis
+    {
+        // Free spans grouped by SmallFloat round down bin (the bin allocate() keeps them in). Non empty bins only.
+        struct SpanClass
+        {
+            uint32 binSize;
+            uint32 count;
+            uint64 bytes;
+        };
+
+        // Largest size that fits a free span with its start aligned up to the alignment
+        struct AlignedFit
+        {
+            uint32 alignment;
+            uint32 largestSize;
+        };
+
+        uint32 usedCount = 0;
+        uint64 usedBytes = 0;
+        uint32 freeCount = 0;
+        uint64 freeBytes = 0;
+        uint32 largestFreeSpan = 0;
+        uint32 largestAllocatable = 0;  // Guaranteed by the bins (round up search): allocate(largestAllocatable) succeeds
+        double fragmentation = 0.0;     // 1 - largestFreeSpan / freeBytes
+        std::vector<SpanClass> freeSpans;
+        std::vector<AlignedFit> alignedFits;
+
+        // Simulated sliding compaction: Used allocations packed to the start in offset order
+        uint32 compactionMoves = 0;
+        uint64 compactionBytesMoved = 0;
+        uint32 compactedLargestFree = 0;
+
+        // Consistency: Neighbor chain, bin lists vs free nodes, bin masks vs bin lists, free storage total
+        std::vector<std::string> errors; // First maxErrors messages
+        uint32 errorCount = 0;
+    };
+
+    // Copies the allocator metadata. O(maxAllocs).
+    bool captureHeapDump(const Allocator& allocator, HeapDump& dump);
+
+    // Binary dump file: Header, bin heads + masks, nodes, freelist. Little endian host layout.
+    // Loading checks the header against the file size (seekable files only) and fails on a mismatch.
+    bool writeHeapDump(const HeapDump& dump, FILE* file);
+    bool loadHeapDump(FILE* file, HeapDump& dump);
+
+    // Works on dumps of corrupted allocators: Broken links are reported, not followed blindly.
+    // Aligned fits are computed for power of two alignments up to maxAlignment.
+    HeapDumpAnalysis analyzeHeapDump(const HeapDump& dump, uint32 maxAlignment = 4096, uint32 maxErrors = 32);
+
+    void printHeapDumpAnalysis(const HeapDumpAnalysis& analysis, FILE* file);
+}
@@ -0,0 +1,40 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+// Offline heap dump analyzer: offsetAllocatorDumpAnalyzer <dump file> [max alignment]
+// Exit code: 0 = consistent, 1 = can't load, 2 = inconsistent metadata
+
+#include "offsetAllocatorDump.hpp"
+
+#include <stdlib.h>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <dump file> [max alignment]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Can't open %s\n", argv[1]);
+        return 1;
+    }
+
+    OffsetAllocator::HeapDump dump;
+    bool loaded = OffsetAllocator::loadHeapDump(file, dump);
+    fclose(file);
+    if (!loaded)
+    {
+        fprintf(stderr, "%s is not a valid heap dump\n", argv[1]);
+        return 1;
+    }
+
+    OffsetAllocator::uint32 maxAlignment = argc > 2 ? (OffsetAllocator::uint32)strtoul(argv[2], nullptr, 0) : 4096;
+    printf("Heap dump %s: size %u, maxAllocs %u\n\n", argv[1], dump.size, dump.maxAllocs);
+    OffsetAllocator::HeapDumpAnalysis analysis = OffsetAllocator::analyzeHeapDump(dump, maxAlignment);
+    OffsetAllocator::printHeapDumpAnalysis(analysis, stdout);
+    return analysis.errorCount ? 2 : 0;
+}
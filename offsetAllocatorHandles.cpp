@@ -0,0 +1,99 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorHandles.hpp"
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+namespace OffsetAllocator
+{
+    HandleTable::HandleTable(uint32 size, uint32 maxAllocs) :
+        m_allocator(size, maxAllocs),
+        m_maxAllocs(maxAllocs),
+        m_entries(new Entry[maxAllocs]),
+        m_freeHandles(new Handle[maxAllocs]),
+        m_freeCount(maxAllocs)
+    {
+        // Stack in inverse order so that handle 0 pops first
+        for (uint32 i = 0; i < maxAllocs; i++)
+        {
+            m_freeHandles[i] = maxAllocs - i - 1;
+        }
+    }
+
+    HandleTable::HandleTable(HandleTable &&other) :
+        m_allocator(static_cast<Allocator&&>(other.m_allocator)),
+        m_maxAllocs(other.m_maxAllocs),
+        m_entries(other.m_entries),
+        m_freeHandles(other.m_freeHandles),
+        m_freeCount(other.m_freeCount)
+    {
+        other.m_entries = nullptr;
+        other.m_freeHandles = nullptr;
+        other.m_freeCount = 0;
+        other.m_maxAllocs = 0;
+    }
+
+    HandleTable::~HandleTable()
+    {
+        delete[] m_entries;
+        delete[] m_freeHandles;
+    }
+
+    Handle HandleTable::allocate(uint32 size)
+    {
+        // Allocator runs out of nodes before we run out of handles (one node per live allocation)
+        if (m_freeCount == 0) return INVALID;
+
+        Allocation allocation = m_allocator.allocate(size);
+        if (allocation.offset == Allocation::NO_SPACE) return INVALID;
+
+        Handle handle = m_freeHandles[--m_freeCount];
+        m_entries[handle] = {.offset = allocation.offset, .size = size, .metadata = allocation.metadata};
+        return handle;
+    }
+
+    void HandleTable::free(Handle handle)
+    {
+        ASSERT(handle < m_maxAllocs);
+        Entry& entry = m_entries[handle];
+        ASSERT(entry.offset != Allocation::NO_SPACE);
+
+        m_allocator.free({.offset = entry.offset, .metadata = entry.metadata});
+        entry = {};
+        m_freeHandles[m_freeCount++] = handle;
+    }
+
+    void HandleTable::relocate(Handle handle, Allocation newAllocation)
+    {
+        ASSERT(handle < m_maxAllocs);
+        ASSERT(newAllocation.offset != Allocation::NO_SPACE);
+        Entry& entry = m_entries[handle];
+        ASSERT(m_allocator.allocationSize(newAllocation) == entry.size);
+
+        m_allocator.free({.offset = entry.offset, .metadata = entry.metadata});
+        entry.offset = newAllocation.offset;
+        entry.metadata = newAllocation.metadata;
+    }
+
+    bool HandleTable::compactMetadata(uint32 newMaxAllocs)
+    {
+        NodeIndex* oldToNew = new NodeIndex[m_allocator.maxAllocs()];
+        bool compacted = m_allocator.compactMetadata(newMaxAllocs, oldToNew);
+        if (compacted)
+        {
+            for (uint32 i = 0; i < m_maxAllocs; i++)
+            {
+                Entry& entry = m_entries[i];
+                if (entry.offset != Allocation::NO_SPACE) entry.metadata = oldToNew[entry.metadata];
+            }
+        }
+        delete[] oldToNew;
+        return compacted;
+    }
+}
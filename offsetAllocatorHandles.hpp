@@ -0,0 +1,58 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+namespace OffsetAllocator
+{
+    typedef uint32 Handle;
+
+    // Stable 32 bit handles on top of Allocator. Users store handles instead of offsets.
+    // Relocation (compaction) only updates the table. Resolve is a single indexed load.
+    class HandleTable
+    {
+    public:
+        struct Entry
+        {
+            uint32 offset = Allocation::NO_SPACE;
+            uint32 size = 0;
+            NodeIndex metadata = Allocation::NO_SPACE; // internal: allocator node index
+        };
+
+        static constexpr Handle INVALID = 0xffffffff;
+
+        HandleTable(uint32 size, uint32 maxAllocs = 128 * 1024);
+        HandleTable(HandleTable &&other);
+        ~HandleTable();
+
+        Handle allocate(uint32 size);
+        void free(Handle handle);
+
+        inline uint32 offset(Handle handle) const { return m_entries[handle].offset; }
+        inline const Entry& resolve(Handle handle) const { return m_entries[handle]; }
+
+        // Point the handle at a new allocation (same size, data already copied by the caller). Frees the old allocation.
+        void relocate(Handle handle, Allocation newAllocation);
+
+        // Renumber allocator nodes into a dense prefix (see Allocator::compactMetadata). Handles stay valid.
+        bool compactMetadata(uint32 newMaxAllocs);
+
+        // Relocation targets come from the table's allocator. A target not passed to relocate goes back via releaseTarget.
+        Allocation allocateTarget(uint32 size) { return m_allocator.allocate(size); }
+        void releaseTarget(Allocation target) { m_allocator.free(target); }
+
+        // Read only: Entries hold node indices, renumbering nodes behind the table's back would leave them stale
+        const Allocator& allocator() const { return m_allocator; }
+
+    private:
+        Allocator m_allocator;
+        uint32 m_maxAllocs;
+
+        // Entries are dense. Freed handle IDs are recycled LIFO, like allocator nodes.
+        Entry* m_entries;
+        Handle* m_freeHandles;
+        uint32 m_freeCount;
+    };
+}
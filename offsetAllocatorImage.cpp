@@ -0,0 +1,105 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorImage.hpp"
+
+#include <vector>
+
+namespace OffsetAllocator
+{
+    static constexpr uint32 USED_COLOR = 0x3060c0;
+    static constexpr uint32 FREE_COLOR = 0xe0e0e0;
+    static constexpr uint32 LEGEND_REGIONS = 8;
+
+    struct ImageBuilder
+    {
+        uint64 elementsPerPixel;
+        uint64 pixelCount;
+        std::vector<double> rgb; // Weighted sums
+        RegionColorFunc colorFunc;
+        void* userData;
+        Region largestFree[LEGEND_REGIONS]; // Sorted by size, descending
+        uint32 largestFreeCount = 0;
+
+        void addLargestFree(const Region& region)
+        {
+            // Insertion into a small sorted array
+            if (largestFreeCount == LEGEND_REGIONS && largestFree[LEGEND_REGIONS - 1].size >= region.size) return;
+            uint32 i = largestFreeCount < LEGEND_REGIONS ? largestFreeCount++ : LEGEND_REGIONS - 1;
+            for (; i > 0 && largestFree[i - 1].size < region.size; i--) largestFree[i] = largestFree[i - 1];
+            largestFree[i] = region;
+        }
+
+        void add(const Region& region)
+        {
+            if (!region.used) addLargestFree(region);
+            if (region.size == 0) return;
+
+            uint32 color = region.used ? (colorFunc ? colorFunc(userData, region) : USED_COLOR) : FREE_COLOR;
+            double r = (color >> 16) & 0xff, g = (color >> 8) & 0xff, b = color & 0xff;
+
+            // Spread the region over the pixels it covers, weighted by covered elements
+            uint64 begin = region.offset;
+            uint64 end = begin + region.size;
+            for (uint64 pixel = begin / elementsPerPixel; pixel < pixelCount && pixel * elementsPerPixel < end; pixel++)
+            {
+                uint64 pixelBegin = pixel * elementsPerPixel;
+                uint64 pixelEnd = pixelBegin + elementsPerPixel;
+                double weight = (double)((end < pixelEnd ? end : pixelEnd) - (begin > pixelBegin ? begin : pixelBegin));
+                rgb[pixel * 3 + 0] += r * weight;
+                rgb[pixel * 3 + 1] += g * weight;
+                rgb[pixel * 3 + 2] += b * weight;
+            }
+        }
+    };
+
+    bool writeOccupancyImage(const Allocator& allocator, FILE* file, uint32 width, uint32 height,
+                             RegionColorFunc colorFunc, void* userData)
+    {
+        // 64 bit product: width * height overflows uint32
+        uint64 pixelCount = (uint64)width * height;
+        if (pixelCount == 0 || pixelCount > MAX_OCCUPANCY_IMAGE_PIXELS) return false;
+
+        ImageBuilder builder;
+        builder.pixelCount = pixelCount;
+        builder.elementsPerPixel = ((uint64)allocator.size() + builder.pixelCount - 1) / builder.pixelCount;
+        if (builder.elementsPerPixel == 0) builder.elementsPerPixel = 1;
+        builder.rgb.assign((size_t)builder.pixelCount * 3, 0.0);
+        builder.colorFunc = colorFunc;
+        builder.userData = userData;
+
+        allocator.visitRegions([](void* builder, const Region& region) { ((ImageBuilder*)builder)->add(region); }, &builder);
+
+        // Header with legend comments
+        StorageReport report = allocator.storageReport();
+        fprintf(file, "P6\n");
+        fprintf(file, "# OffsetAllocator occupancy: size=%u free=%u elementsPerPixel=%llu\n",
+                allocator.size(), report.totalFreeSpace, builder.elementsPerPixel);
+        fprintf(file, "# Colors: used=#%06x free=#%06x (pixels past the end are black)\n", USED_COLOR, FREE_COLOR);
+        for (uint32 i = 0; i < builder.largestFreeCount; i++)
+        {
+            const Region& region = builder.largestFree[i];
+            fprintf(file, "# Largest free #%u: offset=%u size=%u row=%llu\n", i, region.offset, region.size,
+                    (uint64)region.offset / builder.elementsPerPixel / width);
+        }
+        fprintf(file, "%u %u\n255\n", width, height);
+
+        // Pixels: Average color of the covered elements
+        std::vector<uint8> row((size_t)width * 3);
+        for (uint32 y = 0; y < height; y++)
+        {
+            for (uint32 x = 0; x < width; x++)
+            {
+                uint64 pixel = (uint64)y * width + x;
+                uint64 pixelBegin = pixel * builder.elementsPerPixel;
+                uint64 pixelEnd = pixelBegin + builder.elementsPerPixel;
+                if (pixelEnd > allocator.size()) pixelEnd = allocator.size();
+                double covered = pixelEnd > pixelBegin ? (double)(pixelEnd - pixelBegin) : 0.0;
+                for (uint32 c = 0; c < 3; c++)
+                    row[x * 3 + c] = covered > 0.0 ? (uint8)(builder.rgb[pixel * 3 + c] / covered + 0.5) : 0;
+            }
+            if (fwrite(row.data(), row.size(), 1, file) != 1) return false;
+        }
+        return fflush(file) == 0;
+    }
+}
@@ -0,0 +1,23 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <stdio.h>
+
+namespace OffsetAllocator
+{
+    // Returns 0xRRGGBB for a region. Lets callers color used regions by tag.
+    typedef uint32 (*RegionColorFunc)(void* userData, const Region& region);
+
+    // Writes the offset space as a binary PPM (P6) image. Pixels run left to right, top to bottom.
+    // Each pixel covers a fixed element range. Pixels are the byte weighted blend of the regions they cover:
+    // Used = blue (or colorFunc), free = light gray. Header comments list the largest free regions (legend).
+    // Fails for width * height above MAX_OCCUPANCY_IMAGE_PIXELS (8192x8192): The builder keeps 24 bytes per pixel.
+    static constexpr uint64 MAX_OCCUPANCY_IMAGE_PIXELS = 8192ull * 8192;
+
+    bool writeOccupancyImage(const Allocator& allocator, FILE* file, uint32 width, uint32 height,
+                             RegionColorFunc colorFunc = nullptr, void* userData = nullptr);
+}
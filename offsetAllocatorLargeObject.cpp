@@ -0,0 +1,126 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorLargeObject.hpp"
+
+#include <algorithm>
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+namespace OffsetAllocator
+{
+    LargeObjectAllocator::LargeObjectAllocator(uint32 smallSize, uint32 largeSize, uint32 threshold, uint32 pageSize,
+                                               uint32 maxAllocs) :
+        m_small(smallSize, maxAllocs),
+        m_largeBase(smallSize),
+        m_threshold(threshold),
+        m_pageSize(pageSize ? pageSize : 1),
+        m_pageCount(largeSize / m_pageSize),
+        m_freePages(m_pageCount),
+        m_runPages(m_pageCount, 0)
+    {
+        ASSERT((uint64)smallSize + (uint64)m_pageCount * m_pageSize <= 0xffffffffull);
+        if (m_pageCount) m_freeSpans.push_back({.firstPage = 0, .pageCount = m_pageCount});
+    }
+
+    Allocation LargeObjectAllocator::allocate(uint32 size)
+    {
+        if (size < m_threshold) return m_small.allocate(size);
+
+        // First fit: Lowest offset span keeps the top of the region free for the next huge block
+        uint32 pages = (uint32)(((uint64)size + m_pageSize - 1) / m_pageSize);
+        if (pages > MAX_RUN_PAGES) return {};
+        for (uint32 i = 0; i < m_freeSpans.size(); i++)
+        {
+            Span& span = m_freeSpans[i];
+            if (span.pageCount < pages) continue;
+
+            uint32 firstPage = span.firstPage;
+            span.firstPage += pages;
+            span.pageCount -= pages;
+            if (span.pageCount == 0) m_freeSpans.erase(m_freeSpans.begin() + i);
+            m_freePages -= pages;
+            m_runPages[firstPage] = pages;
+            return {.offset = m_largeBase + firstPage * m_pageSize, .metadata = (NodeIndex)pages};
+        }
+        return {};
+    }
+
+    bool LargeObjectAllocator::free(Allocation allocation)
+    {
+        ASSERT(allocation.offset != Allocation::NO_SPACE);
+        if (!isLarge(allocation))
+        {
+            m_small.free(allocation);
+            return true;
+        }
+
+        // Must be the first page of a live run of the same length
+        uint32 largeOffset = allocation.offset - m_largeBase;
+        uint32 firstPage = largeOffset / m_pageSize;
+        if (largeOffset % m_pageSize != 0 || firstPage >= m_pageCount) return false;
+        uint32 pages = m_runPages[firstPage];
+        if (pages == 0 || pages != allocation.metadata) return false;
+        m_runPages[firstPage] = 0;
+        m_freePages += pages;
+
+        // Insert sorted, merge with the previous and next span when contiguous
+        auto next = std::lower_bound(m_freeSpans.begin(), m_freeSpans.end(), firstPage,
+                                     [](const Span& span, uint32 page) { return span.firstPage < page; });
+        ASSERT(next == m_freeSpans.end() || next->firstPage >= firstPage + pages);
+        bool mergePrev = next != m_freeSpans.begin() && (next - 1)->firstPage + (next - 1)->pageCount == firstPage;
+        bool mergeNext = next != m_freeSpans.end() && next->firstPage == firstPage + pages;
+        if (mergePrev && mergeNext)
+        {
+            (next - 1)->pageCount += pages + next->pageCount;
+            m_freeSpans.erase(next);
+        }
+        else if (mergePrev)
+        {
+            (next - 1)->pageCount += pages;
+        }
+        else if (mergeNext)
+        {
+            next->firstPage = firstPage;
+            next->pageCount += pages;
+        }
+        else
+        {
+            m_freeSpans.insert(next, {.firstPage = firstPage, .pageCount = pages});
+        }
+        return true;
+    }
+
+    uint32 LargeObjectAllocator::allocationSize(Allocation allocation) const
+    {
+        if (allocation.offset == Allocation::NO_SPACE) return 0;
+        if (!isLarge(allocation)) return m_small.allocationSize(allocation);
+        uint32 firstPage = (allocation.offset - m_largeBase) / m_pageSize;
+        return firstPage < m_pageCount ? m_runPages[firstPage] * m_pageSize : 0;
+    }
+
+    StorageReport LargeObjectAllocator::largeStorageReport() const
+    {
+        uint32 largestPages = 0;
+        for (const Span& span : m_freeSpans)
+        {
+            if (span.pageCount > largestPages) largestPages = span.pageCount;
+        }
+        return {.totalFreeSpace = m_freePages * m_pageSize, .largestFreeRegion = largestPages * m_pageSize};
+    }
+
+    StorageReport LargeObjectAllocator::storageReport() const
+    {
+        StorageReport small = m_small.storageReport();
+        StorageReport large = largeStorageReport();
+        return {
+            .totalFreeSpace = small.totalFreeSpace + large.totalFreeSpace,
+            .largestFreeRegion = small.largestFreeRegion > large.largestFreeRegion ? small.largestFreeRegion : large.largestFreeRegion,
+        };
+    }
+}
@@ -0,0 +1,65 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Two tier offset space: [0, smallSize) is a regular Allocator, [smallSize, smallSize + largeSize) is a page
+    // granular large object region. Requests of at least threshold elements go to the large region, so huge blocks
+    // never split (or get merged into) the small object bins. The tiers don't spill into each other.
+    // Same Allocation handles: offset >= smallSize identifies a large object, its metadata is the page count.
+    // Runs longer than MAX_RUN_PAGES don't fit the metadata (16 bit node indices) and are rejected.
+    // Large region free spans are kept in an offset sorted list: First fit, neighbor merge on free. O(free spans).
+    // A per page table holds the length of each live run at its first page: Large frees are checked against it.
+    class LargeObjectAllocator
+    {
+    public:
+        // Largest page count the metadata holds. All ones is left unused.
+        static constexpr uint32 MAX_RUN_PAGES = (uint32)(NodeIndex)~(NodeIndex)0 - 1;
+
+        // pageSize in elements. largeSize is rounded down to whole pages.
+        LargeObjectAllocator(uint32 smallSize, uint32 largeSize, uint32 threshold, uint32 pageSize = 64 * 1024,
+                             uint32 maxAllocs = 128 * 1024);
+
+        Allocation allocate(uint32 size);
+
+        // Returns false (no change) for a large handle that isn't the start of a live run with the same page count:
+        // Double free, stale or corrupted handle.
+        bool free(Allocation allocation);
+
+        // Large objects report their page rounded size
+        uint32 allocationSize(Allocation allocation) const;
+        bool isLarge(Allocation allocation) const { return allocation.offset != Allocation::NO_SPACE && allocation.offset >= m_largeBase; }
+
+        // Both tiers. largestFreeRegion is the larger of the two tiers' largest regions.
+        StorageReport storageReport() const;
+        StorageReport largeStorageReport() const;
+
+        uint32 threshold() const { return m_threshold; }
+        uint32 pageSize() const { return m_pageSize; }
+        Allocator& smallAllocator() { return m_small; }
+        const Allocator& smallAllocator() const { return m_small; }
+
+    private:
+        struct Span
+        {
+            uint32 firstPage;
+            uint32 pageCount;
+        };
+
+        Allocator m_small;
+        uint32 m_largeBase;
+        uint32 m_threshold;
+        uint32 m_pageSize;
+        uint32 m_pageCount;
+        uint32 m_freePages;
+
+        std::vector<Span> m_freeSpans; // Sorted by firstPage, never adjacent (merged)
+        std::vector<uint32> m_runPages; // Per page: Live run length at its first page, 0 elsewhere
+    };
+}
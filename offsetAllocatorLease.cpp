@@ -0,0 +1,171 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorLease.hpp"
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+namespace OffsetAllocator
+{
+    static constexpr uint64 SLOT_MASK = LeaseAllocator::WHEEL_SLOTS - 1;
+
+    LeaseAllocator::LeaseAllocator(uint32 size, uint32 maxAllocs, uint64 now) :
+        m_allocator(size, maxAllocs),
+        m_now(now),
+        m_leaseCount(0),
+        m_leases(maxAllocs, Lease{.expiry = 0, .offset = 0, .prev = NO_LEASE, .next = NO_LEASE, .slot = NO_LEASE})
+    {
+        for (uint32& head : m_slotHeads) head = NO_LEASE;
+        for (uint64& occupied : m_occupied) occupied = 0;
+    }
+
+    Allocation LeaseAllocator::allocateLease(uint32 size, uint64 ttlTicks)
+    {
+        Allocation allocation = m_allocator.allocate(size);
+        if (allocation.offset == Allocation::NO_SPACE) return allocation;
+
+        Lease& lease = m_leases[allocation.metadata];
+        lease.expiry = m_now + (ttlTicks ? ttlTicks : 1);
+        lease.offset = allocation.offset;
+        insert(allocation.metadata);
+        m_leaseCount++;
+        return allocation;
+    }
+
+    bool LeaseAllocator::isLive(Allocation allocation) const
+    {
+        if (allocation.metadata >= m_leases.size()) return false;
+        const Lease& lease = m_leases[allocation.metadata];
+        return lease.slot != NO_LEASE && lease.offset == allocation.offset;
+    }
+
+    bool LeaseAllocator::renew(Allocation allocation, uint64 ttlTicks)
+    {
+        if (!isLive(allocation)) return false;
+        unlink(allocation.metadata);
+        m_leases[allocation.metadata].expiry = m_now + (ttlTicks ? ttlTicks : 1);
+        insert(allocation.metadata);
+        return true;
+    }
+
+    bool LeaseAllocator::free(Allocation allocation)
+    {
+        if (!isLive(allocation)) return false;
+        unlink(allocation.metadata);
+        m_leaseCount--;
+        m_allocator.free(allocation);
+        return true;
+    }
+
+    void LeaseAllocator::insert(uint32 nodeIndex)
+    {
+        // Lowest level whose range covers the remaining time. Slot from the absolute expiry bits: A level N slot
+        // is cascaded down when time reaches its start, which is never after the expiry.
+        Lease& lease = m_leases[nodeIndex];
+        uint64 delta = lease.expiry > m_now ? lease.expiry - m_now : 0;
+        uint32 level = 0;
+        while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_SLOT_BITS * (level + 1)))) level++;
+
+        // Due now (cascaded at its expiry tick): Current level 0 slot, expired right after the cascade
+        uint64 expiry = lease.expiry > m_now ? lease.expiry : m_now;
+        uint32 slotIndex = (uint32)((expiry >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+        uint32 slot = level * WHEEL_SLOTS + slotIndex;
+
+        lease.slot = slot;
+        lease.prev = NO_LEASE;
+        lease.next = m_slotHeads[slot];
+        if (lease.next != NO_LEASE) m_leases[lease.next].prev = nodeIndex;
+        m_slotHeads[slot] = nodeIndex;
+        m_occupied[level] |= 1ull << slotIndex;
+    }
+
+    void LeaseAllocator::unlink(uint32 nodeIndex)
+    {
+        Lease& lease = m_leases[nodeIndex];
+        if (lease.prev != NO_LEASE) m_leases[lease.prev].next = lease.next;
+        else m_slotHeads[lease.slot] = lease.next;
+        if (lease.next != NO_LEASE) m_leases[lease.next].prev = lease.prev;
+
+        if (m_slotHeads[lease.slot] == NO_LEASE)
+        {
+            m_occupied[lease.slot / WHEEL_SLOTS] &= ~(1ull << (lease.slot % WHEEL_SLOTS));
+        }
+        lease.slot = NO_LEASE;
+    }
+
+    void LeaseAllocator::cascade(uint32 level)
+    {
+        // Re-insert the slot's leases relative to the new time. They land on lower levels (or level 0).
+        uint32 slot = level * WHEEL_SLOTS + (uint32)((m_now >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+        uint32 nodeIndex = m_slotHeads[slot];
+        m_slotHeads[slot] = NO_LEASE;
+        m_occupied[level] &= ~(1ull << (slot % WHEEL_SLOTS));
+        while (nodeIndex != NO_LEASE)
+        {
+            uint32 next = m_leases[nodeIndex].next;
+            insert(nodeIndex);
+            nodeIndex = next;
+        }
+    }
+
+    uint32 LeaseAllocator::expireSlot(uint32 slot)
+    {
+        uint32 expiredCount = 0;
+        uint32 nodeIndex = m_slotHeads[slot];
+        m_slotHeads[slot] = NO_LEASE;
+        m_occupied[0] &= ~(1ull << slot);
+        while (nodeIndex != NO_LEASE)
+        {
+            Lease& lease = m_leases[nodeIndex];
+            ASSERT(lease.expiry <= m_now);
+            m_expired.push_back({.offset = lease.offset, .metadata = (NodeIndex)nodeIndex});
+            lease.slot = NO_LEASE;
+            nodeIndex = lease.next;
+            expiredCount++;
+        }
+        return expiredCount;
+    }
+
+    uint32 LeaseAllocator::tick(uint64 now)
+    {
+        m_expired.clear();
+        while (m_now < now)
+        {
+            if (m_leaseCount == 0)
+            {
+                m_now = now;
+                break;
+            }
+
+            // Nothing due on level 0: Skip to the end of the level 0 revolution (next cascade point)
+            if (m_occupied[0] == 0)
+            {
+                uint64 revolutionEnd = m_now | SLOT_MASK;
+                if (revolutionEnd >= now)
+                {
+                    m_now = now;
+                    break;
+                }
+                m_now = revolutionEnd;
+            }
+
+            // Level N's current slot starts now when the lower levels wrap around. Cascade top down.
+            m_now++;
+            uint32 cascadeLevels = 0;
+            while (cascadeLevels + 1 < WHEEL_LEVELS && (m_now & ((1ull << (WHEEL_SLOT_BITS * (cascadeLevels + 1))) - 1)) == 0) cascadeLevels++;
+            for (uint32 level = cascadeLevels; level > 0; level--) cascade(level);
+
+            m_leaseCount -= expireSlot((uint32)(m_now & SLOT_MASK));
+        }
+
+        // Batch free: Adjacent expired leases merge with one bin insert per run
+        uint32 expiredCount = (uint32)m_expired.size();
+        if (expiredCount) m_allocator.free(m_expired.data(), expiredCount);
+        return expiredCount;
+    }
+}
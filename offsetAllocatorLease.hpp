@@ -0,0 +1,75 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Allocations with a time to live. Leases sit in a hierarchical timer wheel (4 levels of 64 slots) keyed by
+    // expiry tick: Insert, renew and early free are O(1) list operations. tick(now) advances the wheel and frees
+    // every expired lease with one batch free (runs of adjacent expired leases merge with a single bin insert).
+    // Ticks are caller defined (frames, milliseconds...). Same Allocation handles as Allocator.
+    class LeaseAllocator
+    {
+    public:
+        static constexpr uint32 WHEEL_LEVELS = 4;
+        static constexpr uint32 WHEEL_SLOT_BITS = 6;
+        static constexpr uint32 WHEEL_SLOTS = 1 << WHEEL_SLOT_BITS;
+
+        LeaseAllocator(uint32 size, uint32 maxAllocs = 128 * 1024, uint64 now = 0);
+
+        // Lease expires at now + ttlTicks (at least one tick)
+        Allocation allocateLease(uint32 size, uint64 ttlTicks);
+
+        // Extends the lease to expire at now + ttlTicks. Returns false (no change) if the lease is gone:
+        // Expired, freed or the node now holds a lease at another offset.
+        // NOTE: A node reused by a new lease at the same offset can't be told apart from the old lease.
+        bool renew(Allocation allocation, uint64 ttlTicks);
+
+        // Early release of a live lease. Returns false (no change) if the lease is gone (see renew).
+        bool free(Allocation allocation);
+
+        // Advances time and frees the expired leases. Returns the number of expired leases.
+        // Time moves forward only. Empty wheel slots are skipped 64 ticks at a time.
+        uint32 tick(uint64 now);
+
+        // Leases expired by the last tick()
+        const std::vector<Allocation>& expired() const { return m_expired; }
+
+        uint64 now() const { return m_now; }
+        uint32 leaseCount() const { return m_leaseCount; }
+        Allocator& allocator() { return m_allocator; }
+        const Allocator& allocator() const { return m_allocator; }
+
+    private:
+        static constexpr uint32 NO_LEASE = 0xffffffff;
+
+        // Indexed by node index (Allocation::metadata)
+        struct Lease
+        {
+            uint64 expiry;
+            uint32 offset;
+            uint32 prev;
+            uint32 next;
+            uint32 slot;    // level * WHEEL_SLOTS + slot, NO_LEASE = not leased
+        };
+
+        bool isLive(Allocation allocation) const;
+        void insert(uint32 nodeIndex);
+        void unlink(uint32 nodeIndex);
+        void cascade(uint32 level);
+        uint32 expireSlot(uint32 slot);
+
+        Allocator m_allocator;
+        uint64 m_now;
+        uint32 m_leaseCount;
+        std::vector<Lease> m_leases;
+        uint32 m_slotHeads[WHEEL_LEVELS * WHEEL_SLOTS];
+        uint64 m_occupied[WHEEL_LEVELS];    // Non empty slot bits per level
+        std::vector<Allocation> m_expired;
+    };
+}
@@ -0,0 +1,102 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorLifetime.hpp"
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+namespace OffsetAllocator
+{
+    inline uint32 predictionKey(uint32 size, uint32 siteId)
+    {
+        return (siteId << 8) | SmallFloat::uintToFloatRoundUp(size);
+    }
+
+    LifetimeAllocator::LifetimeAllocator(uint32 size, uint32 maxAllocs, uint32 shortLifetime, uint32 predictorSize) :
+        m_allocator(size, maxAllocs),
+        m_shortLifetime(shortLifetime),
+        m_clock(0),
+        m_live(new LiveAllocation[maxAllocs])
+    {
+        // Round up to pow2
+        uint32 slots = 1;
+        while (slots < predictorSize) slots <<= 1;
+        m_predictorMask = slots - 1;
+        m_predictions = new Prediction[slots];
+    }
+
+    LifetimeAllocator::LifetimeAllocator(LifetimeAllocator &&other) :
+        m_allocator(static_cast<Allocator&&>(other.m_allocator)),
+        m_shortLifetime(other.m_shortLifetime),
+        m_predictorMask(other.m_predictorMask),
+        m_clock(other.m_clock),
+        m_predictions(other.m_predictions),
+        m_live(other.m_live)
+    {
+        other.m_predictions = nullptr;
+        other.m_live = nullptr;
+    }
+
+    LifetimeAllocator::~LifetimeAllocator()
+    {
+        delete[] m_predictions;
+        delete[] m_live;
+    }
+
+    uint32 LifetimeAllocator::predictorSlot(uint32 key) const
+    {
+        // Fibonacci hash: Site IDs live in the high bits
+        return (uint32)((key * 0x9E3779B97F4A7C15ull) >> 32) & m_predictorMask;
+    }
+
+    Allocation LifetimeAllocator::allocate(uint32 size, uint32 siteId)
+    {
+        m_clock++;
+        uint32 key = predictionKey(size, siteId);
+        uint32 slot = predictorSlot(key);
+
+        const Prediction& prediction = m_predictions[slot];
+        bool shortLived = prediction.key == key && prediction.lifetime < m_shortLifetime;
+
+        Allocation allocation = m_allocator.allocate(size, shortLived ? PLACE_HIGH : PLACE_LOW);
+        if (allocation.offset != Allocation::NO_SPACE)
+        {
+            m_live[allocation.metadata] = {.time = m_clock, .slot = slot, .key = key};
+        }
+        return allocation;
+    }
+
+    void LifetimeAllocator::free(Allocation allocation)
+    {
+        ASSERT(allocation.metadata != Allocation::NO_SPACE);
+        m_clock++;
+
+        const LiveAllocation& live = m_live[allocation.metadata];
+        uint64 elapsed = m_clock - live.time;
+        uint32 lifetime = elapsed < Allocation::NO_SPACE ? (uint32)elapsed : Allocation::NO_SPACE - 1;
+
+        Prediction& prediction = m_predictions[live.slot];
+        if (prediction.key != live.key)
+        {
+            prediction = {.key = live.key, .lifetime = lifetime};
+        }
+        else
+        {
+            prediction.lifetime = (uint32)(((uint64)prediction.lifetime * 7 + lifetime) >> 3);
+        }
+
+        m_allocator.free(allocation);
+    }
+
+    uint32 LifetimeAllocator::predictedLifetime(uint32 size, uint32 siteId) const
+    {
+        uint32 key = predictionKey(size, siteId);
+        const Prediction& prediction = m_predictions[predictorSlot(key)];
+        return prediction.key == key ? prediction.lifetime : Allocation::NO_SPACE;
+    }
+}
@@ -0,0 +1,56 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+namespace OffsetAllocator
+{
+    // Lifetime aware placement on top of Allocator. A predictor keyed by (size class, site ID) learns the observed
+    // alloc->free durations. Allocations predicted short lived are carved from the high end of the chosen free node,
+    // the rest (including unknown) from the low end. Short lived blocks no longer punch holes between long lived ones.
+    // Lifetimes are measured in allocator operations (allocate + free calls), not wall clock.
+    class LifetimeAllocator
+    {
+    public:
+        LifetimeAllocator(uint32 size, uint32 maxAllocs = 128 * 1024, uint32 shortLifetime = 4096, uint32 predictorSize = 4096);
+        LifetimeAllocator(LifetimeAllocator &&other);
+        ~LifetimeAllocator();
+
+        // siteId: Optional caller supplied allocation site (e.g. hash of the call site, low 24 bits used). 0 = size class only.
+        Allocation allocate(uint32 size, uint32 siteId = 0);
+        void free(Allocation allocation);
+
+        // Predicted lifetime in allocator operations. NO_SPACE = no samples yet.
+        uint32 predictedLifetime(uint32 size, uint32 siteId = 0) const;
+
+        // Read only: Live records are indexed by node index, renumbering nodes directly would leave them stale
+        const Allocator& allocator() const { return m_allocator; }
+
+    private:
+        struct Prediction
+        {
+            uint32 key = Allocation::NO_SPACE;
+            uint32 lifetime = 0;                // Running average (1/8 weight per sample)
+        };
+
+        struct LiveAllocation
+        {
+            uint64 time;
+            uint32 slot;
+            uint32 key;
+        };
+
+        uint32 predictorSlot(uint32 key) const;
+
+        Allocator m_allocator;
+        uint32 m_shortLifetime;
+        uint32 m_predictorMask;
+        uint64 m_clock;
+
+        // Direct mapped. A colliding key evicts the old prediction.
+        Prediction* m_predictions;
+        LiveAllocation* m_live;             // Indexed by allocation metadata (node index)
+    };
+}
@@ -0,0 +1,225 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorMaintenance.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace OffsetAllocator
+{
+    MaintenanceService::MaintenanceService(Allocator& allocator, uint32 tickBudgetMicroseconds, uint32 nodesPerStep) :
+        m_allocator(allocator),
+        m_tickBudgetMicroseconds(tickBudgetMicroseconds),
+        m_nodesPerStep(nodesPerStep ? nodesPerStep : 1),
+        m_validationCursor(0),
+        m_planRequested(false),
+        m_planReady(false),
+        m_planCursor(0),
+        m_planHash(0),
+        m_state(OWNER)
+    {
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    MaintenanceService::~MaintenanceService()
+    {
+        // Worker stops after its current step
+        m_state.store(SHUTDOWN, std::memory_order_release);
+        m_state.notify_one();
+        m_thread.join();
+    }
+
+    bool MaintenanceService::beginTick()
+    {
+        uint32 expected = OWNER;
+        if (!m_state.compare_exchange_strong(expected, WORKER, std::memory_order_acq_rel)) return false;
+        m_state.notify_one();
+        return true;
+    }
+
+    bool MaintenanceService::tryEndTick()
+    {
+        uint32 expected = WORKER;
+        m_state.compare_exchange_strong(expected, RELEASE_REQUESTED, std::memory_order_acq_rel);
+        return m_state.load(std::memory_order_acquire) == OWNER;
+    }
+
+    void MaintenanceService::requestCompactionPlan()
+    {
+        m_planRequested = true;
+        m_planReady = false;
+        m_planCursor = 0;
+    }
+
+    bool MaintenanceService::takeCompactionPlan(CompactionPlan& plan)
+    {
+        if (!m_planReady) return false;
+        m_planReady = false;
+
+        // Allocator changed after the plan was made: Plan again
+        if (m_plan.stateHash != m_allocator.stateHash())
+        {
+            requestCompactionPlan();
+            return false;
+        }
+
+        plan = std::move(m_plan);
+        m_plan = {};
+        return true;
+    }
+
+    MaintenanceTelemetry MaintenanceService::telemetry() const
+    {
+        std::lock_guard<std::mutex> lock(m_telemetryMutex);
+        return m_telemetry;
+    }
+
+    void MaintenanceService::run()
+    {
+        for (;;)
+        {
+            m_state.wait(OWNER, std::memory_order_acquire);
+            uint32 state = m_state.load(std::memory_order_acquire);
+            if (state == SHUTDOWN) return;
+            if (state != OWNER) tick();
+        }
+    }
+
+    void MaintenanceService::tick()
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto budget = std::chrono::microseconds(m_tickBudgetMicroseconds);
+
+        MaintenanceTelemetry telemetry;
+        {
+            std::lock_guard<std::mutex> lock(m_telemetryMutex);
+            telemetry = m_telemetry;
+        }
+
+        // Telemetry sample: O(1)
+        StorageReport report = m_allocator.storageReport();
+        telemetry.ticks++;
+        telemetry.stateHash = m_allocator.stateHash();
+        telemetry.totalFreeSpace = report.totalFreeSpace;
+        telemetry.largestFreeRegion = report.largestFreeRegion;
+
+        // Compaction planning first, validation gets the rest of the budget. Owner changed the allocator since the
+        // last tick? The regions scanned so far are stale.
+        bool budgetLeft = true;
+        if (m_planRequested)
+        {
+            if (m_planCursor != 0 && m_allocator.stateHash() != m_planHash)
+            {
+                m_planCursor = 0;
+                telemetry.compactionPlanRestarts++;
+            }
+
+            // At least one step per tick: Planning progresses even when the owner asks for the allocator right away
+            while (!planStep(telemetry))
+            {
+                if (m_state.load(std::memory_order_acquire) != WORKER || std::chrono::steady_clock::now() - start >= budget)
+                {
+                    budgetLeft = false;
+                    break;
+                }
+            }
+        }
+
+        // Incremental validation: Node index ranges are stable across ticks, so the cursor survives owner modifications.
+        // At most one full pass per tick.
+        uint32 maxAllocs = m_allocator.maxAllocs();
+        for (uint32 validated = 0; budgetLeft && validated < maxAllocs; validated += m_nodesPerStep)
+        {
+            if (m_state.load(std::memory_order_acquire) != WORKER) break;
+
+            if (!m_allocator.validateNodes(m_validationCursor, m_nodesPerStep))
+            {
+                if (telemetry.validationErrors++ == 0) telemetry.firstCorruptNode = m_validationCursor;
+            }
+
+            m_validationCursor += m_nodesPerStep;
+            if (m_validationCursor >= maxAllocs)
+            {
+                m_validationCursor = 0;
+                telemetry.validationPasses++;
+            }
+
+            if (std::chrono::steady_clock::now() - start >= budget) break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_telemetryMutex);
+            m_telemetry = telemetry;
+        }
+
+        release();
+    }
+
+    bool MaintenanceService::planStep(MaintenanceTelemetry& telemetry)
+    {
+        // Plan start: The state hash detects owner changes between ticks
+        if (m_planCursor == 0)
+        {
+            if (!m_allocator.stateHashEnabled()) m_allocator.enableStateHash(true);
+            m_planHash = m_allocator.stateHash();
+            m_planRegions.clear();
+        }
+
+        m_allocator.visitNodeRange(m_planCursor, m_nodesPerStep, [](void* userData, const Region& region)
+        {
+            if (region.used) static_cast<std::vector<Region>*>(userData)->push_back(region);
+        }, &m_planRegions);
+
+        uint32 maxAllocs = m_allocator.maxAllocs();
+        m_planCursor = m_planCursor < maxAllocs && m_nodesPerStep < maxAllocs - m_planCursor ? m_planCursor + m_nodesPerStep : maxAllocs;
+        if (m_planCursor < maxAllocs) return false;
+
+        m_planCursor = 0;
+        if (!finishPlan())
+        {
+            telemetry.compactionPlanRestarts++;
+            return false;
+        }
+
+        telemetry.compactionPlans++;
+        m_planRequested = false;
+        m_planReady = true;
+        return true;
+    }
+
+    bool MaintenanceService::finishPlan()
+    {
+        // Scanned by node index across ticks: The regions must hash to the allocator state. Catches nodes renumbered
+        // by compactMetadata in between (a region missed or seen twice).
+        uint64 hash = 0;
+        for (const Region& region : m_planRegions) hash += FeatureHooks::hashRegion(region.offset, region.size);
+        if (hash != m_planHash) return false;
+
+        // Sliding compaction: Each allocation moves down to the end of the previous one
+        std::sort(m_planRegions.begin(), m_planRegions.end(), [](const Region& a, const Region& b) { return a.offset < b.offset; });
+        m_plan.moves.clear();
+        m_plan.layout.clear();
+        m_plan.oldOffsets.clear();
+        m_plan.stateHash = m_planHash;
+
+        uint32 offset = 0;
+        for (const Region& region : m_planRegions)
+        {
+            if (region.offset != offset) m_plan.moves.push_back({.srcOffset = region.offset, .dstOffset = offset, .size = region.size});
+            m_plan.layout.push_back({.offset = offset, .size = region.size});
+            m_plan.oldOffsets.push_back(region.offset);
+            offset += region.size;
+        }
+        return true;
+    }
+
+    bool MaintenanceService::release()
+    {
+        // WORKER or RELEASE_REQUESTED -> OWNER. SHUTDOWN stays.
+        uint32 expected = WORKER;
+        if (m_state.compare_exchange_strong(expected, OWNER, std::memory_order_acq_rel)) return true;
+        expected = RELEASE_REQUESTED;
+        return m_state.compare_exchange_strong(expected, OWNER, std::memory_order_acq_rel);
+    }
+}
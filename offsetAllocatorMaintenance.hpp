@@ -0,0 +1,102 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+#include "offsetAllocatorMover.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace OffsetAllocator
+{
+    struct MaintenanceTelemetry
+    {
+        uint64 ticks = 0;
+        uint64 stateHash = 0;
+        uint32 totalFreeSpace = 0;
+        uint32 largestFreeRegion = 0;
+        uint32 validationPasses = 0;            // Completed full passes over the node array
+        uint32 validationErrors = 0;
+        uint32 firstCorruptNode = Allocation::NO_SPACE; // First node of the first failing validation step
+        uint32 compactionPlans = 0;             // Completed plans
+        uint32 compactionPlanRestarts = 0;      // Plans started over: Owner changed the allocator between ticks
+    };
+
+    // Sliding compaction of the live allocations to the start of the offset space, planned for one allocator state.
+    // Apply: Execute the moves (ParallelMover, or memmove in list order), then bulk load a new allocator from the layout
+    // (see Allocator bulk load constructor). Allocation i of the layout is the allocation that was at oldOffsets[i].
+    struct CompactionPlan
+    {
+        std::vector<Move> moves;                // Moved allocations only, ascending offsets
+        std::vector<AllocationRange> layout;    // All live allocations after the moves, offset order
+        std::vector<uint32> oldOffsets;         // Offset before the moves, per layout entry
+        uint64 stateHash = 0;                   // Allocator state (stateHash) the plan was made for
+    };
+
+    // Background thread that runs allocator maintenance (telemetry sampling, compaction planning, incremental
+    // validation) while the owner has lent the allocator to it. The allocator is not thread safe: The owner must not
+    // touch it between a successful beginTick() and a tryEndTick() that returns true.
+    // Owner calls never wait. The worker checks for release requests after each step (nodesPerStep nodes).
+    // Coalescing is not deferred work here: free() merges neighbors eagerly in O(1).
+    class MaintenanceService
+    {
+    public:
+        MaintenanceService(Allocator& allocator, uint32 tickBudgetMicroseconds = 200, uint32 nodesPerStep = 1024);
+        ~MaintenanceService();
+
+        // Owner: Lend the allocator to the worker. Returns false if the previous tick hasn't been released yet.
+        bool beginTick();
+
+        // Owner: Ask the worker to release the allocator. Returns true when the owner has it back.
+        bool tryEndTick();
+
+        // Owner, while it holds the allocator: Plan a compaction in the next ticks. Planning scans nodesPerStep nodes
+        // per step and resumes across ticks while the allocator is unchanged. It uses the state hash to detect owner
+        // changes (the first planning tick enables it). Owner changes between ticks restart the plan.
+        void requestCompactionPlan();
+
+        // Owner, while it holds the allocator: Takes the finished plan. False if there is none, or the allocator
+        // changed since it was planned (a new plan is requested then).
+        bool takeCompactionPlan(CompactionPlan& plan);
+
+        // Any thread
+        MaintenanceTelemetry telemetry() const;
+
+    private:
+        enum State : uint32
+        {
+            OWNER = 0,
+            WORKER = 1,
+            RELEASE_REQUESTED = 2,
+            SHUTDOWN = 3,
+        };
+
+        void run();
+        void tick();
+        bool release();
+        bool planStep(MaintenanceTelemetry& telemetry);
+        bool finishPlan();
+
+        Allocator& m_allocator;
+        uint32 m_tickBudgetMicroseconds;
+        uint32 m_nodesPerStep;
+        uint32 m_validationCursor;
+
+        // Compaction planning. Worker owned while lent, owner owned otherwise (handoff through m_state).
+        bool m_planRequested;
+        bool m_planReady;
+        uint32 m_planCursor;
+        uint64 m_planHash;
+        std::vector<Region> m_planRegions;
+        CompactionPlan m_plan;
+
+        std::atomic<uint32> m_state;
+        mutable std::mutex m_telemetryMutex;
+        MaintenanceTelemetry m_telemetry;
+        std::thread m_thread;
+    };
+}
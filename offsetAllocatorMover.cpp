@@ -0,0 +1,222 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorMover.hpp"
+
+#include <cstring>
+#include <map>
+
+namespace OffsetAllocator
+{
+    inline uint64 packRange(uint32 lo, uint32 hi) { return ((uint64)hi << 32) | lo; }
+    inline uint32 rangeLo(uint64 range) { return (uint32)range; }
+    inline uint32 rangeHi(uint64 range) { return (uint32)(range >> 32); }
+
+    ParallelMover::ParallelMover(uint32 threadCount, uint32 chunkBytes) :
+        m_threadCount(threadCount ? threadCount : std::thread::hardware_concurrency()),
+        m_chunkBytes(chunkBytes ? chunkBytes : 1),
+        m_pendingTasks(0),
+        m_generation(0),
+        m_stop(false)
+    {
+        if (m_threadCount == 0) m_threadCount = 1;
+        m_ranges = std::vector<std::atomic<uint64>>(m_threadCount);
+        for (uint32 i = 1; i < m_threadCount; i++)
+            m_workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    ParallelMover::~ParallelMover()
+    {
+        m_stop.store(true, std::memory_order_release);
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+        m_generation.notify_all();
+        for (std::thread& worker : m_workers) worker.join();
+    }
+
+    void ParallelMover::execute(void* base, uint32 elementSize, const Move* moves, uint32 moveCount)
+    {
+        uint8* bytes = (uint8*)base;
+
+        // Dependency levels: A move must run after every earlier move whose source or destination it overlaps.
+        // level = 1 + max(level of overlapping earlier moves). Moves of the same level never overlap each other.
+        // Touched byte ranges are kept as disjoint segments: start -> {end, level}.
+        struct Segment
+        {
+            uint64 end;
+            uint32 level;
+        };
+        std::map<uint64, Segment> segments;
+
+        auto split = [&segments](uint64 at)
+        {
+            auto it = segments.upper_bound(at);
+            if (it == segments.begin()) return;
+            --it;
+            if (it->first < at && it->second.end > at)
+            {
+                segments[at] = it->second;
+                it->second.end = at;
+            }
+        };
+        auto maxLevel = [&segments](uint64 start, uint64 end, uint32 level)
+        {
+            auto it = segments.upper_bound(start);
+            if (it != segments.begin()) --it;
+            for (; it != segments.end() && it->first < end; ++it)
+            {
+                if (it->second.end > start && it->second.level + 1 > level) level = it->second.level + 1;
+            }
+            return level;
+        };
+        auto assign = [&segments, &split](uint64 start, uint64 end, uint32 level)
+        {
+            split(start);
+            split(end);
+            segments.erase(segments.lower_bound(start), segments.lower_bound(end));
+            segments[start] = {.end = end, .level = level};
+        };
+
+        std::vector<uint32> levels(moveCount);
+        uint32 levelCount = 0;
+        for (uint32 i = 0; i < moveCount; i++)
+        {
+            uint64 src = (uint64)moves[i].srcOffset * elementSize;
+            uint64 dst = (uint64)moves[i].dstOffset * elementSize;
+            uint64 size = (uint64)moves[i].size * elementSize;
+            if (size == 0 || src == dst)
+            {
+                levels[i] = Allocation::NO_SPACE;
+                continue;
+            }
+
+            uint32 level = maxLevel(dst, dst + size, maxLevel(src, src + size, 0));
+            if (src < dst + size && dst < src + size)
+            {
+                assign(src < dst ? src : dst, (src < dst ? dst : src) + size, level);
+            }
+            else
+            {
+                assign(src, src + size, level);
+                assign(dst, dst + size, level);
+            }
+            levels[i] = level;
+            if (level + 1 > levelCount) levelCount = level + 1;
+        }
+
+        // Bucket moves by level (counting sort)
+        std::vector<uint32> levelStart(levelCount + 1, 0);
+        for (uint32 i = 0; i < moveCount; i++)
+            if (levels[i] != Allocation::NO_SPACE) levelStart[levels[i] + 1]++;
+        for (uint32 level = 0; level < levelCount; level++)
+            levelStart[level + 1] += levelStart[level];
+        std::vector<uint32> order(levelStart[levelCount]);
+        {
+            std::vector<uint32> cursor(levelStart.begin(), levelStart.end() - 1);
+            for (uint32 i = 0; i < moveCount; i++)
+                if (levels[i] != Allocation::NO_SPACE) order[cursor[levels[i]]++] = i;
+        }
+
+        for (uint32 level = 0; level < levelCount; level++)
+        {
+            m_tasks.clear();
+            for (uint32 k = levelStart[level]; k < levelStart[level + 1]; k++)
+            {
+                const Move& move = moves[order[k]];
+                uint64 src = (uint64)move.srcOffset * elementSize;
+                uint64 dst = (uint64)move.dstOffset * elementSize;
+                uint64 size = (uint64)move.size * elementSize;
+                if (src < dst + size && dst < src + size)
+                {
+                    // Overlaps itself: Chunk order would matter. Single task.
+                    m_tasks.push_back({.dst = bytes + dst, .src = bytes + src, .bytes = size});
+                    continue;
+                }
+                for (uint64 chunk = 0; chunk < size; chunk += m_chunkBytes)
+                {
+                    uint64 chunkBytes = size - chunk < m_chunkBytes ? size - chunk : m_chunkBytes;
+                    m_tasks.push_back({.dst = bytes + dst + chunk, .src = bytes + src + chunk, .bytes = chunkBytes});
+                }
+            }
+
+            // Single task: Not worth waking the workers
+            uint32 taskCount = (uint32)m_tasks.size();
+            if (taskCount == 1 || m_threadCount == 1)
+            {
+                for (const Task& task : m_tasks) memmove(task.dst, task.src, task.bytes);
+                continue;
+            }
+
+            // Pending count first: A worker still scanning for work from the previous level may claim a task
+            // as soon as its range is published
+            m_pendingTasks.store(taskCount, std::memory_order_release);
+            for (uint32 w = 0; w < m_threadCount; w++)
+            {
+                uint32 lo = (uint32)((uint64)taskCount * w / m_threadCount);
+                uint32 hi = (uint32)((uint64)taskCount * (w + 1) / m_threadCount);
+                m_ranges[w].store(packRange(lo, hi), std::memory_order_release);
+            }
+            m_generation.fetch_add(1, std::memory_order_acq_rel);
+            m_generation.notify_all();
+
+            runPhase(0);
+            for (uint32 pending; (pending = m_pendingTasks.load(std::memory_order_acquire)) != 0; )
+                m_pendingTasks.wait(pending, std::memory_order_acquire);
+        }
+    }
+
+    void ParallelMover::workerLoop(uint32 workerIndex)
+    {
+        // Generation was 0 when the workers were spawned. A late starting worker must not skip past the first bumps.
+        uint32 generation = 0;
+        for (;;)
+        {
+            m_generation.wait(generation, std::memory_order_acquire);
+            generation = m_generation.load(std::memory_order_acquire);
+            if (m_stop.load(std::memory_order_acquire)) return;
+            runPhase(workerIndex);
+        }
+    }
+
+    void ParallelMover::runPhase(uint32 workerIndex)
+    {
+        uint32 taskIndex;
+        while (claimTask(workerIndex, taskIndex))
+        {
+            const Task& task = m_tasks[taskIndex];
+            memmove(task.dst, task.src, task.bytes);
+            if (m_pendingTasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                m_pendingTasks.notify_all();
+        }
+    }
+
+    bool ParallelMover::claimTask(uint32 workerIndex, uint32& taskIndex)
+    {
+        // Own range first (front)
+        std::atomic<uint64>& own = m_ranges[workerIndex];
+        uint64 range = own.load(std::memory_order_acquire);
+        while (rangeLo(range) < rangeHi(range))
+        {
+            if (own.compare_exchange_weak(range, packRange(rangeLo(range) + 1, rangeHi(range)), std::memory_order_acq_rel))
+            {
+                taskIndex = rangeLo(range);
+                return true;
+            }
+        }
+
+        // Steal from the back of other workers' ranges
+        for (uint32 i = 1; i < m_threadCount; i++)
+        {
+            std::atomic<uint64>& victim = m_ranges[(workerIndex + i) % m_threadCount];
+            range = victim.load(std::memory_order_acquire);
+            while (rangeLo(range) < rangeHi(range))
+            {
+                if (victim.compare_exchange_weak(range, packRange(rangeLo(range), rangeHi(range) - 1), std::memory_order_acq_rel))
+                {
+                    taskIndex = rangeHi(range) - 1;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+}
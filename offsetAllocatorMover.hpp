@@ -0,0 +1,59 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Relocation of one allocation. Offsets and size in elements (same units as Allocator).
+    struct Move
+    {
+        uint32 srcOffset;
+        uint32 dstOffset;
+        uint32 size;
+    };
+
+    // Parallel executor for compaction move lists. Result is identical to running memmove for each move in list order.
+    // Each move gets a dependency level: It runs after all earlier moves whose source or destination ranges it overlaps.
+    // Levels run in order. Inside a level, moves are split into chunks that worker threads execute with work stealing.
+    class ParallelMover
+    {
+    public:
+        // threadCount includes the calling thread. 0 = hardware concurrency.
+        ParallelMover(uint32 threadCount = 0, uint32 chunkBytes = 256 * 1024);
+        ~ParallelMover();
+
+        void execute(void* base, uint32 elementSize, const Move* moves, uint32 moveCount);
+
+        uint32 threadCount() const { return m_threadCount; }
+
+    private:
+        struct Task
+        {
+            uint8* dst;
+            const uint8* src;
+            uint64 bytes;
+        };
+
+        void workerLoop(uint32 workerIndex);
+        void runPhase(uint32 workerIndex);
+        bool claimTask(uint32 workerIndex, uint32& taskIndex);
+
+        uint32 m_threadCount;
+        uint64 m_chunkBytes;
+
+        // Per worker task range [lo, hi) packed in 64 bits. Owner pops from lo, thieves steal from hi.
+        std::vector<std::atomic<uint64>> m_ranges;
+        std::vector<Task> m_tasks;
+        std::atomic<uint32> m_pendingTasks;
+        std::atomic<uint32> m_generation;
+        std::atomic<bool> m_stop;
+        std::vector<std::thread> m_workers;
+    };
+}
@@ -0,0 +1,87 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorRegistry.hpp"
+
+#include <mutex>
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+namespace OffsetAllocator
+{
+    static std::mutex s_registryMutex;
+    static Allocator* s_registryHead = nullptr;
+
+    void registerAllocator(Allocator* allocator, const char* name)
+    {
+        ASSERT(name != nullptr);
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        if (allocator->m_name)
+        {
+            // Already registered: Rename only
+            allocator->m_name = name;
+            return;
+        }
+        
+        allocator->m_name = name;
+        allocator->m_registrySample = new RegistrySample;
+        allocator->publishRegistrySample();
+        allocator->m_registryPrev = nullptr;
+        allocator->m_registryNext = s_registryHead;
+        if (s_registryHead) s_registryHead->m_registryPrev = allocator;
+        s_registryHead = allocator;
+    }
+
+    void unregisterAllocator(Allocator* allocator)
+    {
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        if (!allocator->m_name) return;
+        
+        if (allocator->m_registryPrev) allocator->m_registryPrev->m_registryNext = allocator->m_registryNext;
+        else s_registryHead = allocator->m_registryNext;
+        if (allocator->m_registryNext) allocator->m_registryNext->m_registryPrev = allocator->m_registryPrev;
+        allocator->m_name = nullptr;
+        delete allocator->m_registrySample;
+        allocator->m_registrySample = nullptr;
+        allocator->m_registryPrev = allocator->m_registryNext = nullptr;
+    }
+
+    void registryReport(RegistryReport& report)
+    {
+        report.allocatorCount = 0;
+        report.totalSize = 0;
+        report.totalFreeSpace = 0;
+        report.largestFreeRegion = 0;
+        report.usedNodes = 0;
+        report.maxAllocs = 0;
+        report.allocators.clear();
+        
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        for (const Allocator* allocator = s_registryHead; allocator; allocator = allocator->m_registryNext)
+        {
+            // Owner may be modifying the allocator: Published sample only. m_name and m_size are stable under the lock.
+            const RegistrySample& sample = *allocator->m_registrySample;
+            RegistryEntry entry = {
+                .name = allocator->m_name,
+                .size = allocator->size(),
+                .totalFreeSpace = sample.totalFreeSpace.load(std::memory_order_relaxed),
+                .largestFreeRegion = sample.largestFreeRegion.load(std::memory_order_relaxed),
+                .usedNodes = sample.usedNodes.load(std::memory_order_relaxed),
+                .maxAllocs = sample.maxAllocs.load(std::memory_order_relaxed),
+            };
+            
+            report.allocatorCount++;
+            report.totalSize += entry.size;
+            report.totalFreeSpace += entry.totalFreeSpace;
+            if (entry.largestFreeRegion > report.largestFreeRegion) report.largestFreeRegion = entry.largestFreeRegion;
+            report.usedNodes += entry.usedNodes;
+            report.maxAllocs += entry.maxAllocs;
+            report.allocators.push_back(entry);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <atomic>
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Published by a registered allocator's owner after every allocate/free (and other layout changes).
+    // registryReport reads it from other threads. Relaxed: Each field is a recent value on its own.
+    struct RegistrySample
+    {
+        std::atomic<uint32> totalFreeSpace;
+        std::atomic<uint32> largestFreeRegion;
+        std::atomic<uint32> usedNodes;
+        std::atomic<uint32> maxAllocs;
+    };
+
+    struct RegistryEntry
+    {
+        const char* name;
+        uint32 size;
+        uint32 totalFreeSpace;
+        uint32 largestFreeRegion;
+        uint32 usedNodes;           // Live metadata: Used + free region nodes
+        uint32 maxAllocs;
+    };
+
+    // Totals over all registered allocators + one entry per allocator (registration order, newest first)
+    struct RegistryReport
+    {
+        uint32 allocatorCount = 0;
+        uint64 totalSize = 0;
+        uint64 totalFreeSpace = 0;
+        uint64 largestFreeRegion = 0;   // Max over allocators
+        uint64 usedNodes = 0;
+        uint64 maxAllocs = 0;
+        std::vector<RegistryEntry> allocators;
+    };
+
+    // registerAllocator/unregisterAllocator/registryReport are declared in offsetAllocator.hpp.
+    //
+    // Register and unregister from the allocator's owner thread: The owner publishes to the sample they create.
+    //
+    // registryReport: O(registered allocators), O(1) each. Holds the registry mutex only: Owners keep allocating
+    // while it runs and are never blocked by it. Figures come from the owners' RegistrySample. Each one is a recent
+    // value, not a consistent snapshot across fields or allocators (fine for metrics sampling).
+    // The report vector is reused: Pass the same report every call to avoid allocations.
+}
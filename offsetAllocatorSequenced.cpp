@@ -0,0 +1,110 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorSequenced.hpp"
+
+#include <thread>
+
+namespace OffsetAllocator
+{
+    SequencedAllocator::SequencedAllocator(uint32 size, uint32 maxAllocs, uint32 windowSize) :
+        m_allocator(size, maxAllocs),
+        m_windowSize(windowSize ? windowSize : 1),
+        m_slots(new Slot[m_windowSize]),
+        m_nextCommit(0),
+        m_commitLock(false)
+    {
+        for (uint32 i = 0; i < m_windowSize; i++)
+        {
+            m_slots[i].state.store((uint64)i * 4 + EMPTY, std::memory_order_relaxed);
+        }
+    }
+
+    SequencedAllocator::~SequencedAllocator()
+    {
+        delete[] m_slots;
+    }
+
+    void SequencedAllocator::submitAllocate(uint64 sequence, uint32 size)
+    {
+        publish(sequence, ALLOCATE, size, {});
+        tryCommit();
+    }
+
+    Allocation SequencedAllocator::wait(uint64 sequence)
+    {
+        Slot& slot = m_slots[sequence % m_windowSize];
+        while (slot.state.load(std::memory_order_acquire) != sequence * 4 + DONE)
+        {
+            tryCommit();
+            std::this_thread::yield();
+        }
+
+        // Hand the slot to sequence + windowSize
+        Allocation result = slot.allocation;
+        slot.state.store((sequence + m_windowSize) * 4 + EMPTY, std::memory_order_seq_cst);
+        return result;
+    }
+
+    Allocation SequencedAllocator::allocate(uint64 sequence, uint32 size)
+    {
+        submitAllocate(sequence, size);
+        return wait(sequence);
+    }
+
+    void SequencedAllocator::free(uint64 sequence, Allocation allocation)
+    {
+        publish(sequence, FREE, 0, allocation);
+        tryCommit();
+    }
+
+    void SequencedAllocator::publish(uint64 sequence, Phase phase, uint32 size, Allocation allocation)
+    {
+        // Slot still in use by sequence - windowSize? Help committing until it is recycled.
+        Slot& slot = m_slots[sequence % m_windowSize];
+        while (slot.state.load(std::memory_order_acquire) != sequence * 4 + EMPTY)
+        {
+            tryCommit();
+            std::this_thread::yield();
+        }
+
+        slot.size = size;
+        slot.allocation = allocation;
+        slot.state.store(sequence * 4 + phase, std::memory_order_seq_cst);
+    }
+
+    bool SequencedAllocator::ready(uint64 sequence) const
+    {
+        uint64 state = m_slots[sequence % m_windowSize].state.load(std::memory_order_seq_cst);
+        return state == sequence * 4 + ALLOCATE || state == sequence * 4 + FREE;
+    }
+
+    void SequencedAllocator::tryCommit()
+    {
+        // Re-check after unlocking: A request published while we held the lock would otherwise wait for the next caller
+        while (ready(m_nextCommit.load(std::memory_order_seq_cst)))
+        {
+            if (m_commitLock.exchange(true, std::memory_order_seq_cst)) return;
+
+            // Commit the whole ready run in sequence order
+            uint64 sequence = m_nextCommit.load(std::memory_order_relaxed);
+            while (ready(sequence))
+            {
+                Slot& slot = m_slots[sequence % m_windowSize];
+                if (slot.state.load(std::memory_order_relaxed) == sequence * 4 + ALLOCATE)
+                {
+                    slot.allocation = m_allocator.allocate(slot.size);
+                    slot.state.store(sequence * 4 + DONE, std::memory_order_release);
+                }
+                else
+                {
+                    m_allocator.free(slot.allocation);
+                    slot.state.store((sequence + m_windowSize) * 4 + EMPTY, std::memory_order_release);
+                }
+                sequence++;
+            }
+            m_nextCommit.store(sequence, std::memory_order_seq_cst);
+            m_commitLock.store(false, std::memory_order_seq_cst);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <atomic>
+
+namespace OffsetAllocator
+{
+    // Deterministic multi-threaded front end for one Allocator. Every request carries a logical sequence number
+    // and requests are committed in sequence order, so placement depends only on the sequence, not on scheduling.
+    // Sequence numbers start from 0, are dense, and each is used exactly once (an allocate or a free).
+    // Submission does not take a lock: Threads publish into a ring of windowSize slots. Whichever thread finds
+    // the next sequence published commits the whole ready run as a batch.
+    class SequencedAllocator
+    {
+    public:
+        SequencedAllocator(uint32 size, uint32 maxAllocs = 128 * 1024, uint32 windowSize = 1024);
+        ~SequencedAllocator();
+
+        // Pipelined: Submit, do other work, then wait for the result. Waiting helps committing.
+        // A thread must wait for an allocation before it submits the sequence windowSize later (same slot).
+        void submitAllocate(uint64 sequence, uint32 size);
+        Allocation wait(uint64 sequence);
+        Allocation allocate(uint64 sequence, uint32 size);
+
+        // Frees don't wait for the commit
+        void free(uint64 sequence, Allocation allocation);
+
+        // Not thread safe: Only when no requests are in flight
+        Allocator& allocator() { return m_allocator; }
+
+    private:
+        enum Phase : uint64
+        {
+            EMPTY = 0,
+            ALLOCATE = 1,
+            FREE = 2,
+            DONE = 3,
+        };
+
+        // state = sequence * 4 + phase. A slot serves sequences slotIndex, slotIndex + windowSize, ...
+        struct alignas(64) Slot
+        {
+            std::atomic<uint64> state;
+            uint32 size;
+            Allocation allocation;
+        };
+
+        void publish(uint64 sequence, Phase phase, uint32 size, Allocation allocation);
+        bool ready(uint64 sequence) const;
+        void tryCommit();
+
+        Allocator m_allocator;
+        uint32 m_windowSize;
+        Slot* m_slots;
+        alignas(64) std::atomic<uint64> m_nextCommit;
+        alignas(64) std::atomic<bool> m_commitLock;
+    };
+}
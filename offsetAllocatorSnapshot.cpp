@@ -0,0 +1,97 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorSnapshot.hpp"
+
+#include <algorithm>
+#include <map>
+
+namespace OffsetAllocator
+{
+    inline bool entryOrder(const SnapshotEntry& a, const SnapshotEntry& b)
+    {
+        return a.sequence != b.sequence ? a.sequence < b.sequence : a.offset < b.offset;
+    }
+
+    Snapshot captureSnapshot(const Allocator& allocator)
+    {
+        struct Context
+        {
+            Snapshot snapshot;
+            const AllocationTag* tags;
+        };
+        Context context = {.snapshot = {}, .tags = allocator.allocationTags()};
+
+        allocator.visitRegions([](void* userData, const Region& region)
+        {
+            if (!region.used) return;
+            Context& context = *(Context*)userData;
+            AllocationTag tag = context.tags ? context.tags[region.metadata] : AllocationTag{.tag = 0, .sequence = 0};
+            context.snapshot.entries.push_back({.offset = region.offset, .size = region.size, .tag = tag.tag, .sequence = tag.sequence});
+        }, &context);
+
+        // Regions come in offset order
+        std::sort(context.snapshot.entries.begin(), context.snapshot.entries.end(), entryOrder);
+        return static_cast<Snapshot&&>(context.snapshot);
+    }
+
+    SnapshotDiff diffSnapshots(const Snapshot& before, const Snapshot& after)
+    {
+        SnapshotDiff diff;
+
+        // Merge join on (sequence, offset). A free + reallocation at the same offset gets a new sequence:
+        // Removed + added, not a resize.
+        size_t i = 0, j = 0;
+        while (i < before.entries.size() || j < after.entries.size())
+        {
+            if (j == after.entries.size() || (i < before.entries.size() && entryOrder(before.entries[i], after.entries[j])))
+            {
+                diff.removed.push_back(before.entries[i++]);
+            }
+            else if (i == before.entries.size() || entryOrder(after.entries[j], before.entries[i]))
+            {
+                diff.added.push_back(after.entries[j++]);
+            }
+            else
+            {
+                if (before.entries[i].size != after.entries[j].size)
+                {
+                    diff.resized.push_back({.before = before.entries[i], .after = after.entries[j]});
+                }
+                i++;
+                j++;
+            }
+        }
+
+        // Group totals
+        std::map<uint64, SnapshotDiff::Group> groups;
+        auto group = [&groups](uint32 tag, uint32 size) -> SnapshotDiff::Group&
+        {
+            uint32 sizeClass = SmallFloat::uintToFloatRoundUp(size);
+            SnapshotDiff::Group& group = groups[((uint64)tag << 32) | sizeClass];
+            group.tag = tag;
+            group.sizeClass = sizeClass;
+            return group;
+        };
+        for (const SnapshotEntry& entry : diff.added)
+        {
+            SnapshotDiff::Group& g = group(entry.tag, entry.size);
+            g.addedCount++;
+            g.addedBytes += entry.size;
+        }
+        for (const SnapshotEntry& entry : diff.removed)
+        {
+            SnapshotDiff::Group& g = group(entry.tag, entry.size);
+            g.removedCount++;
+            g.removedBytes += entry.size;
+        }
+        for (const SnapshotDiff::Resize& resize : diff.resized)
+        {
+            SnapshotDiff::Group& g = group(resize.after.tag, resize.after.size);
+            g.resizedCount++;
+            g.resizedBytes += (long long)resize.after.size - (long long)resize.before.size;
+        }
+        for (const auto& entry : groups) diff.groups.push_back(entry.second);
+        return diff;
+    }
+}
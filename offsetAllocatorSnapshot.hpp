@@ -0,0 +1,57 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <vector>
+
+namespace OffsetAllocator
+{
+    struct SnapshotEntry
+    {
+        uint32 offset;
+        uint32 size;
+        uint32 tag;
+        uint64 sequence;
+    };
+
+    // Live allocations sorted by (sequence, offset). Sequence + offset identify an allocation across snapshots.
+    // Needs allocation tags (Allocator::enableAllocationTags). Without them all entries have tag 0 and sequence 0.
+    struct Snapshot
+    {
+        std::vector<SnapshotEntry> entries;
+    };
+
+    struct SnapshotDiff
+    {
+        // Same allocation (sequence + offset) with a different size, e.g. grown or shrunk in place by its owner
+        struct Resize
+        {
+            SnapshotEntry before;
+            SnapshotEntry after;
+        };
+
+        // Byte totals per (tag, size class). Size class = SmallFloat round up bin (after size for resizes).
+        struct Group
+        {
+            uint32 tag;
+            uint32 sizeClass;
+            uint32 addedCount;
+            uint32 removedCount;
+            uint32 resizedCount;
+            uint64 addedBytes;
+            uint64 removedBytes;
+            long long resizedBytes;     // Sum of size deltas
+        };
+
+        std::vector<SnapshotEntry> added;      // Sorted by (sequence, offset)
+        std::vector<SnapshotEntry> removed;
+        std::vector<Resize> resized;
+        std::vector<Group> groups;      // Sorted by (tag, sizeClass)
+    };
+
+    Snapshot captureSnapshot(const Allocator& allocator);
+    SnapshotDiff diffSnapshots(const Snapshot& before, const Snapshot& after);
+}
@@ -3,18 +3,31 @@
 #include "gfxTestFixture.hpp"
 
 #include "offsetAllocator.hpp"
+#include "offsetAllocatorBasic.hpp"
+#include "offsetAllocatorBestFit.hpp"
+#include "offsetAllocatorCombining.hpp"
+#include "offsetAllocatorConcurrent.hpp"
+#include "offsetAllocatorDump.hpp"
+#include "offsetAllocatorHandles.hpp"
+#include "offsetAllocatorImage.hpp"
+#include "offsetAllocatorLargeObject.hpp"
+#include "offsetAllocatorLease.hpp"
+#include "offsetAllocatorLifetime.hpp"
+#include "offsetAllocatorMaintenance.hpp"
+#include "offsetAllocatorMover.hpp"
+#include "offsetAllocatorRegistry.hpp"
+#include "offsetAllocatorSequenced.hpp"
+#include "offsetAllocatorSnapshot.hpp"
+#include "offsetAllocatorTrace.hpp"
+#include "offsetAllocatorUnit.hpp"
 
-using namespace f;
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
 
-namespace OffsetAllocator
-{
-    namespace SmallFloat
-    {
-        extern uint32 uintToFloatRoundUp(uint32 size);
-        extern uint32 uintToFloatRoundDown(uint32 size);
-    extern uint32 floatToUint(uint32 floatValue);
-    }
-}
+using namespace f;
 
 namespace offsetAllocatorTests
 {
@@ -257,4 +270,2014 @@ namespace offsetAllocatorTests
             allocator.free(validateAll);
         }
     }
+
+    TEST_CASE("reserve", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024, 16);
+
+        SECTION("budget")
+        {
+            OffsetAllocator::Reservation r = allocator.reserve(1024 * 512, 4);
+            REQUIRE(r.size == 1024 * 512);
+            REQUIRE(r.allocs == 4);
+            
+            // Unreserved callers can't eat into the reserved budget
+            OffsetAllocator::Allocation a = allocator.allocate(1024 * 768);
+            REQUIRE(a.offset == OffsetAllocator::Allocation::NO_SPACE);
+            
+            OffsetAllocator::Allocation b = allocator.allocate(1024 * 512);
+            REQUIRE(b.offset == 0);
+            
+            // Reserved callers draw from the reservation
+            OffsetAllocator::Allocation c = allocator.allocate(1024 * 256, r);
+            REQUIRE(c.offset == 1024 * 512);
+            REQUIRE(r.size == 1024 * 256);
+            REQUIRE(r.allocs == 3);
+            
+            // Exceeding the reservation fails fast
+            OffsetAllocator::Allocation d = allocator.allocate(1024 * 512, r);
+            REQUIRE(d.offset == OffsetAllocator::Allocation::NO_SPACE);
+            
+            // Returning the rest of the reservation makes it available again
+            allocator.unreserve(r);
+            OffsetAllocator::Allocation e = allocator.allocate(1024 * 256);
+            REQUIRE(e.offset == 1024 * 768);
+            
+            allocator.free(b);
+            allocator.free(c);
+            allocator.free(e);
+        }
+        
+        SECTION("nodes")
+        {
+            // Reserve all but one of the allocatable nodes
+            OffsetAllocator::Reservation r = allocator.reserve(0, 13);
+            REQUIRE(r.allocs == 13);
+            
+            OffsetAllocator::Reservation fail = allocator.reserve(0, 2);
+            REQUIRE(fail.size == OffsetAllocator::Allocation::NO_SPACE);
+            REQUIRE(allocator.allocate(0, fail).offset == OffsetAllocator::Allocation::NO_SPACE);
+            
+            OffsetAllocator::Allocation a = allocator.allocate(0);
+            REQUIRE(a.offset == 0);
+            OffsetAllocator::Allocation b = allocator.allocate(0);
+            REQUIRE(b.offset == OffsetAllocator::Allocation::NO_SPACE);
+            
+            OffsetAllocator::Allocation c = allocator.allocate(0, r);
+            REQUIRE(c.offset == 0);
+            
+            allocator.unreserve(r);
+            allocator.free(a);
+            allocator.free(c);
+        }
+        
+        SECTION("fragmentation")
+        {
+            // Two 256KB holes: The budget admits 512KB, no free region fits it
+            OffsetAllocator::Allocation quarters[4];
+            for (uint32 i = 0; i < 4; i++) quarters[i] = allocator.allocate(1024 * 256);
+            allocator.free(quarters[0]);
+            allocator.free(quarters[2]);
+            
+            OffsetAllocator::Reservation r = allocator.reserve(1024 * 512, 2);
+            REQUIRE(r.size == 1024 * 512);
+            REQUIRE(allocator.allocate(1024 * 512, r).offset == OffsetAllocator::Allocation::NO_SPACE);
+            
+            // Failure keeps the budget: Allocations that fit the holes still succeed
+            REQUIRE(r.size == 1024 * 512);
+            REQUIRE(r.allocs == 2);
+            OffsetAllocator::Allocation a = allocator.allocate(1024 * 256, r);
+            OffsetAllocator::Allocation b = allocator.allocate(1024 * 256, r);
+            REQUIRE(a.offset != OffsetAllocator::Allocation::NO_SPACE);
+            REQUIRE(b.offset != OffsetAllocator::Allocation::NO_SPACE);
+            
+            allocator.unreserve(r);
+            allocator.free(a);
+            allocator.free(b);
+            allocator.free(quarters[1]);
+            allocator.free(quarters[3]);
+        }
+        
+        SECTION("stale")
+        {
+            // No allocs: Could never be used
+            REQUIRE(allocator.reserve(1024, 0).size == OffsetAllocator::Allocation::NO_SPACE);
+            
+            OffsetAllocator::Reservation r = allocator.reserve(1024 * 512, 4);
+            OffsetAllocator::Reservation s = allocator.reserve(1024 * 256, 2);
+            REQUIRE(s.allocs == 2);
+            allocator.reset();
+            
+            // Reset released the budget: Stale reservations are no-ops
+            allocator.unreserve(r);
+            REQUIRE(allocator.allocate(1024, s).offset == OffsetAllocator::Allocation::NO_SPACE);
+            REQUIRE(s.size == OffsetAllocator::Allocation::NO_SPACE);
+            
+            // Counters didn't underflow: The full budget can be reserved again
+            OffsetAllocator::Reservation full = allocator.reserve(1024 * 1024, 14);
+            REQUIRE(full.allocs == 14);
+            REQUIRE(allocator.allocate(1024).offset == OffsetAllocator::Allocation::NO_SPACE);
+            allocator.unreserve(full);
+        }
+        
+        // End: Validate that allocator has no fragmentation left. Should be 100% clean.
+        OffsetAllocator::Allocation validateAll = allocator.allocate(1024 * 1024);
+        REQUIRE(validateAll.offset == 0);
+        allocator.free(validateAll);
+    }
+
+    TEST_CASE("flight recorder", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024);
+        allocator.enableFlightRecorder(3); // Rounds up to 4 events
+
+        OffsetAllocator::Allocation a = allocator.allocate(100);
+        OffsetAllocator::Allocation b = allocator.allocate(200);
+        allocator.free(a);
+        allocator.free(b); // Merges with a (prev) and the remainder (next)
+        
+        FILE* file = tmpfile();
+        REQUIRE(file != nullptr);
+        allocator.dumpFlightRecorder(fileno(file));
+        
+        char text[4096] = {};
+        rewind(file);
+        fread(text, 1, sizeof(text) - 1, file);
+        fclose(file);
+        
+        // Ring wrapped: 6 events total, last 4 kept (free a, free b, merge prev, merge next)
+        REQUIRE(strstr(text, "events=4 (total 6)") != nullptr);
+        REQUIRE(strstr(text, "allocate offset=0") == nullptr);
+        REQUIRE(strstr(text, "2 free offset=0 size=100") != nullptr);
+        REQUIRE(strstr(text, "3 free offset=100 size=200") != nullptr);
+        REQUIRE(strstr(text, "4 merge offset=0 size=100") != nullptr);
+        REQUIRE(strstr(text, "5 merge offset=300") != nullptr);
+        REQUIRE(strstr(text, "usedBinsTop=0x") != nullptr);
+    }
+
+    TEST_CASE("state hash", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024);
+        OffsetAllocator::Allocator replica(1024 * 1024);
+        allocator.enableStateHash(true);
+        replica.enableStateHash(true);
+        REQUIRE(allocator.stateHash() == replica.stateHash());
+        OffsetAllocator::uint64 initialHash = allocator.stateHash();
+
+        OffsetAllocator::Allocation a = allocator.allocate(1000);
+        OffsetAllocator::Allocation b = allocator.allocate(2000);
+        REQUIRE(allocator.stateHash() != initialHash);
+        
+        // Same operations on the replica -> same hash
+        OffsetAllocator::Allocation ra = replica.allocate(1000);
+        OffsetAllocator::Allocation rb = replica.allocate(2000);
+        REQUIRE(allocator.stateHash() == replica.stateHash());
+        
+        // Diverged layout -> different hash
+        allocator.free(a);
+        OffsetAllocator::uint64 freedHash = allocator.stateHash();
+        REQUIRE(freedHash != replica.stateHash());
+        replica.free(ra);
+        REQUIRE(freedHash == replica.stateHash());
+        
+        // Enabling late hashes the live allocations: Same value as the incrementally updated hash
+        OffsetAllocator::uint64 liveHash = allocator.stateHash();
+        allocator.enableStateHash(false);
+        REQUIRE(allocator.stateHash() == 0);
+        allocator.enableStateHash(true);
+        REQUIRE(allocator.stateHash() == liveHash);
+        
+        // Full merge returns to the initial state
+        allocator.free(b);
+        replica.free(rb);
+        REQUIRE(allocator.stateHash() == initialHash);
+        REQUIRE(replica.stateHash() == initialHash);
+    }
+
+    TEST_CASE("trace", "[offsetAllocator]")
+    {
+        const char* path = "offsetAllocatorTrace.tmp";
+        OffsetAllocator::Allocator allocator(1024 * 1024);
+        allocator.enableStateHash(true);
+
+        // Small blocks to test block framing
+        FILE* file = fopen(path, "wb");
+        REQUIRE(file != nullptr);
+        {
+            OffsetAllocator::TraceWriter writer(file, 3);
+            OffsetAllocator::Allocation allocations[8];
+            for (uint32 i = 0; i < 8; i++)
+            {
+                allocations[i] = allocator.allocate(1000 + i * 300);
+                writer.allocate(1000 + i * 300, allocations[i]);
+            }
+            for (uint32 i = 0; i < 8; i += 2)
+            {
+                writer.free(allocations[i]);
+                allocator.free(allocations[i]);
+            }
+            OffsetAllocator::Allocation big = allocator.allocate(1024 * 1024 * 2);
+            writer.allocate(1024 * 1024 * 2, big);
+            REQUIRE(writer.finish());
+        }
+        fclose(file);
+
+        OffsetAllocator::TraceReader reader;
+        REQUIRE(reader.open(path));
+        REQUIRE(reader.eventCount() == 13);
+        REQUIRE(reader.blockCount() == 5);
+
+        OffsetAllocator::TraceEvent events[16];
+        REQUIRE(reader.read(events, 16) == 13);
+        REQUIRE(events[0].op == OffsetAllocator::TraceEvent::ALLOCATE);
+        REQUIRE(events[0].offset == 0);
+        REQUIRE(events[0].size == 1000);
+        REQUIRE(events[1].offset == 1000);
+        REQUIRE(events[8].op == OffsetAllocator::TraceEvent::FREE);
+        REQUIRE(events[8].offset == 0);
+        REQUIRE(events[12].node == OffsetAllocator::Allocation::NO_SPACE);
+        REQUIRE(reader.read(events, 16) == 0);
+
+        // Replay into a fresh allocator reproduces the traced state exactly
+        REQUIRE(reader.seekBlock(0));
+        OffsetAllocator::Allocator replay(1024 * 1024);
+        OffsetAllocator::TraceReplayResult result = OffsetAllocator::replayTrace(reader, replay);
+        REQUIRE(result.events == 13);
+        REQUIRE(result.failedAllocations == 1);
+        REQUIRE(result.offsetMismatches == 0);
+        replay.enableStateHash(true);
+        REQUIRE(replay.stateHash() == allocator.stateHash());
+        REQUIRE(!reader.corrupted());
+        reader.close();
+
+        SECTION("corrupted")
+        {
+            file = fopen(path, "rb");
+            std::vector<OffsetAllocator::uint8> bytes(4096);
+            bytes.resize(fread(bytes.data(), 1, bytes.size(), file));
+            fclose(file);
+
+            auto openCorrupted = [&](uint64 fileOffset, const void* data, uint32 size)
+            {
+                std::vector<OffsetAllocator::uint8> corrupted = bytes;
+                memcpy(corrupted.data() + fileOffset, data, size);
+                FILE* out = fopen(path, "wb");
+                fwrite(corrupted.data(), 1, corrupted.size(), out);
+                fclose(out);
+                return reader.open(path);
+            };
+
+            // Block 0: File header (8 bytes), block header {byteSize, eventCount} and 3 events
+            uint32 eventCount = 1000;
+            REQUIRE(openCorrupted(12, &eventCount, sizeof(eventCount)));
+            REQUIRE(reader.read(events, 16) == 0);
+            REQUIRE(reader.corrupted());
+
+            // First event's tag: Unknown op
+            OffsetAllocator::uint8 tag = 3;
+            REQUIRE(openCorrupted(16, &tag, sizeof(tag)));
+            REQUIRE(reader.read(events, 16) == 0);
+            REQUIRE(reader.corrupted());
+
+            // Fields past the block end: 4 byte block holding a 1 + 1 + 1 + 2 byte event
+            uint32 blockHeader[2] = {4, 1};
+            REQUIRE(openCorrupted(8, blockHeader, sizeof(blockHeader)));
+            REQUIRE(reader.read(events, 16) == 0);
+            REQUIRE(reader.corrupted());
+
+            // Block 1 index entry past the end of the file: Block 0 still decodes
+            uint64 indexOffset;
+            memcpy(&indexOffset, bytes.data() + bytes.size() - 24, sizeof(indexOffset));
+            uint64 blockOffset = 1ull << 40;
+            REQUIRE(openCorrupted(indexOffset + sizeof(uint64), &blockOffset, sizeof(blockOffset)));
+            REQUIRE(reader.read(events, 16) == 3);
+            REQUIRE(reader.corrupted());
+            REQUIRE(!reader.seekBlock(1));
+            reader.close();
+        }
+
+        remove(path);
+    }
+
+    TEST_CASE("validate", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024, 1024);
+        REQUIRE(allocator.validate());
+
+        // Pseudo random allocs and frees. Validate after every operation.
+        OffsetAllocator::Allocation allocations[256];
+        uint32 seed = 12345;
+        for (uint32 i = 0; i < 256; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            allocations[i] = allocator.allocate((seed >> 16) % 5000);
+            REQUIRE(allocator.validate());
+        }
+        for (uint32 i = 0; i < 256; i++)
+        {
+            uint32 index = (i * 97) % 256;
+            if (allocations[index].offset != OffsetAllocator::Allocation::NO_SPACE)
+                allocator.free(allocations[index]);
+            REQUIRE(allocator.validate());
+        }
+
+        OffsetAllocator::StorageReport report = allocator.storageReport();
+        REQUIRE(report.totalFreeSpace == 1024 * 1024);
+    }
+
+    TEST_CASE("maintenance", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024, 4096);
+        allocator.enableStateHash(true);
+        OffsetAllocator::Allocation a = allocator.allocate(1000);
+        OffsetAllocator::Allocation b = allocator.allocate(2000);
+        allocator.free(a);
+
+        OffsetAllocator::MaintenanceService maintenance(allocator, 1000 * 1000, 256);
+        REQUIRE(maintenance.beginTick());
+        REQUIRE(!maintenance.beginTick()); // Already lent
+        
+        // Owner would do other work here. Test waits for the release.
+        while (!maintenance.tryEndTick()) {}
+        
+        OffsetAllocator::MaintenanceTelemetry telemetry = maintenance.telemetry();
+        REQUIRE(telemetry.ticks == 1);
+        REQUIRE(telemetry.stateHash == allocator.stateHash());
+        REQUIRE(telemetry.totalFreeSpace == 1024 * 1024 - 2000);
+        REQUIRE(telemetry.validationErrors == 0);
+        
+        // Owner has the allocator back
+        allocator.free(b);
+        REQUIRE(maintenance.beginTick());
+        while (!maintenance.tryEndTick()) {}
+        REQUIRE(maintenance.telemetry().ticks == 2);
+        REQUIRE(maintenance.telemetry().totalFreeSpace == 1024 * 1024);
+    }
+
+    TEST_CASE("maintenance compaction plan", "[offsetAllocator]")
+    {
+        // Fragmented heap: Every 3rd allocation freed. Allocation i is filled with byte i.
+        const uint32 size = 1024 * 1024;
+        OffsetAllocator::Allocator allocator(size, 4096);
+        std::vector<OffsetAllocator::uint8> data(size, 0xff);
+        std::vector<OffsetAllocator::Allocation> allocations, live;
+        for (uint32 i = 0; i < 64; i++)
+        {
+            allocations.push_back(allocator.allocate(1000 + i * 37));
+            memset(&data[allocations[i].offset], (int)i, 1000 + i * 37);
+        }
+        for (uint32 i = 0; i < 64; i++)
+        {
+            if (i % 3 == 0) allocator.free(allocations[i]);
+            else live.push_back(allocations[i]);
+        }
+        
+        OffsetAllocator::MaintenanceService maintenance(allocator, 1000 * 1000, 256);
+        auto planTicks = [&](OffsetAllocator::CompactionPlan& plan)
+        {
+            for (uint32 i = 0; i < 100; i++)
+            {
+                if (maintenance.takeCompactionPlan(plan)) return true;
+                REQUIRE(maintenance.beginTick());
+                while (!maintenance.tryEndTick()) {}
+            }
+            return false;
+        };
+        
+        OffsetAllocator::CompactionPlan plan;
+        REQUIRE(!maintenance.takeCompactionPlan(plan)); // Not requested
+        maintenance.requestCompactionPlan();
+        REQUIRE(planTicks(plan));
+        REQUIRE(maintenance.telemetry().compactionPlans == 1);
+        REQUIRE(plan.layout.size() == live.size());
+        REQUIRE(!plan.moves.empty());
+        
+        // Apply: Moves, then bulk load the packed layout
+        OffsetAllocator::ParallelMover mover(2, 4096);
+        mover.execute(data.data(), 1, plan.moves.data(), (uint32)plan.moves.size());
+        uint32 usedBytes = 0;
+        for (uint32 i = 0; i < plan.layout.size(); i++)
+        {
+            REQUIRE(plan.layout[i].offset == usedBytes);
+            REQUIRE(plan.oldOffsets[i] == live[i].offset);
+            uint32 index = (plan.layout[i].size - 1000) / 37;
+            REQUIRE(data[plan.layout[i].offset] == index);
+            REQUIRE(data[plan.layout[i].offset + plan.layout[i].size - 1] == index);
+            usedBytes += plan.layout[i].size;
+        }
+        
+        OffsetAllocator::Allocator compacted(size, 4096, plan.layout.data(), (uint32)plan.layout.size());
+        REQUIRE(compacted.validate());
+        REQUIRE(compacted.storageReport().totalFreeSpace == size - usedBytes);
+        REQUIRE(compacted.allocate(size / 2).offset == usedBytes);
+        
+        SECTION("owner changes")
+        {
+            // One step per tick: The plan spans ticks. Owner changes in between restart it.
+            OffsetAllocator::MaintenanceService slow(allocator, 0, 1024);
+            slow.requestCompactionPlan();
+            REQUIRE(slow.beginTick());
+            while (!slow.tryEndTick()) {}
+            OffsetAllocator::Allocation extra = allocator.allocate(500);
+            REQUIRE(slow.beginTick());
+            while (!slow.tryEndTick()) {}
+            REQUIRE(slow.telemetry().compactionPlanRestarts == 1);
+            
+            OffsetAllocator::CompactionPlan restarted;
+            for (uint32 i = 0; i < 100 && !slow.takeCompactionPlan(restarted); i++)
+            {
+                REQUIRE(slow.beginTick());
+                while (!slow.tryEndTick()) {}
+            }
+            REQUIRE(restarted.layout.size() == live.size() + 1);
+            
+            // Finished plan gone stale before it was taken: Planned again
+            slow.requestCompactionPlan();
+            for (uint32 i = 0; i < 4; i++)
+            {
+                REQUIRE(slow.beginTick());
+                while (!slow.tryEndTick()) {}
+            }
+            allocator.free(extra);
+            REQUIRE(!slow.takeCompactionPlan(restarted));
+            for (uint32 i = 0; i < 100 && !slow.takeCompactionPlan(restarted); i++)
+            {
+                REQUIRE(slow.beginTick());
+                while (!slow.tryEndTick()) {}
+            }
+            REQUIRE(restarted.layout.size() == live.size());
+        }
+    }
+
+    TEST_CASE("parallel mover", "[offsetAllocator]")
+    {
+        const uint32 size = 1024 * 1024;
+        std::vector<uint32> reference(size);
+        std::vector<uint32> data(size);
+        for (uint32 i = 0; i < size; i++) reference[i] = data[i] = i;
+
+        // Random moves, including overlapping and self overlapping ones. Result must match sequential memmove.
+        std::vector<OffsetAllocator::Move> moves;
+        uint32 seed = 777;
+        for (uint32 i = 0; i < 500; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            uint32 moveSize = (seed >> 8) % 20000;
+            seed = seed * 1664525 + 1013904223;
+            uint32 src = (seed >> 4) % (size - moveSize);
+            seed = seed * 1664525 + 1013904223;
+            uint32 dst = (i % 4 == 0) ? (src + moveSize / 2) % (size - moveSize) : (seed >> 4) % (size - moveSize);
+            moves.push_back({.srcOffset = src, .dstOffset = dst, .size = moveSize});
+            memmove(&reference[dst], &reference[src], moveSize * sizeof(uint32));
+        }
+
+        OffsetAllocator::ParallelMover mover(4, 4096);
+        mover.execute(data.data(), sizeof(uint32), moves.data(), (uint32)moves.size());
+        REQUIRE(data == reference);
+    }
+
+    TEST_CASE("parallel mover benchmark", "[offsetAllocator][!benchmark]")
+    {
+        // Compaction of a fragmented 256MB arena: Every other 1MB block slides left
+        const uint32 blockSize = 1024 * 1024;
+        const uint32 blockCount = 256;
+        std::vector<OffsetAllocator::uint8> arena((size_t)blockSize * blockCount);
+        std::vector<OffsetAllocator::Move> moves;
+        for (uint32 i = 1; i < blockCount; i += 2)
+            moves.push_back({.srcOffset = i * blockSize, .dstOffset = (i / 2) * blockSize, .size = blockSize});
+
+        OffsetAllocator::ParallelMover singleThread(1);
+        OffsetAllocator::ParallelMover multiThread;
+        
+        BENCHMARK("single thread 128MB")
+        {
+            singleThread.execute(arena.data(), 1, moves.data(), (uint32)moves.size());
+        };
+        BENCHMARK("parallel 128MB")
+        {
+            multiThread.execute(arena.data(), 1, moves.data(), (uint32)moves.size());
+        };
+    }
+
+    TEST_CASE("allocation stats", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024);
+        REQUIRE(allocator.allocationStats() == nullptr);
+        allocator.enableAllocationStats(true);
+
+        // 118 rounds up to bin 39 (120). Served from the big initial node.
+        OffsetAllocator::Allocation a = allocator.allocate(118);
+        OffsetAllocator::Allocation b = allocator.allocate(1024);
+        allocator.free(a);
+        
+        // Freed 118 node goes to round down bin 38 (112). Request 100 (bin 37) picks it: Exact size class, remainder 18.
+        OffsetAllocator::Allocation c = allocator.allocate(100);
+        REQUIRE(c.offset == 0);
+        
+        const OffsetAllocator::AllocationStats* stats = allocator.allocationStats();
+        REQUIRE(stats != nullptr);
+        REQUIRE(stats->sizeClasses[39].allocations == 1);
+        REQUIRE(stats->sizeClasses[39].requestedBytes == 118);
+        REQUIRE(stats->sizeClasses[39].binBytes == 120);
+        REQUIRE(stats->sizeClasses[39].nodeBytes == 1024 * 1024);
+        REQUIRE(stats->sizeClasses[37].nodeBytes == 118);
+        REQUIRE(stats->sizeClasses[37].exactFits == 0);
+        REQUIRE(stats->topBinEscalations[4] == 1); // a: Top bin 4 was empty
+        
+        // Request 113 rounds up to bin 39 (120 > 118). Top bin 4 has no fitting leaf bin -> escalation.
+        OffsetAllocator::Allocation d = allocator.allocate(113);
+        REQUIRE(stats->topBinEscalations[4] == 2);
+        
+        // Too large -> failure
+        OffsetAllocator::Allocation e = allocator.allocate(1024 * 1024);
+        REQUIRE(e.offset == OffsetAllocator::Allocation::NO_SPACE);
+        REQUIRE(stats->failedAllocations == 1);
+        
+        allocator.free(b);
+        allocator.free(c);
+        allocator.free(d);
+        allocator.enableAllocationStats(false);
+        REQUIRE(allocator.allocationStats() == nullptr);
+    }
+
+    TEST_CASE("handle table", "[offsetAllocator]")
+    {
+        OffsetAllocator::HandleTable handles(1024 * 1024, 16);
+        
+        OffsetAllocator::Handle a = handles.allocate(1024);
+        OffsetAllocator::Handle b = handles.allocate(2048);
+        OffsetAllocator::Handle c = handles.allocate(3072);
+        REQUIRE(a == 0);
+        REQUIRE(b == 1);
+        REQUIRE(handles.offset(b) == 1024);
+        REQUIRE(handles.resolve(c).size == 3072);
+        
+        // Compaction: Free a and b, move c down into the hole. Handle c stays valid.
+        handles.free(a);
+        handles.free(b);
+        OffsetAllocator::Allocation target = handles.allocateTarget(3072);
+        REQUIRE(target.offset == 0);
+        handles.relocate(c, target);
+        REQUIRE(handles.offset(c) == 0);
+        REQUIRE(handles.allocator().validate());
+        
+        // Freed IDs are recycled
+        OffsetAllocator::Handle d = handles.allocate(512);
+        REQUIRE(d == 1);
+        REQUIRE(handles.offset(d) == 3072);
+        
+        // Unused relocation target goes back to the table's allocator
+        uint32 freeSpace = handles.allocator().storageReport().totalFreeSpace;
+        handles.releaseTarget(handles.allocateTarget(4096));
+        REQUIRE(handles.allocator().storageReport().totalFreeSpace == freeSpace);
+        
+        handles.free(c);
+        handles.free(d);
+        REQUIRE(handles.allocator().storageReport().totalFreeSpace == 1024 * 1024);
+    }
+
+    TEST_CASE("visit regions", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1000);
+        OffsetAllocator::Allocation a = allocator.allocate(100);
+        OffsetAllocator::Allocation b = allocator.allocate(200);
+        OffsetAllocator::Allocation c = allocator.allocate(300);
+        allocator.free(b);
+
+        std::vector<OffsetAllocator::Region> regions;
+        allocator.visitRegions([](void* userData, const OffsetAllocator::Region& region)
+        {
+            ((std::vector<OffsetAllocator::Region>*)userData)->push_back(region);
+        }, &regions);
+        
+        REQUIRE(regions.size() == 4);
+        REQUIRE((regions[0].offset == 0 && regions[0].size == 100 && regions[0].used && regions[0].metadata == a.metadata));
+        REQUIRE((regions[1].offset == 100 && regions[1].size == 200 && !regions[1].used));
+        REQUIRE((regions[2].offset == 300 && regions[2].size == 300 && regions[2].used));
+        REQUIRE((regions[3].offset == 600 && regions[3].size == 400 && !regions[3].used));
+
+        SECTION("occupancy image")
+        {
+            // 10x10 pixels, 10 elements per pixel
+            FILE* file = tmpfile();
+            REQUIRE(file != nullptr);
+            REQUIRE(OffsetAllocator::writeOccupancyImage(allocator, file, 10, 10));
+            
+            long fileSize = ftell(file);
+            std::vector<char> data(fileSize + 1, 0);
+            rewind(file);
+            REQUIRE(fread(data.data(), 1, fileSize, file) == (size_t)fileSize);
+            fclose(file);
+            
+            REQUIRE(strncmp(data.data(), "P6\n", 3) == 0);
+            REQUIRE(strstr(data.data(), "# Largest free #0: offset=600 size=400 row=6") != nullptr);
+            REQUIRE(strstr(data.data(), "# Largest free #1: offset=100 size=200 row=1") != nullptr);
+            
+            // Pixel 0 = used, pixel 10 (offset 100) = free
+            const unsigned char* pixels = (const unsigned char*)data.data() + fileSize - 10 * 10 * 3;
+            REQUIRE((pixels[0] == 0x30 && pixels[1] == 0x60 && pixels[2] == 0xc0));
+            REQUIRE((pixels[30] == 0xe0 && pixels[31] == 0xe0 && pixels[32] == 0xe0));
+            
+            // Pixel count overflows uint32 (wraps to 65536) or exceeds the cap: Rejected, nothing written
+            file = tmpfile();
+            REQUIRE(file != nullptr);
+            REQUIRE(!OffsetAllocator::writeOccupancyImage(allocator, file, 65536, 65537));
+            REQUIRE(!OffsetAllocator::writeOccupancyImage(allocator, file, 8192, 8193));
+            REQUIRE(ftell(file) == 0);
+            fclose(file);
+        }
+
+        allocator.free(a);
+        allocator.free(c);
+    }
+
+    TEST_CASE("best fit", "[offsetAllocator]")
+    {
+        OffsetAllocator::BestFitAllocator allocator(1024 * 1024 * 256);
+
+        OffsetAllocator::Allocation a = allocator.allocate(1000);
+        OffsetAllocator::Allocation b = allocator.allocate(10);
+        OffsetAllocator::Allocation c = allocator.allocate(300);
+        OffsetAllocator::Allocation d = allocator.allocate(10);
+        OffsetAllocator::Allocation e = allocator.allocate(310);
+        OffsetAllocator::Allocation f = allocator.allocate(10);
+        REQUIRE(a.offset == 0);
+        REQUIRE(e.offset == 1320);
+        REQUIRE(allocator.allocationSize(c) == 300);
+
+        // Holes: 1000 @ 0, 300 @ 1010, 310 @ 1320. Exact best fit, no bin rounding.
+        allocator.free(a);
+        allocator.free(c);
+        allocator.free(e);
+
+        OffsetAllocator::Allocation g = allocator.allocate(305);
+        REQUIRE(g.offset == 1320);
+        OffsetAllocator::Allocation h = allocator.allocate(290);
+        REQUIRE(h.offset == 1010);
+        OffsetAllocator::Allocation i = allocator.allocate(301);
+        REQUIRE(i.offset == 0);
+
+        OffsetAllocator::StorageReportFull full = allocator.storageReportFull();
+        uint32 freeRegions = 0;
+        for (uint32 bin = 0; bin < OffsetAllocator::NUM_LEAF_BINS; bin++) freeRegions += full.freeRegions[bin].count;
+        REQUIRE(freeRegions == 4); // 699 @ 301, 10 @ 1300, 5 @ 1625, tail
+        
+        // Free all: Everything merges back into one node
+        allocator.free(b);
+        allocator.free(d);
+        allocator.free(f);
+        allocator.free(g);
+        allocator.free(h);
+        allocator.free(i);
+        
+        OffsetAllocator::StorageReport report = allocator.storageReport();
+        REQUIRE(report.totalFreeSpace == 1024 * 1024 * 256);
+        REQUIRE(report.largestFreeRegion == 1024 * 1024 * 256);
+        
+        OffsetAllocator::Allocation all = allocator.allocate(1024 * 1024 * 256);
+        REQUIRE(all.offset == 0);
+        REQUIRE(allocator.allocate(1).offset == OffsetAllocator::Allocation::NO_SPACE);
+        allocator.free(all);
+
+        SECTION("random")
+        {
+            // Brute force reference: Scan an occupancy map for the smallest gap that fits, lowest offset first
+            const uint32 poolSize = 16 * 1024;
+            OffsetAllocator::BestFitAllocator random(poolSize, 256);
+            std::vector<bool> occupied(poolSize, false);
+            OffsetAllocator::Allocation slots[32] = {};
+            uint32 mismatches = 0;
+            uint32 seed = 12345;
+            for (uint32 op = 0; op < 4000; op++)
+            {
+                seed = seed * 1664525 + 1013904223;
+                OffsetAllocator::Allocation& slot = slots[(seed >> 8) % 32];
+                if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE)
+                {
+                    uint32 size = random.allocationSize(slot);
+                    for (uint32 j = 0; j < size; j++) occupied[slot.offset + j] = false;
+                    random.free(slot);
+                    slot = {};
+                }
+
+                seed = seed * 1664525 + 1013904223;
+                uint32 size = 1 + (seed >> 8) % 1024;
+                uint32 bestOffset = OffsetAllocator::Allocation::NO_SPACE;
+                uint32 bestSize = 0xffffffff;
+                for (uint32 gapStart = 0; gapStart < poolSize; )
+                {
+                    uint32 gapEnd = gapStart;
+                    while (gapEnd < poolSize && !occupied[gapEnd]) gapEnd++;
+                    if (gapEnd - gapStart >= size && gapEnd - gapStart < bestSize)
+                    {
+                        bestOffset = gapStart;
+                        bestSize = gapEnd - gapStart;
+                    }
+                    gapStart = gapEnd + 1;
+                }
+
+                slot = random.allocate(size);
+                if (slot.offset != bestOffset) mismatches++;
+                if (slot.offset != OffsetAllocator::Allocation::NO_SPACE)
+                {
+                    for (uint32 j = 0; j < size; j++) occupied[slot.offset + j] = true;
+                }
+            }
+            REQUIRE(mismatches == 0);
+        }
+    }
+
+    TEST_CASE("best fit benchmark", "[offsetAllocator][!benchmark]")
+    {
+        // Long lived pool churn: Random sizes (64..64K), random frees, pool kept ~75% full
+        const uint32 poolSize = 256 * 1024 * 1024;
+        const uint32 slotCount = 6144;
+        
+        auto churn = [](auto& allocator, std::vector<OffsetAllocator::Allocation>& slots, uint32 operations)
+        {
+            uint32 rng = 12345;
+            uint32 failures = 0;
+            for (uint32 op = 0; op < operations; op++)
+            {
+                rng = rng * 1664525 + 1013904223;
+                OffsetAllocator::Allocation& slot = slots[(rng >> 8) % slots.size()];
+                if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE)
+                {
+                    allocator.free(slot);
+                    slot = {};
+                }
+                rng = rng * 1664525 + 1013904223;
+                slot = allocator.allocate(64 + (rng >> 8) % (64 * 1024));
+                if (slot.offset == OffsetAllocator::Allocation::NO_SPACE) failures++;
+            }
+            return failures;
+        };
+        
+        std::vector<OffsetAllocator::Allocation> slots(slotCount);
+        BENCHMARK("binned 100K churn")
+        {
+            OffsetAllocator::Allocator allocator(poolSize);
+            slots.assign(slotCount, {});
+            return churn(allocator, slots, 100000);
+        };
+        BENCHMARK("best fit 100K churn")
+        {
+            OffsetAllocator::BestFitAllocator allocator(poolSize);
+            slots.assign(slotCount, {});
+            return churn(allocator, slots, 100000);
+        };
+    }
+
+    TEST_CASE("placement", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1000);
+        OffsetAllocator::Allocation a = allocator.allocate(100);
+        OffsetAllocator::Allocation b = allocator.allocate(200, OffsetAllocator::PLACE_HIGH);
+        OffsetAllocator::Allocation c = allocator.allocate(300);
+        REQUIRE(a.offset == 0);
+        REQUIRE(b.offset == 800);
+        REQUIRE(c.offset == 100);
+        REQUIRE(allocator.validate());
+        
+        // High end allocation merges back like any other
+        allocator.free(b);
+        REQUIRE(allocator.validate());
+        REQUIRE(allocator.storageReport().totalFreeSpace == 600);
+        allocator.free(a);
+        allocator.free(c);
+        REQUIRE(allocator.validate());
+        
+        uint32 regionCount = 0;
+        allocator.visitRegions([](void* userData, const OffsetAllocator::Region&) { (*(uint32*)userData)++; }, &regionCount);
+        REQUIRE(regionCount == 1);
+    }
+
+    TEST_CASE("lifetime placement", "[offsetAllocator]")
+    {
+        OffsetAllocator::LifetimeAllocator allocator(1024 * 1024, 1024, 8);
+        REQUIRE(allocator.predictedLifetime(256, 1) == OffsetAllocator::Allocation::NO_SPACE);
+        
+        // Train: Site 1 dies immediately, site 2 lives long
+        OffsetAllocator::Allocation longLived[16];
+        for (uint32 i = 0; i < 16; i++)
+        {
+            longLived[i] = allocator.allocate(256, 2);
+            allocator.free(allocator.allocate(256, 1));
+        }
+        for (uint32 i = 0; i < 16; i++) allocator.free(longLived[i]);
+        REQUIRE(allocator.predictedLifetime(256, 1) == 1);
+        REQUIRE(allocator.predictedLifetime(256, 2) >= 8);
+        
+        // Short lived go to the high end of the free node, long lived to the low end
+        OffsetAllocator::Allocation shortLived = allocator.allocate(256, 1);
+        OffsetAllocator::Allocation longLivedNew = allocator.allocate(256, 2);
+        REQUIRE(shortLived.offset == 1024 * 1024 - 256);
+        REQUIRE(longLivedNew.offset == 0);
+        allocator.free(shortLived);
+        allocator.free(longLivedNew);
+        REQUIRE(allocator.allocator().validate());
+    }
+
+    TEST_CASE("batch free", "[offsetAllocator]")
+    {
+        // Batch free must produce the same layout as freeing one by one
+        OffsetAllocator::Allocator batched(1024 * 1024, 1024);
+        OffsetAllocator::Allocator sequential(1024 * 1024, 1024);
+        batched.enableStateHash(true);
+        sequential.enableStateHash(true);
+        std::vector<OffsetAllocator::Allocation> batchedAllocations, sequentialAllocations;
+        
+        uint32 rng = 1;
+        for (uint32 i = 0; i < 500; i++)
+        {
+            rng = rng * 1664525 + 1013904223;
+            uint32 size = 1 + (rng >> 8) % 1000;
+            batchedAllocations.push_back(batched.allocate(size));
+            sequentialAllocations.push_back(sequential.allocate(size));
+        }
+        REQUIRE(batched.stateHash() == sequential.stateHash());
+        
+        // Free every allocation with a set bit: Contiguous runs and isolated holes
+        std::vector<OffsetAllocator::Allocation> batch;
+        for (uint32 i = 0; i < 500; i++)
+        {
+            rng = rng * 1664525 + 1013904223;
+            if ((rng >> 16) & 1)
+            {
+                batch.push_back(batchedAllocations[i]);
+                sequential.free(sequentialAllocations[i]);
+                batchedAllocations[i] = {};
+                sequentialAllocations[i] = {};
+            }
+        }
+        batched.free(batch.data(), (uint32)batch.size());
+        REQUIRE(batched.validate());
+        REQUIRE(batched.stateHash() == sequential.stateHash());
+        REQUIRE(batched.storageReport().totalFreeSpace == sequential.storageReport().totalFreeSpace);
+        
+        // Rest in reverse order
+        batch.clear();
+        for (uint32 i = 500; i-- > 0;)
+        {
+            if (batchedAllocations[i].metadata != OffsetAllocator::Allocation::NO_SPACE) batch.push_back(batchedAllocations[i]);
+        }
+        batched.free(batch.data(), (uint32)batch.size());
+        REQUIRE(batched.validate());
+        
+        uint32 regionCount = 0;
+        batched.visitRegions([](void* userData, const OffsetAllocator::Region&) { (*(uint32*)userData)++; }, &regionCount);
+        REQUIRE(regionCount == 1);
+    }
+
+    TEST_CASE("flat combining", "[offsetAllocator]")
+    {
+        OffsetAllocator::FlatCombiningAllocator allocator(1024 * 1024 * 16, 64 * 1024, 8);
+        
+        // Every thread keeps a window of live allocations and checks that they stay exclusively its own
+        const uint32 threadCount = 4;
+        std::vector<uint32> owner(1024 * 1024 * 16 / 256, 0);
+        std::vector<std::thread> threads;
+        std::atomic<uint32> errors(0);
+        for (uint32 t = 0; t < threadCount; t++)
+        {
+            threads.emplace_back([&allocator, &owner, &errors, t]()
+            {
+                OffsetAllocator::Allocation live[16];
+                uint32 rng = t + 1;
+                for (uint32 i = 0; i < 20000; i++)
+                {
+                    OffsetAllocator::Allocation& slot = live[i % 16];
+                    if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE)
+                    {
+                        if (owner[slot.offset / 256] != t + 1) errors++;
+                        owner[slot.offset / 256] = 0;
+                        allocator.free(slot);
+                    }
+                    rng = rng * 1664525 + 1013904223;
+                    slot = allocator.allocate(256 * (1 + (rng >> 8) % 64));
+                    if (slot.offset == OffsetAllocator::Allocation::NO_SPACE)
+                    {
+                        errors++;
+                        continue;
+                    }
+                    owner[slot.offset / 256] = t + 1;
+                }
+                for (OffsetAllocator::Allocation& slot : live)
+                {
+                    if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE) allocator.free(slot);
+                }
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+        
+        REQUIRE(errors == 0);
+        REQUIRE(allocator.allocator().validate());
+        REQUIRE(allocator.allocator().storageReport().totalFreeSpace == 1024 * 1024 * 16);
+    }
+
+    TEST_CASE("concurrent", "[offsetAllocator]")
+    {
+        const uint32 size = 1024 * 1024 * 16;
+        OffsetAllocator::ConcurrentAllocator allocator(size, 64 * 1024);
+        
+        // Every thread keeps a window of live allocations and checks that they stay exclusively its own
+        const uint32 threadCount = 4;
+        std::vector<std::atomic<uint32>> owner(size / 256);
+        std::vector<std::thread> threads;
+        std::atomic<uint32> errors(0);
+        for (uint32 t = 0; t < threadCount; t++)
+        {
+            threads.emplace_back([&allocator, &owner, &errors, t]()
+            {
+                OffsetAllocator::Allocation live[16];
+                uint32 rng = t + 1;
+                for (uint32 i = 0; i < 20000; i++)
+                {
+                    OffsetAllocator::Allocation& slot = live[i % 16];
+                    if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE)
+                    {
+                        if (owner[slot.offset / 256].exchange(0) != t + 1) errors++;
+                        allocator.free(slot);
+                    }
+                    rng = rng * 1664525 + 1013904223;
+                    slot = allocator.allocate(256 * (1 + (rng >> 8) % 64));
+                    if (slot.offset == OffsetAllocator::Allocation::NO_SPACE)
+                    {
+                        errors++;
+                        continue;
+                    }
+                    if (owner[slot.offset / 256].exchange(t + 1) != 0) errors++;
+                }
+                for (OffsetAllocator::Allocation& slot : live)
+                {
+                    if (slot.metadata == OffsetAllocator::Allocation::NO_SPACE) continue;
+                    owner[slot.offset / 256] = 0;
+                    allocator.free(slot);
+                }
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+        
+        REQUIRE(errors == 0);
+        
+        // Everything merged back into one node
+        REQUIRE(allocator.storageReport().totalFreeSpace == size);
+        OffsetAllocator::Allocation all = allocator.allocate(size);
+        REQUIRE(all.offset == 0);
+        allocator.free(all);
+    }
+
+    TEST_CASE("concurrent benchmark", "[offsetAllocator][!benchmark]")
+    {
+        // Contended mixed size churn: Global mutex vs flat combining vs fine grained locking
+        const uint32 threadCount = 8;
+        const uint32 operations = 100000;
+        
+        auto run = [](auto allocate, auto free)
+        {
+            std::vector<std::thread> threads;
+            for (uint32 t = 0; t < threadCount; t++)
+            {
+                threads.emplace_back([&allocate, &free, t]()
+                {
+                    OffsetAllocator::Allocation live[32];
+                    uint32 rng = t + 1;
+                    for (uint32 i = 0; i < operations; i++)
+                    {
+                        OffsetAllocator::Allocation& slot = live[i % 32];
+                        if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE) free(slot);
+                        rng = rng * 1664525 + 1013904223;
+                        slot = allocate(16 + (rng >> 8) % 4096);
+                    }
+                    for (OffsetAllocator::Allocation& slot : live)
+                    {
+                        if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE) free(slot);
+                    }
+                });
+            }
+            for (std::thread& thread : threads) thread.join();
+        };
+        
+        OffsetAllocator::Allocator allocator(1024 * 1024 * 256);
+        std::mutex mutex;
+        BENCHMARK("global mutex 8 threads")
+        {
+            run([&](uint32 size) { std::lock_guard<std::mutex> lock(mutex); return allocator.allocate(size); },
+                [&](OffsetAllocator::Allocation allocation) { std::lock_guard<std::mutex> lock(mutex); allocator.free(allocation); });
+        };
+        
+        OffsetAllocator::FlatCombiningAllocator combining(1024 * 1024 * 256);
+        BENCHMARK("flat combining 8 threads")
+        {
+            run([&](uint32 size) { return combining.allocate(size); },
+                [&](OffsetAllocator::Allocation allocation) { combining.free(allocation); });
+        };
+        
+        OffsetAllocator::ConcurrentAllocator concurrent(1024 * 1024 * 256);
+        BENCHMARK("fine grained 8 threads")
+        {
+            run([&](uint32 size) { return concurrent.allocate(size); },
+                [&](OffsetAllocator::Allocation allocation) { concurrent.free(allocation); });
+        };
+    }
+
+    TEST_CASE("sequenced", "[offsetAllocator]")
+    {
+        // Thread t owns sequences t, t + 4, ... Even rounds allocate, odd rounds free the previous allocation.
+        const uint32 threadCount = 4;
+        const uint32 rounds = 2000;
+        
+        auto run = [](uint32 scheduleSeed)
+        {
+            OffsetAllocator::SequencedAllocator allocator(1024 * 1024, 16 * 1024, 64);
+            std::vector<OffsetAllocator::Allocation> results(threadCount * rounds);
+            std::vector<std::thread> threads;
+            for (uint32 t = 0; t < threadCount; t++)
+            {
+                threads.emplace_back([&allocator, &results, scheduleSeed, t]()
+                {
+                    uint32 rng = scheduleSeed * 31 + t;
+                    OffsetAllocator::Allocation live;
+                    for (uint32 round = 0; round < rounds; round++)
+                    {
+                        // Perturb scheduling: Placement must not depend on it
+                        rng = rng * 1664525 + 1013904223;
+                        if ((rng >> 28) == 0) std::this_thread::yield();
+                        
+                        uint64 sequence = (uint64)round * threadCount + t;
+                        if (round & 1)
+                        {
+                            allocator.free(sequence, live);
+                        }
+                        else
+                        {
+                            live = allocator.allocate(sequence, 1 + (uint32)(sequence * 2654435761u % 4096));
+                            results[sequence] = live;
+                        }
+                    }
+                });
+            }
+            for (std::thread& thread : threads) thread.join();
+            REQUIRE(allocator.allocator().validate());
+            REQUIRE(allocator.allocator().storageReport().totalFreeSpace == 1024 * 1024);
+            return results;
+        };
+        
+        // Reference: Same requests single threaded in sequence order
+        OffsetAllocator::Allocator reference(1024 * 1024, 16 * 1024);
+        std::vector<OffsetAllocator::Allocation> expected(threadCount * rounds);
+        for (uint64 sequence = 0; sequence < threadCount * rounds; sequence++)
+        {
+            if ((sequence / threadCount) & 1)
+                reference.free(expected[sequence - threadCount]);
+            else
+                expected[sequence] = reference.allocate(1 + (uint32)(sequence * 2654435761u % 4096));
+        }
+        
+        for (uint32 seed = 0; seed < 3; seed++)
+        {
+            std::vector<OffsetAllocator::Allocation> results = run(seed);
+            bool identical = true;
+            for (uint32 i = 0; i < threadCount * rounds; i++)
+            {
+                identical &= results[i].offset == expected[i].offset && results[i].metadata == expected[i].metadata;
+            }
+            REQUIRE(identical);
+        }
+    }
+
+    TEST_CASE("prewarm", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024);
+        auto regionCount = [&allocator]()
+        {
+            uint32 count = 0;
+            allocator.visitRegions([](void* userData, const OffsetAllocator::Region&) { (*(uint32*)userData)++; }, &count);
+            return count;
+        };
+        
+        // 100 and 1000 are not bin sizes: Normal allocation would round up and split
+        const uint32 sizes[] = {100, 256, 1000};
+        const uint32 counts[] = {10, 5, 2};
+        REQUIRE(allocator.prewarm(sizes, counts, 3) == 17);
+        REQUIRE(allocator.validate());
+        REQUIRE(regionCount() == 18);
+        REQUIRE(allocator.storageReport().totalFreeSpace == 1024 * 1024);
+        
+        // Exact fits: No split
+        OffsetAllocator::Allocation a = allocator.allocate(100);
+        OffsetAllocator::Allocation b = allocator.allocate(1000);
+        OffsetAllocator::Allocation c = allocator.allocate(256);
+        REQUIRE(regionCount() == 18);
+        REQUIRE(allocator.allocationSize(a) == 100);
+        REQUIRE(b.offset < 100 * 10 + 256 * 5 + 1000 * 2);
+        REQUIRE(allocator.validate());
+        
+        // Unwarm coalesces the unused prewarmed nodes around the live ones
+        allocator.unwarm();
+        REQUIRE(allocator.validate());
+        REQUIRE(regionCount() <= 7);
+        
+        allocator.free(a);
+        allocator.free(b);
+        allocator.free(c);
+        REQUIRE(regionCount() == 1);
+        REQUIRE(allocator.validate());
+
+        SECTION("no side effects")
+        {
+            // Carving is not an allocation: No stats, tags, sequence numbers or hash changes
+            OffsetAllocator::Allocator instrumented(1024 * 1024);
+            instrumented.enableAllocationStats(true);
+            instrumented.enableAllocationTags(true);
+            instrumented.enableStateHash(true);
+            OffsetAllocator::Allocation live = instrumented.allocate(5000);
+            OffsetAllocator::uint64 hash = instrumented.stateHash();
+            OffsetAllocator::AllocationStats stats = *instrumented.allocationStats();
+            
+            // Reserved storage doesn't block carving. Carved nodes stay free.
+            OffsetAllocator::Reservation reservation = instrumented.reserve(1000 * 1024, 16);
+            REQUIRE(reservation.size != OffsetAllocator::Allocation::NO_SPACE);
+            REQUIRE(instrumented.prewarm(sizes, counts, 3) == 17);
+            REQUIRE(instrumented.stateHash() == hash);
+            REQUIRE(memcmp(instrumented.allocationStats(), &stats, sizeof(stats)) == 0);
+            REQUIRE(instrumented.storageReport().totalFreeSpace == 1024 * 1024 - 5000);
+            
+            OffsetAllocator::Allocation next = instrumented.allocate(100, reservation);
+            const OffsetAllocator::AllocationTag* tags = instrumented.allocationTags();
+            REQUIRE(tags[next.metadata].sequence == tags[live.metadata].sequence + 1);
+            instrumented.unreserve(reservation);
+            REQUIRE(instrumented.validate());
+        }
+    }
+
+    TEST_CASE("bulk load", "[offsetAllocator]")
+    {
+        // Same layout built by allocating and by bulk loading must match
+        OffsetAllocator::Allocator reference(1024 * 1024, 1024);
+        reference.enableStateHash(true);
+        std::vector<OffsetAllocator::Allocation> referenceAllocations;
+        for (uint32 i = 0; i < 100; i++) referenceAllocations.push_back(reference.allocate(100 + i * 10));
+        for (uint32 i = 0; i < 100; i += 3) reference.free(referenceAllocations[i]);
+        
+        std::vector<OffsetAllocator::AllocationRange> ranges;
+        for (uint32 i = 0; i < 100; i++)
+        {
+            if (i % 3 == 0) continue;
+            ranges.push_back({.offset = referenceAllocations[i].offset, .size = 100 + i * 10});
+        }
+        
+        std::vector<OffsetAllocator::Allocation> allocations(ranges.size());
+        OffsetAllocator::Allocator allocator(1024 * 1024, 1024, ranges.data(), (uint32)ranges.size(), allocations.data());
+        REQUIRE(allocator.validate());
+        allocator.enableStateHash(true);
+        REQUIRE(allocator.stateHash() == reference.stateHash());
+        REQUIRE(allocator.storageReport().totalFreeSpace == reference.storageReport().totalFreeSpace);
+        REQUIRE(allocations[0].offset == referenceAllocations[1].offset);
+        REQUIRE(allocator.allocationSize(allocations[0]) == 110);
+        
+        // Fully functional: Free everything, one node remains
+        for (OffsetAllocator::Allocation allocation : allocations) allocator.free(allocation);
+        REQUIRE(allocator.validate());
+        REQUIRE(allocator.storageReport().totalFreeSpace == 1024 * 1024);
+        
+        SECTION("empty")
+        {
+            OffsetAllocator::Allocator empty(1024, 16, nullptr, 0);
+            REQUIRE(empty.validate());
+            REQUIRE(empty.allocate(1024).offset == 0);
+        }
+        
+        SECTION("invalid")
+        {
+            // Overlapping, unsorted, out of bounds and too many nodes: Empty allocator, NO_SPACE handles
+            const OffsetAllocator::AllocationRange overlapping[] = {{.offset = 0, .size = 100}, {.offset = 50, .size = 100}};
+            const OffsetAllocator::AllocationRange unsorted[] = {{.offset = 500, .size = 100}, {.offset = 0, .size = 100}};
+            const OffsetAllocator::AllocationRange outOfBounds[] = {{.offset = 1000, .size = 0xffffff00}};
+            const OffsetAllocator::AllocationRange gaps[] = {{.offset = 100, .size = 10}, {.offset = 200, .size = 10}, {.offset = 300, .size = 10}};
+            const OffsetAllocator::AllocationRange* layouts[] = {overlapping, unsorted, outOfBounds, gaps};
+            const uint32 counts[] = {2, 2, 1, 3};
+            for (uint32 i = 0; i < 4; i++)
+            {
+                OffsetAllocator::Allocation out[3] = {{.offset = 1, .metadata = 1}, {.offset = 1, .metadata = 1}, {.offset = 1, .metadata = 1}};
+                
+                // Gaps layout: 3 used + 3 gaps + tail = 7 nodes, 7 available with maxAllocs 8 -> fits with 8, not 7
+                OffsetAllocator::Allocator invalid(1024, 7, layouts[i], counts[i], out);
+                REQUIRE(invalid.validate());
+                REQUIRE(invalid.storageReport().totalFreeSpace == 1024);
+                invalid.enableStateHash(true);
+                REQUIRE(invalid.stateHash() == 0);
+                for (uint32 j = 0; j < counts[i]; j++) REQUIRE(out[j].offset == OffsetAllocator::Allocation::NO_SPACE);
+                REQUIRE(invalid.allocate(1024).offset == 0);
+            }
+            
+            OffsetAllocator::Allocation out[3];
+            OffsetAllocator::Allocator exact(1024, 8, gaps, 3, out);
+            REQUIRE(exact.validate());
+            REQUIRE(out[2].offset == 300);
+            REQUIRE(exact.allocationSize(out[2]) == 10);
+        }
+    }
+
+    TEST_CASE("bulk load benchmark", "[offsetAllocator][!benchmark]")
+    {
+        // 10M live allocations (1..16 elements), a gap after every 16th
+        const uint32 count = 10 * 1000 * 1000;
+        std::vector<OffsetAllocator::AllocationRange> ranges(count);
+        uint32 cursor = 0;
+        for (uint32 i = 0; i < count; i++)
+        {
+            uint32 size = 1 + (i * 2654435761u >> 28);
+            ranges[i] = {.offset = cursor, .size = size};
+            cursor += size + ((i & 15) == 15 ? 8 : 0);
+        }
+        const uint32 size = cursor + 1024;
+        const uint32 maxAllocs = count + count / 16 + 16;
+        
+        BENCHMARK("bulk load 10M")
+        {
+            OffsetAllocator::Allocator allocator(size, maxAllocs, ranges.data(), count);
+            return allocator.storageReport().totalFreeSpace;
+        };
+        
+        // Baseline: Allocate everything including the gaps, then free the gaps
+        BENCHMARK("allocate + free gaps 10M")
+        {
+            OffsetAllocator::Allocator allocator(size, maxAllocs);
+            std::vector<OffsetAllocator::Allocation> gaps;
+            gaps.reserve(count / 16);
+            for (uint32 i = 0; i < count; i++)
+            {
+                allocator.allocate(ranges[i].size);
+                if ((i & 15) == 15) gaps.push_back(allocator.allocate(8));
+            }
+            for (OffsetAllocator::Allocation gap : gaps) allocator.free(gap);
+            return allocator.storageReport().totalFreeSpace;
+        };
+    }
+
+    TEST_CASE("snapshot diff", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024);
+        REQUIRE(allocator.allocationTags() == nullptr);
+        allocator.enableAllocationTags(true);
+        
+        allocator.setCurrentTag(1);
+        OffsetAllocator::Allocation a = allocator.allocate(1024);
+        OffsetAllocator::Allocation b = allocator.allocate(2048);
+        allocator.setCurrentTag(2);
+        OffsetAllocator::Allocation c = allocator.allocate(4096);
+        REQUIRE(allocator.allocationTags()[b.metadata].tag == 1);
+        REQUIRE(allocator.allocationTags()[c.metadata].sequence > allocator.allocationTags()[b.metadata].sequence);
+        
+        OffsetAllocator::Snapshot before = OffsetAllocator::captureSnapshot(allocator);
+        REQUIRE(before.entries.size() == 3);
+        
+        // a: Freed and reallocated at the same offset with the same tag (removed + added). c: Freed. d: New.
+        allocator.free(a);
+        allocator.setCurrentTag(1);
+        OffsetAllocator::Allocation a2 = allocator.allocate(1024);
+        REQUIRE(a2.offset == a.offset);
+        allocator.free(c);
+        allocator.setCurrentTag(3);
+        OffsetAllocator::Allocation d = allocator.allocate(100);
+        allocator.setAllocationTag(d, 4);
+        
+        OffsetAllocator::Snapshot after = OffsetAllocator::captureSnapshot(allocator);
+        OffsetAllocator::SnapshotDiff diff = OffsetAllocator::diffSnapshots(before, after);
+        REQUIRE(diff.added.size() == 2);
+        REQUIRE((diff.added[0].offset == a.offset && diff.added[0].size == 1024 && diff.added[0].tag == 1));
+        REQUIRE((diff.added[1].size == 100 && diff.added[1].tag == 4));
+        REQUIRE(diff.removed.size() == 2);
+        REQUIRE((diff.removed[0].offset == a.offset && diff.removed[0].size == 1024));
+        REQUIRE((diff.removed[1].size == 4096 && diff.removed[1].tag == 2));
+        REQUIRE(diff.resized.empty());
+        
+        // Groups sorted by (tag, size class)
+        REQUIRE(diff.groups.size() == 3);
+        REQUIRE((diff.groups[0].tag == 1 && diff.groups[0].addedCount == 1 && diff.groups[0].removedCount == 1));
+        REQUIRE((diff.groups[1].tag == 2 && diff.groups[1].removedBytes == 4096));
+        REQUIRE((diff.groups[2].tag == 4 && diff.groups[2].addedBytes == 100));
+        REQUIRE(diff.groups[2].sizeClass == OffsetAllocator::SmallFloat::uintToFloatRoundUp(100));
+        
+        // Unchanged heap: Empty diff
+        REQUIRE(OffsetAllocator::diffSnapshots(after, after).groups.empty());
+        
+        // Same sequence and offset with a new size: Resize
+        OffsetAllocator::Snapshot shrunk = after;
+        shrunk.entries[0].size = 512;
+        diff = OffsetAllocator::diffSnapshots(after, shrunk);
+        REQUIRE((diff.added.empty() && diff.removed.empty()));
+        REQUIRE(diff.resized.size() == 1);
+        REQUIRE((diff.resized[0].before.size == after.entries[0].size && diff.resized[0].after.size == 512));
+        REQUIRE((diff.groups.size() == 1 && diff.groups[0].resizedCount == 1));
+        REQUIRE(diff.groups[0].resizedBytes == 512 - (long long)after.entries[0].size);
+        
+        allocator.free(a2);
+        allocator.free(b);
+        allocator.free(d);
+    }
+
+    TEST_CASE("compact metadata", "[offsetAllocator]")
+    {
+        // Load spike: 4096 nodes, keep every 64th allocation
+        OffsetAllocator::Allocator allocator(1024 * 1024 * 16, 8192);
+        allocator.enableStateHash(true);
+        std::vector<OffsetAllocator::Allocation> allocations;
+        for (uint32 i = 0; i < 4096; i++) allocations.push_back(allocator.allocate(1000));
+        std::vector<OffsetAllocator::Allocation> kept;
+        for (uint32 i = 0; i < 4096; i++)
+        {
+            if (i % 64 == 63) kept.push_back(allocations[i]);
+            else allocator.free(allocations[i]);
+        }
+        uint64 hash = allocator.stateHash();
+        
+        // Too small for the live nodes
+        REQUIRE(!allocator.compactMetadata(16));
+        REQUIRE(allocator.maxAllocs() == 8192);
+        
+        std::vector<OffsetAllocator::NodeIndex> oldToNew(8192);
+        REQUIRE(allocator.compactMetadata(256, oldToNew.data()));
+        REQUIRE(allocator.maxAllocs() == 256);
+        REQUIRE(allocator.validate());
+        REQUIRE(allocator.stateHash() == hash);
+        for (OffsetAllocator::Allocation& allocation : kept)
+        {
+            allocation.metadata = oldToNew[allocation.metadata];
+            REQUIRE(allocation.metadata < 256);
+            REQUIRE(allocator.allocationSize(allocation) == 1000);
+        }
+        
+        // Fully functional in the smaller node array
+        OffsetAllocator::Allocation extra = allocator.allocate(5000);
+        REQUIRE(extra.offset != OffsetAllocator::Allocation::NO_SPACE);
+        allocator.free(extra);
+        for (OffsetAllocator::Allocation allocation : kept) allocator.free(allocation);
+        REQUIRE(allocator.validate());
+        REQUIRE(allocator.storageReport().totalFreeSpace == 1024 * 1024 * 16);
+        
+        SECTION("handles")
+        {
+            OffsetAllocator::HandleTable table(1024 * 1024, 4096);
+            std::vector<OffsetAllocator::Handle> handles;
+            for (uint32 i = 0; i < 1000; i++) handles.push_back(table.allocate(256));
+            for (uint32 i = 0; i < 1000; i++) if (i % 10) table.free(handles[i]);
+            
+            REQUIRE(table.compactMetadata(256));
+            REQUIRE(table.allocator().validate());
+            for (uint32 i = 0; i < 1000; i += 10)
+            {
+                REQUIRE(table.allocator().allocationSize({.offset = table.offset(handles[i]), .metadata = table.resolve(handles[i]).metadata}) == 256);
+                table.free(handles[i]);
+            }
+            REQUIRE(table.allocator().storageReport().totalFreeSpace == 1024 * 1024);
+        }
+    }
+
+    TEST_CASE("lifetime histograms", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024 * 256);
+        REQUIRE(allocator.lifetimeHistogram() == nullptr);
+        allocator.enableLifetimeHistograms(true);
+        
+        uint32 small = OffsetAllocator::SmallFloat::uintToFloatRoundUp(64);
+        uint32 large = OffsetAllocator::SmallFloat::uintToFloatRoundUp(100000);
+        
+        // Freed right away: Lifetime 1 (bucket 1)
+        for (uint32 i = 0; i < 10; i++)
+        {
+            OffsetAllocator::Allocation a = allocator.allocate(64);
+            allocator.free(a);
+        }
+        REQUIRE(allocator.lifetimeHistogram()->counts[small][1] == 10);
+        
+        // Leaked: Shows up in the live ages only. 100 allocations later: Age 101 (bucket 6)
+        OffsetAllocator::Allocation leak = allocator.allocate(100000);
+        std::vector<OffsetAllocator::Allocation> batch;
+        for (uint32 i = 0; i < 100; i++) batch.push_back(allocator.allocate(64));
+        
+        OffsetAllocator::LifetimeHistogram ages;
+        allocator.ageHistogram(ages);
+        REQUIRE(ages.counts[large][6] == 1);
+        uint64 liveSmall = 0;
+        for (uint32 b = 0; b < OffsetAllocator::LifetimeHistogram::NUM_BUCKETS; b++) liveSmall += ages.counts[small][b];
+        REQUIRE(liveSmall == 100);
+        
+        // Batch free records lifetimes too: 100..1 -> buckets 0..6
+        allocator.free(batch.data(), (uint32)batch.size());
+        uint64 freedSmall = 0;
+        for (uint32 b = 0; b < OffsetAllocator::LifetimeHistogram::NUM_BUCKETS; b++) freedSmall += allocator.lifetimeHistogram()->counts[small][b];
+        REQUIRE(freedSmall == 110);
+        REQUIRE(allocator.lifetimeHistogram()->counts[large][6] == 0);
+        
+        allocator.free(leak);
+        REQUIRE(allocator.lifetimeHistogram()->counts[large][6] == 1);
+        
+        REQUIRE(OffsetAllocator::LifetimeHistogram::bucket(0) == 0);
+        REQUIRE(OffsetAllocator::LifetimeHistogram::bucket(~0ull - 1) == OffsetAllocator::LifetimeHistogram::NUM_BUCKETS - 1);
+    }
+
+    TEST_CASE("registry", "[offsetAllocator]")
+    {
+        OffsetAllocator::RegistryReport report;
+        OffsetAllocator::registryReport(report);
+        uint32 baseCount = report.allocatorCount;
+        
+        {
+            OffsetAllocator::Allocator textures(1024 * 1024, 1024, "textures");
+            OffsetAllocator::Allocator meshes(2048 * 1024, 1024, "meshes");
+            OffsetAllocator::Allocator unnamed(4096);
+            REQUIRE(strcmp(textures.name(), "textures") == 0);
+            REQUIRE(unnamed.name() == nullptr);
+            
+            OffsetAllocator::Allocation a = textures.allocate(1000);
+            OffsetAllocator::registryReport(report);
+            REQUIRE(report.allocatorCount == baseCount + 2);
+            REQUIRE(report.allocators.size() == baseCount + 2);
+            REQUIRE(strcmp(report.allocators[0].name, "meshes") == 0);
+            REQUIRE(report.allocators[1].totalFreeSpace == textures.storageReport().totalFreeSpace);
+            REQUIRE(report.allocators[1].largestFreeRegion == textures.storageReport().largestFreeRegion);
+            REQUIRE(report.allocators[1].usedNodes == 2);
+            REQUIRE(report.totalSize >= 3072 * 1024);
+            
+            // Explicit registration + move keeps the registration with the state
+            OffsetAllocator::registerAllocator(&unnamed, "scratch");
+            OffsetAllocator::Allocator moved(static_cast<OffsetAllocator::Allocator&&>(textures));
+            REQUIRE(textures.name() == nullptr);
+            REQUIRE(strcmp(moved.name(), "textures") == 0);
+            OffsetAllocator::registryReport(report);
+            REQUIRE(report.allocatorCount == baseCount + 3);
+            
+            moved.free(a);
+        }
+        
+        // Destructors unregister
+        OffsetAllocator::registryReport(report);
+        REQUIRE(report.allocatorCount == baseCount);
+        
+        SECTION("concurrent sampling")
+        {
+            // Owner keeps allocating while another thread samples. Idle owner -> exact figures.
+            OffsetAllocator::Allocator owner(1024 * 1024, 1024, "owner");
+            std::atomic<bool> done(false);
+            std::thread sampler([&done]()
+            {
+                OffsetAllocator::RegistryReport sampled;
+                while (!done) OffsetAllocator::registryReport(sampled);
+            });
+            
+            OffsetAllocator::Allocation allocations[64] = {};
+            uint32 seed = 12345;
+            for (uint32 i = 0; i < 20000; i++)
+            {
+                seed = seed * 1664525 + 1013904223;
+                OffsetAllocator::Allocation& allocation = allocations[(seed >> 8) % 64];
+                if (allocation.metadata != OffsetAllocator::Allocation::NO_SPACE) owner.free(allocation);
+                allocation = owner.allocate(1 + (seed >> 16) % 4096);
+            }
+            done = true;
+            sampler.join();
+            
+            OffsetAllocator::registryReport(report);
+            REQUIRE(report.allocators[0].totalFreeSpace == owner.storageReport().totalFreeSpace);
+            REQUIRE(report.allocators[0].largestFreeRegion == owner.storageReport().largestFreeRegion);
+            for (OffsetAllocator::Allocation& allocation : allocations)
+            {
+                if (allocation.metadata != OffsetAllocator::Allocation::NO_SPACE) owner.free(allocation);
+            }
+        }
+    }
+
+    TEST_CASE("heap dump", "[offsetAllocator]")
+    {
+        OffsetAllocator::Allocator allocator(1024 * 1024, 1024);
+        std::vector<OffsetAllocator::Allocation> allocations;
+        for (uint32 i = 0; i < 64; i++) allocations.push_back(allocator.allocate(1000 + i));
+        for (uint32 i = 0; i < 64; i += 2) allocator.free(allocations[i]);
+        
+        OffsetAllocator::HeapDump captured;
+        REQUIRE(OffsetAllocator::captureHeapDump(allocator, captured));
+        
+        // File round trip
+        FILE* file = tmpfile();
+        REQUIRE(file);
+        REQUIRE(OffsetAllocator::writeHeapDump(captured, file));
+        rewind(file);
+        OffsetAllocator::HeapDump dump;
+        REQUIRE(OffsetAllocator::loadHeapDump(file, dump));
+        fclose(file);
+        REQUIRE(dump.nodes.size() == 1024);
+        
+        OffsetAllocator::HeapDumpAnalysis analysis = OffsetAllocator::analyzeHeapDump(dump, 64);
+        REQUIRE(analysis.errorCount == 0);
+        REQUIRE(analysis.usedCount == 32);
+        REQUIRE(analysis.freeCount == 33);
+        REQUIRE(analysis.freeBytes == allocator.storageReport().totalFreeSpace);
+        REQUIRE(analysis.largestAllocatable == allocator.storageReport().largestFreeRegion);
+        REQUIRE(analysis.alignedFits.size() == 7);
+        REQUIRE(analysis.alignedFits[0].largestSize == analysis.largestFreeSpan);
+        
+        // Every other allocation moves: All but the first used one (offset 1000 -> 0)
+        REQUIRE(analysis.compactionMoves == 32);
+        REQUIRE(analysis.compactedLargestFree == analysis.freeBytes);
+        
+        SECTION("corrupted header")
+        {
+            file = tmpfile();
+            REQUIRE(file);
+            REQUIRE(OffsetAllocator::writeHeapDump(captured, file));
+            std::vector<OffsetAllocator::uint8> bytes(ftell(file));
+            rewind(file);
+            REQUIRE(fread(bytes.data(), 1, bytes.size(), file) == bytes.size());
+            fclose(file);
+            
+            // Header: magic, version, size, maxAllocs, freeOffset. Huge maxAllocs, freelist cursor out of range, truncated.
+            auto load = [&](uint32 field, uint32 value, size_t truncate)
+            {
+                std::vector<OffsetAllocator::uint8> corrupted = bytes;
+                if (field) memcpy(&corrupted[field * 4], &value, 4);
+                FILE* corruptedFile = tmpfile();
+                fwrite(corrupted.data(), 1, corrupted.size() - truncate, corruptedFile);
+                rewind(corruptedFile);
+                OffsetAllocator::HeapDump loaded;
+                bool ok = OffsetAllocator::loadHeapDump(corruptedFile, loaded);
+                fclose(corruptedFile);
+                return ok;
+            };
+            REQUIRE(load(0, 0, 0));
+            REQUIRE(!load(3, 0x7fffffff, 0));
+            REQUIRE(!load(3, 1023, 0));
+            REQUIRE(!load(4, 1024, 0));
+            REQUIRE(!load(0, 0, 4));
+        }
+        
+        SECTION("corrupted")
+        {
+            // Bin mask disagrees with the bin list, broken neighbor link
+            uint32 bin = 0;
+            while (dump.binIndices[bin] == 0xffffffff) bin++;
+            dump.usedBins[bin >> OffsetAllocator::TOP_BINS_INDEX_SHIFT] &= ~(1 << (bin & OffsetAllocator::LEAF_BINS_INDEX_MASK));
+            dump.nodes[allocations[5].metadata].dataOffset += 16;
+            
+            OffsetAllocator::HeapDumpAnalysis corrupted = OffsetAllocator::analyzeHeapDump(dump);
+            REQUIRE(corrupted.errorCount >= 2);
+            REQUIRE(!corrupted.errors.empty());
+        }
+        
+        for (uint32 i = 1; i < 64; i += 2) allocator.free(allocations[i]);
+    }
+
+    TEST_CASE("large objects", "[offsetAllocator]")
+    {
+        // 1M elements small tier, 64 pages of 64K large tier, 256K threshold
+        OffsetAllocator::LargeObjectAllocator allocator(1024 * 1024, 64 * 65536, 256 * 1024);
+        
+        OffsetAllocator::Allocation small = allocator.allocate(1000);
+        REQUIRE(!allocator.isLarge(small));
+        REQUIRE(small.offset < 1024 * 1024);
+        
+        // Page rounded, first fit from the start of the large tier
+        OffsetAllocator::Allocation a = allocator.allocate(300 * 1024);
+        OffsetAllocator::Allocation b = allocator.allocate(1024 * 1024);
+        OffsetAllocator::Allocation c = allocator.allocate(512 * 1024);
+        REQUIRE(allocator.isLarge(a));
+        REQUIRE(a.offset == 1024 * 1024);
+        REQUIRE(allocator.allocationSize(a) == 5 * 65536);
+        REQUIRE(b.offset == a.offset + 5 * 65536);
+        REQUIRE(c.offset == b.offset + 16 * 65536);
+        REQUIRE(allocator.largeStorageReport().totalFreeSpace == (64 - 29) * 65536);
+        
+        // Large objects don't touch the small tier
+        REQUIRE(allocator.smallAllocator().storageReport().totalFreeSpace == 1024 * 1024 - 1000);
+        
+        // Freed hole is reused first fit, freed spans merge back into one
+        REQUIRE(allocator.free(b));
+        OffsetAllocator::Allocation d = allocator.allocate(400 * 1024);
+        REQUIRE(d.offset == b.offset);
+        
+        // Stale and forged handles are rejected: b is now the start of d (7 pages, not 16), mid run, double free
+        REQUIRE(!allocator.free(b));
+        REQUIRE(!allocator.free({.offset = d.offset + 65536, .metadata = 6}));
+        REQUIRE(!allocator.free({.offset = d.offset + 100, .metadata = 7}));
+        REQUIRE(allocator.free(a));
+        REQUIRE(!allocator.free(a));
+        REQUIRE(allocator.largeStorageReport().totalFreeSpace == (64 - 15) * 65536); // c + d live
+        REQUIRE(allocator.free(d));
+        REQUIRE(allocator.free(c));
+        REQUIRE(allocator.largeStorageReport().largestFreeRegion == 64 * 65536);
+        
+        // Tiers don't spill: Too large for the large tier fails, small tier full doesn't use large pages
+        REQUIRE(allocator.allocate(65 * 65536).offset == OffsetAllocator::Allocation::NO_SPACE);
+        std::vector<OffsetAllocator::Allocation> smallAllocations;
+        for (;;)
+        {
+            OffsetAllocator::Allocation allocation = allocator.allocate(200 * 1024);
+            if (allocation.offset == OffsetAllocator::Allocation::NO_SPACE) break;
+            REQUIRE(!allocator.isLarge(allocation));
+            smallAllocations.push_back(allocation);
+        }
+        REQUIRE(smallAllocations.size() >= 4);
+        REQUIRE(allocator.largeStorageReport().totalFreeSpace == 64 * 65536);
+        
+        for (OffsetAllocator::Allocation allocation : smallAllocations) allocator.free(allocation);
+        allocator.free(small);
+        REQUIRE(allocator.smallAllocator().storageReport().totalFreeSpace == 1024 * 1024);
+        
+        // Run page count past the metadata range: Rejected up front (16 bit node indices), never truncated
+        OffsetAllocator::LargeObjectAllocator unitPages(1024, 100000, 1, 1);
+        OffsetAllocator::Allocation huge = unitPages.allocate(70000);
+        if (70000 > OffsetAllocator::LargeObjectAllocator::MAX_RUN_PAGES)
+        {
+            REQUIRE(huge.offset == OffsetAllocator::Allocation::NO_SPACE);
+        }
+        else
+        {
+            REQUIRE(unitPages.allocationSize(huge) == 70000);
+            REQUIRE(unitPages.free(huge));
+            REQUIRE(unitPages.largeStorageReport().largestFreeRegion == 100000);
+        }
+    }
+
+    TEST_CASE("unit allocations", "[offsetAllocator]")
+    {
+        OffsetAllocator::UnitAllocator allocator(4096, 256);
+        
+        // 64 units share one chunk (one node)
+        std::vector<OffsetAllocator::Allocation> units;
+        for (uint32 i = 0; i < 64; i++) units.push_back(allocator.allocate(1));
+        REQUIRE(allocator.chunkCount() == 1);
+        for (uint32 i = 0; i < 64; i++)
+        {
+            REQUIRE(units[i].offset == units[0].offset + i);
+            REQUIRE(units[i].metadata == units[0].metadata);
+            REQUIRE(allocator.allocationSize(units[i]) == 1);
+        }
+        
+        // Multi unit requests use the binned path
+        OffsetAllocator::Allocation range = allocator.allocate(100);
+        REQUIRE(allocator.allocationSize(range) == 100);
+        REQUIRE(allocator.storageReport().totalFreeSpace == 4096 - 164);
+        
+        // Lowest free slot is reused
+        allocator.free(units[10]);
+        allocator.free(units[3]);
+        OffsetAllocator::Allocation reused = allocator.allocate(1);
+        REQUIRE(reused.offset == units[3].offset);
+        units[3] = reused;
+        
+        units.push_back(allocator.allocate(1));
+        REQUIRE(allocator.chunkCount() == 1);
+        REQUIRE(units.back().offset == units[10].offset);
+        units[10] = {};
+        units.push_back(allocator.allocate(1));
+        REQUIRE(allocator.chunkCount() == 2);
+        
+        // Free everything: One empty chunk is kept, the rest goes back to the allocator
+        allocator.free(range);
+        for (OffsetAllocator::Allocation unit : units)
+        {
+            if (unit.offset != OffsetAllocator::Allocation::NO_SPACE) allocator.free(unit);
+        }
+        REQUIRE(allocator.chunkCount() == 1);
+        REQUIRE(allocator.storageReport().totalFreeSpace == 4096);
+        REQUIRE(allocator.allocator().validate());
+    }
+    
+    TEST_CASE("unit allocations benchmark", "[offsetAllocator][!benchmark]")
+    {
+        // Descriptor heap: 90% single unit requests, random frees, 64K live slots
+        const uint32 slotCount = 64 * 1024;
+        
+        auto churn = [](auto& allocator, std::vector<OffsetAllocator::Allocation>& slots, uint32 operations)
+        {
+            uint32 rng = 12345;
+            uint32 failures = 0;
+            for (uint32 op = 0; op < operations; op++)
+            {
+                rng = rng * 1664525 + 1013904223;
+                OffsetAllocator::Allocation& slot = slots[(rng >> 8) % slots.size()];
+                if (slot.metadata != OffsetAllocator::Allocation::NO_SPACE) allocator.free(slot);
+                rng = rng * 1664525 + 1013904223;
+                slot = allocator.allocate((rng >> 8) % 10 ? 1 : 2 + (rng >> 16) % 15);
+                if (slot.offset == OffsetAllocator::Allocation::NO_SPACE) failures++;
+            }
+            return failures;
+        };
+        
+        // Node metadata after filling the heap
+        {
+            OffsetAllocator::Allocator binned(1024 * 1024);
+            OffsetAllocator::UnitAllocator unit(1024 * 1024);
+            std::vector<OffsetAllocator::Allocation> binnedSlots(slotCount), unitSlots(slotCount);
+            churn(binned, binnedSlots, 1000000);
+            churn(unit, unitSlots, 1000000);
+            OffsetAllocator::HeapDump binnedDump, unitDump;
+            OffsetAllocator::captureHeapDump(binned, binnedDump);
+            OffsetAllocator::captureHeapDump(unit.allocator(), unitDump);
+            printf("binned: live nodes=%u\n", binnedDump.maxAllocs - binnedDump.freeOffset - 1);
+            printf("unit:   live nodes=%u chunks=%u\n", unitDump.maxAllocs - unitDump.freeOffset - 1, unit.chunkCount());
+        }
+        
+        std::vector<OffsetAllocator::Allocation> slots(slotCount);
+        BENCHMARK("binned 1M churn")
+        {
+            OffsetAllocator::Allocator allocator(1024 * 1024);
+            slots.assign(slotCount, {});
+            return churn(allocator, slots, 1000000);
+        };
+        BENCHMARK("unit 1M churn")
+        {
+            OffsetAllocator::UnitAllocator allocator(1024 * 1024);
+            slots.assign(slotCount, {});
+            return churn(allocator, slots, 1000000);
+        };
+    }
+
+    struct CountingHooks : OffsetAllocator::NoHooks
+    {
+        uint32 allocations = 0;
+        uint32 frees = 0;
+        uint32 failures = 0;
+        
+        void onAllocate(uint64, uint64, uint32) { allocations++; }
+        void onFree(uint64, uint64, uint32) { frees++; }
+        void onFailure(uint64) { failures++; }
+    };
+    
+    struct SmallHeapPolicy : OffsetAllocator::DefaultPolicy
+    {
+        using Index = OffsetAllocator::uint16;
+        using Offset = OffsetAllocator::uint16;
+        static constexpr uint32 MANTISSA_BITS = 2;
+        static constexpr OffsetAllocator::BinOrder BIN_ORDER = OffsetAllocator::BinOrder::FIFO;
+        template<typename Node, typename Index> using Storage = OffsetAllocator::InlineStorage<256>::Type<Node, Index>;
+        using Hooks = CountingHooks;
+    };
+    
+    struct HugeHeapPolicy : OffsetAllocator::DefaultPolicy
+    {
+        using Offset = OffsetAllocator::uint64;
+        static constexpr uint32 MANTISSA_BITS = 4;
+    };
+    
+    template<typename AllocatorA, typename AllocatorB>
+    static void churnSameOffsets(AllocatorA& a, AllocatorB& b, uint32 operations, uint32 maxSize)
+    {
+        std::vector<decltype(a.allocate(1))> slotsA(512);
+        std::vector<decltype(b.allocate(1))> slotsB(512);
+        uint32 rng = 12345;
+        uint32 mismatches = 0;
+        for (uint32 op = 0; op < operations; op++)
+        {
+            rng = rng * 1664525 + 1013904223;
+            uint32 slot = (rng >> 8) % 512;
+            if (slotsA[slot].offset != OffsetAllocator::Allocation::NO_SPACE)
+            {
+                a.free(slotsA[slot]);
+                b.free(slotsB[slot]);
+            }
+            rng = rng * 1664525 + 1013904223;
+            uint32 size = 1 + (rng >> 8) % maxSize;
+            slotsA[slot] = a.allocate(size);
+            slotsB[slot] = b.allocate(size);
+            if ((uint64)slotsA[slot].offset != (uint64)slotsB[slot].offset) mismatches++;
+        }
+        REQUIRE(mismatches == 0);
+    }
+    
+    TEST_CASE("basic allocator", "[offsetAllocator]")
+    {
+        SECTION("default policy matches Allocator")
+        {
+            OffsetAllocator::Allocator reference(1024 * 1024, 1024);
+            OffsetAllocator::BasicAllocator<> allocator(1024 * 1024, 1024);
+            churnSameOffsets(reference, allocator, 20000, 16 * 1024);
+            REQUIRE(allocator.storageReport().totalFreeSpace == reference.storageReport().totalFreeSpace);
+            REQUIRE(allocator.storageReport().largestFreeRegion == reference.storageReport().largestFreeRegion);
+        }
+        
+        SECTION("16 bit, FIFO, inline storage, hooks")
+        {
+            OffsetAllocator::BasicAllocator<SmallHeapPolicy> allocator(60000, 256);
+            static_assert(sizeof(OffsetAllocator::BasicAllocator<SmallHeapPolicy>::Node) == 14);
+            
+            // FIFO: Equal sized free nodes are reused oldest first (96 = exact size class with 2 mantissa bits)
+            OffsetAllocator::BasicAllocator<SmallHeapPolicy>::Allocation a[6];
+            for (uint32 i = 0; i < 6; i++) a[i] = allocator.allocate(96);
+            allocator.free(a[1]);
+            allocator.free(a[3]);
+            REQUIRE(allocator.allocate(96).offset == a[1].offset);
+            REQUIRE(allocator.allocate(96).offset == a[3].offset);
+            REQUIRE(allocator.allocate(60000).offset == OffsetAllocator::BasicAllocator<SmallHeapPolicy>::Allocation::NO_SPACE);
+            REQUIRE(allocator.hooks().allocations == 8);
+            REQUIRE(allocator.hooks().frees == 2);
+            REQUIRE(allocator.hooks().failures == 1);
+            
+            // Random churn: Everything merges back
+            std::vector<OffsetAllocator::BasicAllocator<SmallHeapPolicy>::Allocation> slots(64);
+            uint32 rng = 777;
+            for (uint32 op = 0; op < 10000; op++)
+            {
+                rng = rng * 1664525 + 1013904223;
+                auto& slot = slots[(rng >> 8) % 64];
+                if (slot.metadata != 0xffff) allocator.free(slot);
+                slot = allocator.allocate(1 + (rng >> 16) % 500);
+            }
+            for (auto& slot : slots) if (slot.metadata != 0xffff) allocator.free(slot);
+        }
+        
+        SECTION("batch free, prewarm, compact with FIFO bins")
+        {
+            using Small = OffsetAllocator::BasicAllocator<SmallHeapPolicy>;
+            Small allocator(60000, 256);
+            Small::Allocation a[32];
+            for (uint32 i = 0; i < 32; i++) a[i] = allocator.allocate(100 + i);
+
+            // Every other allocation: Batch free keeps the FIFO tails consistent
+            Small::Allocation batch[16];
+            for (uint32 i = 0; i < 16; i++) batch[i] = a[i * 2];
+            allocator.free(batch, 16);
+            REQUIRE(allocator.validate());
+            REQUIRE(allocator.hooks().frees == 16);
+
+            OffsetAllocator::uint16 sizes[] = {64};
+            uint32 counts[] = {8};
+            REQUIRE(allocator.prewarm(sizes, counts, 1) == 8);
+            REQUIRE(allocator.validate());
+            allocator.unwarm();
+            REQUIRE(allocator.validate());
+
+            // Live nodes renumbered into a dense prefix: Handles follow the map
+            OffsetAllocator::uint16 oldToNew[256];
+            uint32 liveNodes = allocator.usedNodes();
+            REQUIRE(allocator.compactMetadata(liveNodes + 1, oldToNew));
+            REQUIRE(allocator.validate());
+            for (uint32 i = 0; i < 16; i++)
+            {
+                Small::Allocation live = a[i * 2 + 1];
+                live.metadata = oldToNew[live.metadata];
+                REQUIRE(allocator.allocationSize(live) == 100 + i * 2 + 1);
+                allocator.free(live);
+            }
+            REQUIRE(allocator.validate());
+            REQUIRE(allocator.usedNodes() == 1);
+            REQUIRE(allocator.storageReport().totalFreeSpace == 60000);
+        }
+
+        SECTION("64 bit offsets")
+        {
+            OffsetAllocator::BasicAllocator<HugeHeapPolicy> allocator(1ull << 40, 1024);
+            auto big = allocator.allocate(1ull << 36);
+            auto small = allocator.allocate(1000);
+            REQUIRE(big.offset == 0);
+            REQUIRE(small.offset == 1ull << 36);
+            REQUIRE(allocator.allocationSize(big) == 1ull << 36);
+            REQUIRE(allocator.storageReport().totalFreeSpace == (1ull << 40) - (1ull << 36) - 1000);
+            allocator.free(big);
+            allocator.free(small);
+            REQUIRE(allocator.storageReport().largestFreeRegion == 1ull << 40);
+        }
+    }
+    
+    TEST_CASE("basic allocator benchmark", "[offsetAllocator][!benchmark]")
+    {
+        // Default policy vs Allocator: Same churn workload as the best fit benchmark
+        const uint32 poolSize = 256 * 1024 * 1024;
+        const uint32 slotCount = 6144;
+        
+        auto churn = [](auto& allocator, auto& slots, uint32 operations)
+        {
+            uint32 rng = 12345;
+            uint32 failures = 0;
+            for (uint32 op = 0; op < operations; op++)
+            {
+                rng = rng * 1664525 + 1013904223;
+                auto& slot = slots[(rng >> 8) % slots.size()];
+                if (slot.offset != 0xffffffff) allocator.free(slot);
+                rng = rng * 1664525 + 1013904223;
+                slot = allocator.allocate(64 + (rng >> 8) % (64 * 1024));
+                if (slot.offset == 0xffffffff) failures++;
+            }
+            return failures;
+        };
+        
+        std::vector<OffsetAllocator::Allocation> slots(slotCount);
+        std::vector<OffsetAllocator::BasicAllocator<>::Allocation> basicSlots(slotCount);
+        BENCHMARK("Allocator 1M churn")
+        {
+            OffsetAllocator::Allocator allocator(poolSize);
+            slots.assign(slotCount, {});
+            return churn(allocator, slots, 1000000);
+        };
+        BENCHMARK("BasicAllocator<DefaultPolicy> 1M churn")
+        {
+            OffsetAllocator::BasicAllocator<> allocator(poolSize);
+            basicSlots.assign(slotCount, {});
+            return churn(allocator, basicSlots, 1000000);
+        };
+    }
+
+    TEST_CASE("leases", "[offsetAllocator]")
+    {
+        OffsetAllocator::LeaseAllocator leases(1024 * 1024, 4096, 1000);
+        
+        OffsetAllocator::Allocation a = leases.allocateLease(100, 10);
+        OffsetAllocator::Allocation b = leases.allocateLease(100, 10);
+        OffsetAllocator::Allocation c = leases.allocateLease(100, 5000);
+        REQUIRE(leases.tick(1009) == 0);
+        REQUIRE(leases.renew(b, 100));
+        
+        // a expires at 1010, b was renewed to 1109
+        REQUIRE(leases.tick(1010) == 1);
+        REQUIRE(leases.expired()[0].offset == a.offset);
+        
+        // Expired lease: free and renew are no-ops, also after its space is leased again
+        REQUIRE(!leases.free(a));
+        REQUIRE(!leases.renew(a, 10));
+        OffsetAllocator::Allocation reused = leases.allocateLease(300, 10);
+        REQUIRE(!leases.free(a));
+        REQUIRE(leases.leaseCount() == 3);
+        REQUIRE(leases.free(reused));
+        
+        // Live node, different offset: Stale handle
+        REQUIRE(!leases.free({.offset = b.offset + 16, .metadata = b.metadata}));
+        REQUIRE(leases.leaseCount() == 2);
+        REQUIRE(leases.allocator().validate());
+        REQUIRE(leases.tick(1108) == 0);
+        REQUIRE(leases.tick(1200) == 1);
+        REQUIRE(leases.expired()[0].offset == b.offset);
+        
+        // Long leases cascade down the wheel and expire on time
+        REQUIRE(leases.tick(5999) == 0);
+        REQUIRE(leases.tick(6000) == 1);
+        REQUIRE(leases.leaseCount() == 0);
+        REQUIRE(leases.allocator().storageReport().totalFreeSpace == 1024 * 1024);
+        (void)c;
+        
+        SECTION("random")
+        {
+            // Every lease expires in the first tick that reaches its expiry, regardless of wheel level
+            std::vector<OffsetAllocator::Allocation> live;
+            std::vector<uint64> expiryOf(4096, 0);
+            uint32 rng = 4242;
+            uint64 now = leases.now();
+            for (uint32 step = 0; step < 2000; step++)
+            {
+                for (uint32 i = 0; i < 4; i++)
+                {
+                    rng = rng * 1664525 + 1013904223;
+                    uint64 ttl = 1 + (rng >> 8) % ((rng & 1) ? 200 : 400000);
+                    OffsetAllocator::Allocation allocation = leases.allocateLease(16 + (rng >> 20) % 256, ttl);
+                    if (allocation.offset == OffsetAllocator::Allocation::NO_SPACE) continue;
+                    expiryOf[allocation.metadata] = now + ttl;
+                    live.push_back(allocation);
+                }
+                
+                // Renew or release some
+                rng = rng * 1664525 + 1013904223;
+                if (!live.empty())
+                {
+                    uint32 index = (rng >> 8) % live.size();
+                    if (rng & 1)
+                    {
+                        REQUIRE(leases.renew(live[index], 300));
+                        expiryOf[live[index].metadata] = now + 300;
+                    }
+                    else
+                    {
+                        REQUIRE(leases.free(live[index]));
+                        live[index] = live.back();
+                        live.pop_back();
+                    }
+                }
+                
+                rng = rng * 1664525 + 1013904223;
+                uint64 next = now + 1 + (rng >> 8) % ((rng & 3) ? 50 : 5000);
+                uint32 expiredCount = leases.tick(next);
+                
+                uint32 expected = 0;
+                for (uint32 j = 0; j < live.size(); )
+                {
+                    if (expiryOf[live[j].metadata] <= next)
+                    {
+                        expected++;
+                        live[j] = live.back();
+                        live.pop_back();
+                    }
+                    else j++;
+                }
+                uint32 early = 0;
+                for (OffsetAllocator::Allocation allocation : leases.expired()) early += expiryOf[allocation.metadata] > next;
+                REQUIRE((expiredCount == expected && early == 0));
+                now = next;
+            }
+            REQUIRE(leases.leaseCount() == live.size());
+            REQUIRE(leases.allocator().validate());
+            
+            leases.tick(now + 1000000);
+            REQUIRE(leases.leaseCount() == 0);
+            REQUIRE(leases.allocator().storageReport().totalFreeSpace == 1024 * 1024);
+        }
+    }
 }
@@ -0,0 +1,399 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorTrace.hpp"
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+namespace OffsetAllocator
+{
+    // NOTE: Fixed size fields are stored in native byte order (little endian on all supported platforms)
+    static constexpr uint32 TRACE_MAGIC = 0x5254414f; // "OATR"
+    static constexpr uint32 TRACE_VERSION = 2;
+
+    struct TraceFileHeader
+    {
+        uint32 magic;
+        uint32 version;
+    };
+
+    struct TraceBlockHeader
+    {
+        uint32 byteSize; // Excluding this header
+        uint32 eventCount;
+    };
+
+    struct TraceTrailer
+    {
+        uint64 indexOffset; // uint64 file offset per block
+        uint64 totalEvents;
+        uint32 blockCount;
+        uint32 magic;
+    };
+
+    // Event encoding: Tag byte {op : 2, offset delta bytes - 1 : 2, node bytes - 1 : 2, size bytes - 1 : 2}, then the
+    // three fields little endian in 1-4 bytes each. All lengths are known from the tag: No per byte continuation
+    // branches (data dependent, mispredicted) and no dependency chain through the field bytes.
+    static constexpr uint32 MAX_EVENT_BYTES = 1 + 3 * 4;
+
+    inline uint32 fieldBytes(uint32 value)
+    {
+        return 1 + (value >= 1u << 8) + (value >= 1u << 16) + (value >= 1u << 24);
+    }
+
+    // Caller guarantees 4 writable bytes
+    inline uint8* writeField(uint8* out, uint32 value, uint32 bytes)
+    {
+        memcpy(out, &value, sizeof(value));
+        return out + bytes;
+    }
+
+    // Caller guarantees 4 readable bytes
+    inline uint32 readField(const uint8* in, uint32 bytes)
+    {
+        uint32 value;
+        memcpy(&value, in, sizeof(value));
+        return value & (0xffffffff >> (32 - bytes * 8));
+    }
+
+    inline uint32 zigzagEncode(uint32 delta) { return (delta << 1) ^ (uint32)((int)delta >> 31); }
+    inline uint32 zigzagDecode(uint32 value) { return (value >> 1) ^ (0 - (value & 1)); }
+
+    // TraceWriter...
+    TraceWriter::TraceWriter(FILE* file, uint32 blockEventCount) :
+        m_file(file),
+        m_blockEventCount(blockEventCount ? blockEventCount : 1),
+        m_blockEvents(0),
+        m_prevOffset(0),
+        m_fileOffset(0),
+        m_totalEvents(0),
+        m_finished(false),
+        m_failed(false)
+    {
+        // Worst case event. The last 4 byte field store ends there too.
+        m_block.reserve(sizeof(TraceBlockHeader) + m_blockEventCount * MAX_EVENT_BYTES);
+        m_block.resize(sizeof(TraceBlockHeader));
+
+        TraceFileHeader header = {.magic = TRACE_MAGIC, .version = TRACE_VERSION};
+        m_failed |= fwrite(&header, sizeof(header), 1, m_file) != 1;
+        m_fileOffset += sizeof(header);
+    }
+
+    TraceWriter::~TraceWriter()
+    {
+        finish();
+    }
+
+    void TraceWriter::allocate(uint32 size, Allocation allocation)
+    {
+        uint32 nodePlusOne = allocation.offset == Allocation::NO_SPACE ? 0 : (uint32)allocation.metadata + 1;
+        writeEvent(TraceEvent::ALLOCATE, nodePlusOne ? allocation.offset : m_prevOffset, size, nodePlusOne);
+    }
+
+    void TraceWriter::free(Allocation allocation)
+    {
+        writeEvent(TraceEvent::FREE, allocation.offset, 0, (uint32)allocation.metadata + 1);
+    }
+
+    void TraceWriter::writeEvent(uint32 op, uint32 offset, uint32 size, uint32 nodePlusOne)
+    {
+        ASSERT(!m_finished);
+
+        uint32 used = (uint32)m_block.size();
+        m_block.resize(used + MAX_EVENT_BYTES);
+        uint8* start = m_block.data() + used;
+        uint8* out = start;
+
+        // Size is always present (1 byte for free): Keeps the decode loop branch free
+        uint32 delta = zigzagEncode(offset - m_prevOffset);
+        uint32 deltaBytes = fieldBytes(delta);
+        uint32 nodeBytes = fieldBytes(nodePlusOne);
+        uint32 sizeBytes = fieldBytes(size);
+        *out++ = (uint8)(op | (deltaBytes - 1) << 2 | (nodeBytes - 1) << 4 | (sizeBytes - 1) << 6);
+        out = writeField(out, delta, deltaBytes);
+        out = writeField(out, nodePlusOne, nodeBytes);
+        out = writeField(out, size, sizeBytes);
+        m_block.resize(used + (uint32)(out - start));
+
+        m_prevOffset = offset;
+        if (++m_blockEvents == m_blockEventCount) flushBlock();
+    }
+
+    void TraceWriter::flushBlock()
+    {
+        if (m_blockEvents == 0) return;
+
+        TraceBlockHeader header = {.byteSize = (uint32)(m_block.size() - sizeof(TraceBlockHeader)), .eventCount = m_blockEvents};
+        memcpy(m_block.data(), &header, sizeof(header));
+        m_failed |= fwrite(m_block.data(), m_block.size(), 1, m_file) != 1;
+
+        m_blockOffsets.push_back(m_fileOffset);
+        m_fileOffset += m_block.size();
+        m_totalEvents += m_blockEvents;
+
+        // Next block decodes independently: Reset delta state
+        m_block.resize(sizeof(TraceBlockHeader));
+        m_blockEvents = 0;
+        m_prevOffset = 0;
+    }
+
+    bool TraceWriter::finish()
+    {
+        if (m_finished) return !m_failed;
+        m_finished = true;
+
+        flushBlock();
+
+        TraceTrailer trailer = {
+            .indexOffset = m_fileOffset,
+            .totalEvents = m_totalEvents,
+            .blockCount = (uint32)m_blockOffsets.size(),
+            .magic = TRACE_MAGIC};
+        if (!m_blockOffsets.empty())
+            m_failed |= fwrite(m_blockOffsets.data(), sizeof(uint64) * m_blockOffsets.size(), 1, m_file) != 1;
+        m_failed |= fwrite(&trailer, sizeof(trailer), 1, m_file) != 1;
+        m_failed |= fflush(m_file) != 0;
+        return !m_failed;
+    }
+
+    // TraceReader...
+    TraceReader::TraceReader() :
+        m_data(nullptr),
+        m_dataSize(0),
+        m_blockIndex(nullptr),
+        m_blockCount(0),
+        m_totalEvents(0),
+        m_block(0),
+        m_cursor(nullptr),
+        m_blockEnd(nullptr),
+        m_blockEventsLeft(0),
+        m_prevOffset(0),
+        m_corrupted(false),
+        m_mapping(nullptr)
+    {
+    }
+
+    TraceReader::~TraceReader()
+    {
+        close();
+    }
+
+    bool TraceReader::open(const char* path)
+    {
+        close();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping) return false;
+        m_data = (const uint8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!m_data)
+        {
+            CloseHandle(mapping);
+            return false;
+        }
+        m_mapping = mapping;
+        m_dataSize = (uint64)fileSize.QuadPart;
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat fileStat;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+            data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+        madvise(data, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+        m_data = (const uint8*)data;
+        m_dataSize = (uint64)fileStat.st_size;
+#endif
+
+        // Validate header and trailer
+        TraceFileHeader header;
+        TraceTrailer trailer;
+        if (m_dataSize < sizeof(header) + sizeof(trailer))
+        {
+            close();
+            return false;
+        }
+        memcpy(&header, m_data, sizeof(header));
+        memcpy(&trailer, m_data + m_dataSize - sizeof(trailer), sizeof(trailer));
+        if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION || trailer.magic != TRACE_MAGIC ||
+            trailer.indexOffset < sizeof(header) || trailer.indexOffset > m_dataSize ||
+            trailer.indexOffset + (uint64)trailer.blockCount * sizeof(uint64) + sizeof(trailer) != m_dataSize)
+        {
+            close();
+            return false;
+        }
+
+        m_blockIndex = m_data + trailer.indexOffset;
+        m_blockCount = trailer.blockCount;
+        m_totalEvents = trailer.totalEvents;
+        seekBlock(0);
+        return true;
+    }
+
+    void TraceReader::close()
+    {
+        if (!m_data) return;
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle((HANDLE)m_mapping);
+#else
+        munmap((void*)m_data, (size_t)m_dataSize);
+#endif
+        m_data = nullptr;
+        m_mapping = nullptr;
+        m_dataSize = 0;
+        m_blockIndex = nullptr;
+        m_blockCount = 0;
+        m_totalEvents = 0;
+        m_cursor = nullptr;
+        m_blockEnd = nullptr;
+        m_blockEventsLeft = 0;
+        m_corrupted = false;
+    }
+
+    bool TraceReader::seekBlock(uint32 blockIndex)
+    {
+        m_block = blockIndex;
+        m_blockEventsLeft = 0;
+        m_prevOffset = 0;
+        if (blockIndex >= m_blockCount) return false;
+
+        // Blocks live between the file header and the block index. Smallest event is 4 bytes.
+        uint64 blockOffset;
+        memcpy(&blockOffset, m_blockIndex + blockIndex * sizeof(uint64), sizeof(uint64));
+        uint64 blocksEnd = (uint64)(m_blockIndex - m_data);
+        TraceBlockHeader header;
+        if (blockOffset < sizeof(TraceFileHeader) || blockOffset > blocksEnd || blocksEnd - blockOffset < sizeof(header))
+        {
+            m_corrupted = true;
+            return false;
+        }
+        memcpy(&header, m_data + blockOffset, sizeof(header));
+        if (header.byteSize > blocksEnd - blockOffset - sizeof(header) || (uint64)header.eventCount * 4 > header.byteSize)
+        {
+            m_corrupted = true;
+            return false;
+        }
+
+        m_cursor = m_data + blockOffset + sizeof(header);
+        m_blockEnd = m_cursor + header.byteSize;
+        m_blockEventsLeft = header.eventCount;
+        return true;
+    }
+
+    uint32 TraceReader::read(TraceEvent* events, uint32 maxEvents)
+    {
+        uint32 count = 0;
+        while (count < maxEvents && !m_corrupted)
+        {
+            if (m_blockEventsLeft == 0)
+            {
+                if (!seekBlock(m_block + 1)) break;
+            }
+
+            // Tight decode loop for the rest of this block
+            uint32 blockCount = m_blockEventsLeft < maxEvents - count ? m_blockEventsLeft : maxEvents - count;
+            const uint8* in = m_cursor;
+            const uint8* end = m_blockEnd;
+            uint32 prevOffset = m_prevOffset;
+            uint32 decoded = 0;
+            for (; decoded < blockCount; decoded++)
+            {
+                TraceEvent& event = events[count + decoded];
+                if (in == end) break;
+                uint32 tag = *in++;
+                uint32 deltaBytes = (tag >> 2 & 3) + 1;
+                uint32 nodeBytes = (tag >> 4 & 3) + 1;
+                uint32 sizeBytes = (tag >> 6) + 1;
+                uint32 eventBytes = deltaBytes + nodeBytes + sizeBytes;
+                event.op = tag & 3;
+                if (event.op > TraceEvent::FREE || eventBytes > (uint32)(end - in)) break;
+
+                // Near the block end the 4 byte field loads would read past it: Copy the event to a padded buffer
+                const uint8* fields = in;
+                uint8 padded[MAX_EVENT_BYTES - 1] = {};
+                if ((uint32)(end - in) < MAX_EVENT_BYTES - 1)
+                {
+                    memcpy(padded, in, eventBytes);
+                    fields = padded;
+                }
+                prevOffset += zigzagDecode(readField(fields, deltaBytes));
+                event.offset = prevOffset;
+                event.node = readField(fields + deltaBytes, nodeBytes) - 1; // 0 -> NO_SPACE
+                event.size = readField(fields + deltaBytes + nodeBytes, sizeBytes);
+                in += eventBytes;
+            }
+
+            // Overrun or unknown op: Return the events decoded so far and stop
+            if (decoded < blockCount)
+            {
+                m_corrupted = true;
+                count += decoded;
+                break;
+            }
+            m_cursor = in;
+            m_prevOffset = prevOffset;
+            m_blockEventsLeft -= blockCount;
+            count += blockCount;
+        }
+        return count;
+    }
+
+    TraceReplayResult replayTrace(TraceReader& reader, Allocator& allocator)
+    {
+        TraceReplayResult result = {};
+        std::vector<Allocation> live;
+        TraceEvent events[1024];
+
+        while (uint32 count = reader.read(events, 1024))
+        {
+            for (uint32 i = 0; i < count; i++)
+            {
+                const TraceEvent& event = events[i];
+                if (event.op == TraceEvent::ALLOCATE)
+                {
+                    Allocation allocation = allocator.allocate(event.size);
+                    if (allocation.offset == Allocation::NO_SPACE) result.failedAllocations++;
+                    if (event.node == Allocation::NO_SPACE) continue;
+                    if (allocation.offset != event.offset) result.offsetMismatches++;
+
+                    // Traced node index identifies the allocation for the matching free
+                    if (event.node >= live.size()) live.resize(event.node + 1);
+                    live[event.node] = allocation;
+                }
+                else if (event.node < live.size())
+                {
+                    if (live[event.node].offset != Allocation::NO_SPACE) allocator.free(live[event.node]);
+                    live[event.node] = {};
+                }
+            }
+            result.events += count;
+        }
+        return result;
+    }
+}
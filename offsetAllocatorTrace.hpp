@@ -0,0 +1,103 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <stdio.h>
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Compact allocator trace format:
+    //   File header | Block 0 | Block 1 | ... | Block index | Trailer
+    // Blocks are independently decodable (delta state resets per block). Events inside a block:
+    //   tag byte (op and the byte length of each field), zigzag offset delta, node + 1 (0 = failed allocation),
+    //   size (0 for free). Fields are 1-4 bytes little endian.
+    struct TraceEvent
+    {
+        static constexpr uint32 ALLOCATE = 0;
+        static constexpr uint32 FREE = 1;
+
+        uint32 op;
+        uint32 offset;
+        uint32 size;    // allocate only
+        uint32 node;    // Allocation::metadata of the traced allocator. NO_SPACE = failed allocation.
+    };
+
+    class TraceWriter
+    {
+    public:
+        TraceWriter(FILE* file, uint32 blockEventCount = 64 * 1024);
+        ~TraceWriter();
+
+        void allocate(uint32 size, Allocation allocation);
+        void free(Allocation allocation);
+
+        // Writes the last block, the block index and the trailer. Called by the destructor if not called before.
+        bool finish();
+
+    private:
+        void writeEvent(uint32 op, uint32 offset, uint32 size, uint32 nodePlusOne);
+        void flushBlock();
+
+        FILE* m_file;
+        uint32 m_blockEventCount;
+        uint32 m_blockEvents;
+        uint32 m_prevOffset;
+        uint64 m_fileOffset;
+        uint64 m_totalEvents;
+        bool m_finished;
+        bool m_failed;
+        std::vector<uint8> m_block;
+        std::vector<uint64> m_blockOffsets;
+    };
+
+    // Memory maps the trace file and streams events out of it
+    class TraceReader
+    {
+    public:
+        TraceReader();
+        ~TraceReader();
+
+        bool open(const char* path);
+        void close();
+
+        uint64 eventCount() const { return m_totalEvents; }
+        uint32 blockCount() const { return m_blockCount; }
+
+        // Decodes up to maxEvents from the current position. Returns 0 at end of trace.
+        // A block or event that runs past its bounds, or an unknown op, stops reading and sets corrupted().
+        uint32 read(TraceEvent* events, uint32 maxEvents);
+        bool seekBlock(uint32 blockIndex);
+        bool corrupted() const { return m_corrupted; }
+
+    private:
+        const uint8* m_data;
+        uint64 m_dataSize;
+        const uint8* m_blockIndex;
+        uint32 m_blockCount;
+        uint64 m_totalEvents;
+
+        // Streaming cursor
+        uint32 m_block;
+        const uint8* m_cursor;
+        const uint8* m_blockEnd;
+        uint32 m_blockEventsLeft;
+        uint32 m_prevOffset;
+        bool m_corrupted;
+
+        void* m_mapping; // platform handle
+    };
+
+    struct TraceReplayResult
+    {
+        uint64 events;
+        uint64 failedAllocations;
+        uint64 offsetMismatches; // Replay placed an allocation at a different offset than the trace
+    };
+
+    // Replays the trace (from the reader's current position) against the allocator.
+    TraceReplayResult replayTrace(TraceReader& reader, Allocator& allocator);
+}
@@ -0,0 +1,136 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#include "offsetAllocatorUnit.hpp"
+
+#include <bit>
+
+#ifdef DEBUG
+#include <assert.h>
+#define ASSERT(x) assert(x)
+#else
+#define ASSERT(x)
+#endif
+
+namespace OffsetAllocator
+{
+    static constexpr uint64 ALL_FREE = ~0ull;
+
+    UnitAllocator::UnitAllocator(uint32 size, uint32 maxAllocs) :
+        m_allocator(size, maxAllocs),
+        m_nodeChunks(maxAllocs, NO_CHUNK),
+        m_emptyChunk(NO_CHUNK),
+        m_freeUnits(0)
+    {
+    }
+
+    Allocation UnitAllocator::allocate(uint32 size)
+    {
+        if (size == 1)
+        {
+            Allocation allocation = allocateUnit();
+            if (allocation.offset != Allocation::NO_SPACE) return allocation;
+        }
+        return m_allocator.allocate(size);
+    }
+
+    Allocation UnitAllocator::allocateUnit()
+    {
+        if (m_partialChunks.empty())
+        {
+            // Carve a new chunk. No contiguous 64 units left: Caller falls back to the binned path.
+            Allocation span = m_allocator.allocate(CHUNK_UNITS);
+            if (span.offset == Allocation::NO_SPACE) return {};
+
+            uint32 chunkIndex;
+            if (!m_freeChunks.empty())
+            {
+                chunkIndex = m_freeChunks.back();
+                m_freeChunks.pop_back();
+            }
+            else
+            {
+                chunkIndex = (uint32)m_chunks.size();
+                m_chunks.push_back({});
+            }
+            m_chunks[chunkIndex] = {.span = span, .freeMask = ALL_FREE, .partialIndex = (uint32)m_partialChunks.size()};
+            m_partialChunks.push_back(chunkIndex);
+            m_nodeChunks[span.metadata] = chunkIndex;
+            m_freeUnits += CHUNK_UNITS;
+        }
+
+        uint32 chunkIndex = m_partialChunks.back();
+        Chunk& chunk = m_chunks[chunkIndex];
+        if (chunkIndex == m_emptyChunk) m_emptyChunk = NO_CHUNK;
+
+        uint32 slot = std::countr_zero(chunk.freeMask);
+        chunk.freeMask &= chunk.freeMask - 1;
+        m_freeUnits--;
+        if (chunk.freeMask == 0)
+        {
+            m_partialChunks.pop_back();
+            chunk.partialIndex = NO_CHUNK;
+        }
+        return {.offset = chunk.span.offset + slot, .metadata = chunk.span.metadata};
+    }
+
+    void UnitAllocator::free(Allocation allocation)
+    {
+        ASSERT(allocation.metadata != Allocation::NO_SPACE);
+        uint32 chunkIndex = m_nodeChunks[allocation.metadata];
+        if (chunkIndex == NO_CHUNK)
+        {
+            m_allocator.free(allocation);
+            return;
+        }
+        freeUnit(chunkIndex, allocation.offset);
+    }
+
+    void UnitAllocator::freeUnit(uint32 chunkIndex, uint32 offset)
+    {
+        Chunk& chunk = m_chunks[chunkIndex];
+        uint32 slot = offset - chunk.span.offset;
+        ASSERT(slot < CHUNK_UNITS);
+        ASSERT((chunk.freeMask & (1ull << slot)) == 0); // Double delete check
+
+        if (chunk.freeMask == 0)
+        {
+            chunk.partialIndex = (uint32)m_partialChunks.size();
+            m_partialChunks.push_back(chunkIndex);
+        }
+        chunk.freeMask |= 1ull << slot;
+        m_freeUnits++;
+        if (chunk.freeMask != ALL_FREE) return;
+
+        // Fully free: Keep one, release the previous empty chunk back to the allocator
+        uint32 releaseIndex = m_emptyChunk;
+        m_emptyChunk = chunkIndex;
+        if (releaseIndex == NO_CHUNK) return;
+
+        Chunk& release = m_chunks[releaseIndex];
+        uint32 lastChunkIndex = m_partialChunks.back();
+        m_partialChunks[release.partialIndex] = lastChunkIndex;
+        m_chunks[lastChunkIndex].partialIndex = release.partialIndex;
+        m_partialChunks.pop_back();
+
+        m_nodeChunks[release.span.metadata] = NO_CHUNK;
+        m_allocator.free(release.span);
+        m_freeUnits -= CHUNK_UNITS;
+        release = {};
+        m_freeChunks.push_back(releaseIndex);
+    }
+
+    uint32 UnitAllocator::allocationSize(Allocation allocation) const
+    {
+        if (allocation.offset == Allocation::NO_SPACE) return 0;
+        if (m_nodeChunks[allocation.metadata] != NO_CHUNK) return 1;
+        return m_allocator.allocationSize(allocation);
+    }
+
+    StorageReport UnitAllocator::storageReport() const
+    {
+        StorageReport report = m_allocator.storageReport();
+        report.totalFreeSpace += m_freeUnits;
+        return report;
+    }
+}
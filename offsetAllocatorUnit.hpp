@@ -0,0 +1,56 @@
+// (C) Sebastian Aaltonen 2023
+// MIT License (see file: LICENSE)
+
+#pragma once
+
+#include "offsetAllocator.hpp"
+
+#include <vector>
+
+namespace OffsetAllocator
+{
+    // Allocator with a unit size fast path (descriptor / ID heaps). Single unit requests are served from 64 unit
+    // chunks carved from the Allocator, each managed by a 64 bit free mask (ctz slot search). One node per chunk
+    // instead of a node + split per unit. Multi unit requests use the binned path as is.
+    // Same Allocation handles: A unit allocation's metadata is its chunk's node index.
+    class UnitAllocator
+    {
+    public:
+        static constexpr uint32 CHUNK_UNITS = 64;
+
+        UnitAllocator(uint32 size, uint32 maxAllocs = 128 * 1024);
+
+        Allocation allocate(uint32 size);
+        void free(Allocation allocation);
+
+        uint32 allocationSize(Allocation allocation) const;
+
+        // Free unit slots in chunks count as free space. largestFreeRegion is the Allocator's.
+        StorageReport storageReport() const;
+        uint32 chunkCount() const { return (uint32)(m_chunks.size() - m_freeChunks.size()); }
+
+        // Read only: The chunk map is indexed by node index, renumbering nodes directly would leave it stale
+        const Allocator& allocator() const { return m_allocator; }
+
+    private:
+        static constexpr uint32 NO_CHUNK = 0xffffffff;
+
+        struct Chunk
+        {
+            Allocation span;
+            uint64 freeMask;        // Bit set = free unit
+            uint32 partialIndex;    // Position in m_partialChunks, NO_CHUNK when full
+        };
+
+        Allocation allocateUnit();
+        void freeUnit(uint32 chunkIndex, uint32 offset);
+
+        Allocator m_allocator;
+        std::vector<Chunk> m_chunks;
+        std::vector<uint32> m_freeChunks;       // Recycled chunk indices
+        std::vector<uint32> m_partialChunks;    // Chunks with free units. Allocation takes the last one.
+        std::vector<uint32> m_nodeChunks;       // Allocator node index -> chunk index (NO_CHUNK = regular allocation)
+        uint32 m_emptyChunk;                    // One fully free chunk is kept to avoid carve/release ping pong
+        uint32 m_freeUnits;
+    };
+}